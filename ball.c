@@ -1,79 +1,722 @@
 #include "ball.h"
+#include "ccd.h"
+#include "integrate.h"
+#include "shapes.h"
+#include "sleep.h"
 #include "utils.h"
 #include "window.h"
 #include "world.h"
 #include <math.h>
 
+#define IDLE_LIFETIME_TICKS ((BALL_IDLE_LIFETIME_MS * PHYSICS_HZ + 999) / 1000) // steps, in simulated time
 
-void UpdateBalls(Ball (*balls)[MAX_BALLS]) {
-    for (size_t i = 0; i < MAX_BALLS; ++i) {
-        Ball *ball = &(*balls)[i];
-        if (!ball->visible) continue;
+// a BALL_RADIUS circle of BALL_MASS, BALL_MATERIAL_DEFAULT and standing still
+static void resetBody(BallStore *balls, const size_t i) {
+    balls->radius[i] = BALL_RADIUS;
+    balls->inv_mass[i] = 1.0f / BALL_MASS;
+    balls->material[i] = BALL_MATERIAL_DEFAULT;
+    balls->shape[i] = BALL_SHAPE_CIRCLE;
+    balls->half_length[i] = 0;
+    balls->half_width[i] = BALL_RADIUS;
+    balls->angle[i] = 0;
+    balls->spin[i] = 0;
+    balls->inv_inertia[i] = 2.0f / (BALL_MASS * BALL_RADIUS * BALL_RADIUS);
+}
 
-        // check if the ball is idle, if so: reduce its lifetime
-        if (ball->idle) {
-            ball->remaining_lifetime -= FRAME_DELAY_MS;
+static const char *const pool_policy_names[BALL_POOL_POLICY_COUNT] = {
+        [BALL_POOL_REJECT] = "reject",
+        [BALL_POOL_RECYCLE_OLDEST_IDLE] = "oldest-idle",
+        [BALL_POOL_RECYCLE_OLDEST] = "oldest",
+};
 
-            if (ball->remaining_lifetime <= FRAME_DELAY_MS) {
-                // reset
-                ball->visible = false;
-                ball->idle = false;
-                ball->remaining_lifetime = BALL_IDLE_LIFETIME_MS;
-            }
+static void listAppend(BallList *list, const Uint32 i) {
+    list->next[i] = BALL_LIST_NONE;
+    list->prev[i] = list->tail;
+    if (list->tail != BALL_LIST_NONE) {
+        list->next[list->tail] = i;
+    } else {
+        list->head = i;
+    }
+    list->tail = i;
+}
+
+static void listRemove(BallList *list, const Uint32 i) {
+    const Uint32 next = list->next[i];
+    const Uint32 prev = list->prev[i];
+    if (prev != BALL_LIST_NONE) {
+        list->next[prev] = next;
+    } else {
+        list->head = next;
+    }
+    if (next != BALL_LIST_NONE) {
+        list->prev[next] = prev;
+    } else {
+        list->tail = prev;
+    }
+    list->next[i] = BALL_LIST_NONE;
+    list->prev[i] = BALL_LIST_NONE;
+}
+
+// grows every stream to `capacity` slots (a multiple of BALL_MASK_BITS) and puts the new slots on the free list
+static bool growBallStore(BallStore *balls, const size_t capacity) {
+    const size_t old = balls->capacity;
+
+#define GROW(field, alloc)                                                               \
+    do {                                                                                 \
+        void *grown = alloc(balls->field, capacity * sizeof(*balls->field));             \
+        if (!grown) return false;                                                        \
+        balls->field = grown;                                                            \
+    } while (0)
+
+    GROW(x, SDL_SIMDRealloc);
+    GROW(y, SDL_SIMDRealloc);
+    GROW(vx, SDL_SIMDRealloc);
+    GROW(vy, SDL_SIMDRealloc);
+    GROW(prev_x, SDL_SIMDRealloc);
+    GROW(prev_y, SDL_SIMDRealloc);
+    GROW(radius, SDL_SIMDRealloc);
+    GROW(inv_mass, SDL_SIMDRealloc);
+    GROW(material, SDL_SIMDRealloc);
+    GROW(shape, SDL_SIMDRealloc);
+    GROW(half_length, SDL_SIMDRealloc);
+    GROW(half_width, SDL_SIMDRealloc);
+    GROW(angle, SDL_SIMDRealloc);
+    GROW(spin, SDL_SIMDRealloc);
+    GROW(inv_inertia, SDL_SIMDRealloc);
+    GROW(expiry, SDL_realloc);
+    GROW(still_time, SDL_SIMDRealloc);
+    GROW(island_next, SDL_realloc);
+    GROW(island_prev, SDL_realloc);
+    GROW(active, SDL_realloc);
+    GROW(generation, SDL_realloc);
+    GROW(free_list, SDL_realloc);
+    GROW(spawned.next, SDL_realloc);
+    GROW(spawned.prev, SDL_realloc);
+    GROW(resting.next, SDL_realloc);
+    GROW(resting.prev, SDL_realloc);
+    GROW(remap, SDL_realloc);
+    GROW(remap_generation, SDL_realloc);
+#undef GROW
+
+    Uint64 *visible = SDL_realloc(balls->visible, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!visible) return false;
+    balls->visible = visible;
 
-            continue;
+    Uint64 *idle = SDL_realloc(balls->idle, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!idle) return false;
+    balls->idle = idle;
+
+    Uint64 *swept = SDL_realloc(balls->swept, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!swept) return false;
+    balls->swept = swept;
+
+    Uint64 *shaped = SDL_realloc(balls->shaped, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!shaped) return false;
+    balls->shaped = shaped;
+
+    Uint64 *timed = SDL_realloc(balls->timed, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!timed) return false;
+    balls->timed = timed;
+
+    Uint64 *recycled = SDL_realloc(balls->recycled, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!recycled) return false;
+    balls->recycled = recycled;
+
+    const size_t added = capacity - old;
+    SDL_memset(balls->x + old, 0, added * sizeof(float));
+    SDL_memset(balls->y + old, 0, added * sizeof(float));
+    SDL_memset(balls->vx + old, 0, added * sizeof(float));
+    SDL_memset(balls->vy + old, 0, added * sizeof(float));
+    SDL_memset(balls->prev_x + old, 0, added * sizeof(float));
+    SDL_memset(balls->prev_y + old, 0, added * sizeof(float));
+    SDL_memset(balls->visible + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+    SDL_memset(balls->idle + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+    SDL_memset(balls->swept + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+    SDL_memset(balls->shaped + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+    SDL_memset(balls->timed + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+    SDL_memset(balls->recycled + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+
+    // pushed in reverse so the lowest slot is handed out first
+    for (size_t i = capacity; i-- > old;) {
+        resetBody(balls, i);
+        balls->expiry[i] = 0;
+        balls->still_time[i] = 0;
+        balls->island_next[i] = i;
+        balls->island_prev[i] = i;
+        balls->generation[i] = 1;
+        balls->remap[i] = BALL_LIST_NONE;
+        balls->remap_generation[i] = 0;
+        balls->spawned.next[i] = balls->spawned.prev[i] = BALL_LIST_NONE;
+        balls->resting.next[i] = balls->resting.prev[i] = BALL_LIST_NONE;
+        balls->free_list[balls->free_count++] = i;
+    }
+
+    balls->capacity = capacity;
+    return true;
+}
+
+bool InitBallStore(BallStore *balls, const size_t capacity, const size_t max_capacity) {
+    // every stream is padded to whole mask words so kernels never need a scalar tail
+    *balls = (BallStore) {
+            .max_capacity = BALL_MASK_WORDS(max_capacity) * BALL_MASK_BITS,
+            .policy = BALL_POOL_POLICY,
+            .sort_interval = BALL_SORT_INTERVAL,
+            .spawned = {.head = BALL_LIST_NONE, .tail = BALL_LIST_NONE},
+            .resting = {.head = BALL_LIST_NONE, .tail = BALL_LIST_NONE}
+    };
+    InitTimerWheel(&balls->lifetimes);
+
+    const char *env = SDL_getenv(BALL_POOL_POLICY_ENV);
+    for (int p = 0; env && p < BALL_POOL_POLICY_COUNT; ++p) {
+        if (!SDL_strcasecmp(env, pool_policy_names[p])) balls->policy = p;
+    }
+    env = SDL_getenv(BALL_SORT_INTERVAL_ENV);
+    if (env) balls->sort_interval = SDL_max(SDL_atoi(env), 0);
+
+    if (!growBallStore(balls, BALL_MASK_WORDS(capacity) * BALL_MASK_BITS)) {
+        FreeBallStore(balls);
+        return false;
+    }
+
+    for (int m = 0; m < BALL_MATERIAL_COUNT; ++m) SetBallMaterial(balls, m, BALL_BOUNCE, FLOOR_FRICTION);
+    SetBallMaterial(balls, BALL_MATERIAL_RUBBER, 0.9f, 0.98f);
+    SetBallMaterial(balls, BALL_MATERIAL_CLAY, 0.2f, 0.8f);
+    return true;
+}
+
+void FreeBallStore(BallStore *balls) {
+    SDL_SIMDFree(balls->x);
+    SDL_SIMDFree(balls->y);
+    SDL_SIMDFree(balls->vx);
+    SDL_SIMDFree(balls->vy);
+    SDL_SIMDFree(balls->prev_x);
+    SDL_SIMDFree(balls->prev_y);
+    SDL_SIMDFree(balls->radius);
+    SDL_SIMDFree(balls->inv_mass);
+    SDL_SIMDFree(balls->material);
+    SDL_SIMDFree(balls->shape);
+    SDL_SIMDFree(balls->half_length);
+    SDL_SIMDFree(balls->half_width);
+    SDL_SIMDFree(balls->angle);
+    SDL_SIMDFree(balls->spin);
+    SDL_SIMDFree(balls->inv_inertia);
+    SDL_SIMDFree(balls->still_time);
+    SDL_free(balls->expiry);
+    SDL_free(balls->island_next);
+    SDL_free(balls->island_prev);
+    SDL_free(balls->active);
+    SDL_free(balls->generation);
+    SDL_free(balls->free_list);
+    SDL_free(balls->spawned.next);
+    SDL_free(balls->spawned.prev);
+    SDL_free(balls->resting.next);
+    SDL_free(balls->resting.prev);
+    SDL_free(balls->remap);
+    SDL_free(balls->remap_generation);
+    SDL_free(balls->visible);
+    SDL_free(balls->idle);
+    SDL_free(balls->swept);
+    SDL_free(balls->shaped);
+    SDL_free(balls->timed);
+    SDL_free(balls->recycled);
+    FreeTimerWheel(&balls->lifetimes);
+    *balls = (BallStore) {0};
+}
+
+const char *BallPoolPolicyName(const BallPoolPolicy policy) {
+    return policy < BALL_POOL_POLICY_COUNT ? pool_policy_names[policy] : "unknown";
+}
+
+// the ball a full pool gives up under its policy, BALL_LIST_NONE if none
+static Uint32 evictionVictim(const BallStore *balls) {
+    switch (balls->policy) {
+        case BALL_POOL_RECYCLE_OLDEST_IDLE:
+            return balls->resting.head;
+        case BALL_POOL_RECYCLE_OLDEST:
+            return balls->spawned.head;
+        case BALL_POOL_REJECT:
+        default:
+            return BALL_LIST_NONE;
+    }
+}
+
+bool CanSpawnBall(const BallStore *balls) {
+    return balls->free_count > 0 || balls->capacity < balls->max_capacity || evictionVictim(balls) != BALL_LIST_NONE;
+}
+
+BallHandle SpawnBall(BallStore *balls) {
+    if (!balls->free_count) {
+        size_t capacity = balls->capacity ? balls->capacity * 2 : BALL_MASK_BITS;
+        if (capacity > balls->max_capacity) capacity = balls->max_capacity;
+
+        // full (or out of memory): the victim's slot goes on the free list and is the one handed out
+        if (capacity <= balls->capacity || !growBallStore(balls, capacity)) {
+            const Uint32 victim = evictionVictim(balls);
+            if (victim == BALL_LIST_NONE) return BALL_HANDLE_NONE;
+
+            ReleaseBall(balls, victim);
+            balls->recycled[victim / BALL_MASK_BITS] |= (Uint64) 1 << (victim % BALL_MASK_BITS);
         }
+    }
 
-        // update the ball position
-        ball->vel.y += SDL_STANDARD_GRAVITY * FRAME_TIME_S; // account for timeskip
+    const Uint32 i = balls->free_list[--balls->free_count];
+    balls->visible[i / BALL_MASK_BITS] |= (Uint64) 1 << (i % BALL_MASK_BITS);
+    listAppend(&balls->spawned, i);
 
-        ball->pos.x += ball->vel.x;
-        ball->pos.y += ball->vel.y;
+    return (BallHandle) {.index = i, .generation = balls->generation[i]};
+}
 
-        // collision check
-        for (size_t j = 0; j < MAX_BALLS; ++j) {
-            if (i == j) continue;
+void ReleaseBall(BallStore *balls, const size_t i) {
+    const Uint64 bit = (Uint64) 1 << (i % BALL_MASK_BITS);
+    if (!(balls->visible[i / BALL_MASK_BITS] & bit)) return;
 
-            Ball *other = &(*balls)[j];
-            if (other->visible && !other->idle) {
-                HandleCollision(ball, other);
-            }
+    balls->visible[i / BALL_MASK_BITS] &= ~bit;
+    balls->idle[i / BALL_MASK_BITS] &= ~bit;
+    ResetBallLifetime(balls, i);
+    listRemove(&balls->spawned, i);
+    balls->still_time[i] = 0;
+    balls->shaped[i / BALL_MASK_BITS] &= ~bit;
+    resetBody(balls, i);
+
+    // leave whatever sleeping island it was part of
+    balls->island_next[balls->island_prev[i]] = balls->island_next[i];
+    balls->island_prev[balls->island_next[i]] = balls->island_prev[i];
+    balls->island_next[i] = i;
+    balls->island_prev[i] = i;
+
+    // outstanding handles to this slot go stale, 0 is never a live generation
+    if (++balls->generation[i] == 0) balls->generation[i] = 1;
+    balls->free_list[balls->free_count++] = i;
+}
+
+void SetBallBody(BallStore *balls, const size_t i, const float radius, const float mass, const Uint8 material) {
+    const float r = SDL_clamp(radius, BALL_MIN_RADIUS, BALL_MAX_RADIUS);
+
+    balls->radius[i] = r;
+    balls->inv_mass[i] = 1.0f / mass;
+    balls->material[i] = material;
+    balls->shape[i] = BALL_SHAPE_CIRCLE;
+    balls->half_length[i] = 0;
+    balls->half_width[i] = r;
+    balls->inv_inertia[i] = 2.0f / (mass * r * r);
+    balls->shaped[i / BALL_MASK_BITS] &= ~((Uint64) 1 << (i % BALL_MASK_BITS));
+}
+
+void SetBallShape(BallStore *balls, const size_t i, const BallShape shape, const float half_length,
+                  const float half_width) {
+    if (shape == BALL_SHAPE_CIRCLE) {
+        SetBallBody(balls, i, half_width, 1.0f / balls->inv_mass[i], balls->material[i]);
+        return;
+    }
+
+    float length = fmaxf(half_length, BALL_MIN_RADIUS * 0.5f);
+    float width = fmaxf(half_width, BALL_MIN_RADIUS * 0.5f);
+    float bound = shape == BALL_SHAPE_BOX ? sqrtf(length * length + width * width) : length + width;
+    if (bound > BALL_MAX_RADIUS) {
+        length *= BALL_MAX_RADIUS / bound;
+        width *= BALL_MAX_RADIUS / bound;
+        bound = BALL_MAX_RADIUS;
+    }
+
+    // a box's moment of inertia, and roughly a capsule's: its middle as a rod plus its rounding as a disc
+    const float mass = 1.0f / balls->inv_mass[i];
+    const float inertia = shape == BALL_SHAPE_BOX ? mass * (length * length + width * width) / 3.0f
+                                                  : mass * (length * length / 3.0f + width * width / 2.0f);
+
+    balls->radius[i] = fmaxf(bound, BALL_MIN_RADIUS);
+    balls->shape[i] = shape;
+    balls->half_length[i] = length;
+    balls->half_width[i] = width;
+    balls->inv_inertia[i] = 1.0f / inertia;
+    balls->shaped[i / BALL_MASK_BITS] |= (Uint64) 1 << (i % BALL_MASK_BITS);
+}
+
+void SetBallMaterial(BallStore *balls, const Uint8 material, const float restitution, const float friction) {
+    balls->materials.restitution[material] = restitution;
+    balls->materials.friction[material] = friction;
+}
+
+size_t GetBallIndex(const BallStore *balls, const BallHandle handle) {
+    if (handle.index >= balls->capacity || balls->generation[handle.index] != handle.generation) return -1;
+    return IsBallVisible(balls, handle.index) ? handle.index : (size_t) -1;
+}
+
+BallHandle GetBallHandle(const BallStore *balls, const size_t i) {
+    return (BallHandle) {.index = i, .generation = balls->generation[i]};
+}
+
+void CompactActiveBalls(BallStore *balls) {
+    size_t count = 0;
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        Uint64 bits = balls->visible[w] & ~balls->idle[w];
+
+        while (bits) {
+            balls->active[count++] = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            bits &= bits - 1;
+        }
+    }
+
+    balls->active_count = count;
+}
+
+// spreads the low 16 bits out to the even bits
+static Uint32 spreadBits(Uint32 v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// LSD radix sort of n keys, 8 bits a pass, carrying order along. passes where every key has the same digit
+// are skipped, the sorted result may end up in either buffer
+static void radixSort(Uint32 **keys, Uint32 **order, Uint32 **sort_keys, Uint32 **sort_order, const size_t n) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t k = 0; k < n; ++k) offsets[((*keys)[k] >> shift) & 0xFF]++;
+        if (offsets[((*keys)[0] >> shift) & 0xFF] == n) continue;
+
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            const size_t count = offsets[d];
+            offsets[d] = sum;
+            sum += count;
+        }
+
+        for (size_t k = 0; k < n; ++k) {
+            const size_t to = offsets[((*keys)[k] >> shift) & 0xFF]++;
+            (*sort_keys)[to] = (*keys)[k];
+            (*sort_order)[to] = (*order)[k];
+        }
+
+        Uint32 *swap = *keys;
+        *keys = *sort_keys;
+        *sort_keys = swap;
+        swap = *order;
+        *order = *sort_order;
+        *sort_order = swap;
+    }
+}
+
+// stream[k] = stream[order[k]] for the first n elements, through scratch
+static void permute4(void *stream, const Uint32 *order, const size_t n, void *scratch) {
+    for (size_t k = 0; k < n; ++k) SDL_memcpy((Uint8 *) scratch + k * 4, (Uint8 *) stream + order[k] * 4, 4);
+    SDL_memcpy(stream, scratch, n * 4);
+}
+
+static void permute1(Uint8 *stream, const Uint32 *order, const size_t n, Uint8 *scratch) {
+    for (size_t k = 0; k < n; ++k) scratch[k] = stream[order[k]];
+    SDL_memcpy(stream, scratch, n);
+}
+
+// the same for links between slots, which point to where their target moved
+static void permuteLinks(Uint32 *links, const Uint32 *order, const size_t n, const Uint32 *remap, Uint32 *scratch) {
+    for (size_t k = 0; k < n; ++k) {
+        const Uint32 link = links[order[k]];
+        scratch[k] = link == BALL_LIST_NONE ? BALL_LIST_NONE : remap[link];
+    }
+    SDL_memcpy(links, scratch, n * sizeof(Uint32));
+}
+
+// bit k of the mask is bit order[k] of what it was, the rest of it is cleared
+static void permuteMask(Uint64 *mask, const Uint32 *order, const size_t n, const size_t words, Uint64 *scratch) {
+    SDL_memset(scratch, 0, words * sizeof(Uint64));
+    for (size_t k = 0; k < n; ++k) {
+        if ((mask[order[k] / BALL_MASK_BITS] >> (order[k] % BALL_MASK_BITS)) & 1) {
+            scratch[k / BALL_MASK_BITS] |= (Uint64) 1 << (k % BALL_MASK_BITS);
         }
+    }
+    SDL_memcpy(mask, scratch, words * sizeof(Uint64));
+}
+
+bool SortBallStore(BallStore *balls) {
+    const size_t words = balls->capacity / BALL_MASK_BITS;
+    size_t n = 0;
+    for (size_t w = 0; w < words; ++w) n += BALL_MASK_POPCOUNT(balls->visible[w]);
+    if (!n) return false;
+
+    // keys and order twice for the radix sort, then room for one whole stream while it's permuted
+    Uint32 *buffer = SDL_malloc((4 * n + balls->capacity) * sizeof(Uint32));
+    if (!buffer) return false;
+    Uint32 *keys = buffer;
+    Uint32 *order = keys + n;
+    Uint32 *sort_keys = order + n;
+    Uint32 *sort_order = sort_keys + n;
+    Uint32 *scratch = sort_order + n;
 
-        // boundary checking horizontal
-        if (ball->pos.x < BALL_RADIUS || ball->pos.x > WIN_WIDTH - BALL_RADIUS) {
-            ball->vel.x = -ball->vel.x * BALL_BOUNCE;
-            ball->pos.x = clamp(ball->pos.x, BALL_RADIUS, WIN_WIDTH - BALL_RADIUS);
+    size_t count = 0;
+    for (size_t w = 0; w < words; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const Uint32 cx = (Uint32) SDL_clamp(balls->x[i] / BALL_SORT_CELL, 0.0f, 65535.0f);
+            const Uint32 cy = (Uint32) SDL_clamp(balls->y[i] / BALL_SORT_CELL, 0.0f, 65535.0f);
+            keys[count] = spreadBits(cx) | (spreadBits(cy) << 1);
+            order[count++] = i;
         }
+    }
+    radixSort(&keys, &order, &sort_keys, &sort_order, n);
+
+    // already packed into the lowest slots in order
+    size_t k = 0;
+    while (k < n && order[k] == k) ++k;
+    if (k == n) {
+        SDL_free(buffer);
+        return false;
+    }
 
-        // boundary checking vertical
-        if (ball->pos.y < BALL_RADIUS || ball->pos.y > WIN_HEIGHT - BALL_RADIUS) {
-            ball->vel.y = -ball->vel.y * BALL_BOUNCE;
-            ball->pos.y = clamp(ball->pos.y, BALL_RADIUS, WIN_HEIGHT - BALL_RADIUS);
+    for (size_t i = 0; i < balls->capacity; ++i) {
+        balls->remap[i] = BALL_LIST_NONE;
+        balls->remap_generation[i] = balls->generation[i];
+    }
+    for (k = 0; k < n; ++k) balls->remap[order[k]] = k;
+
+    permute4(balls->x, order, n, scratch);
+    permute4(balls->y, order, n, scratch);
+    permute4(balls->vx, order, n, scratch);
+    permute4(balls->vy, order, n, scratch);
+    permute4(balls->prev_x, order, n, scratch);
+    permute4(balls->prev_y, order, n, scratch);
+    permute4(balls->radius, order, n, scratch);
+    permute4(balls->inv_mass, order, n, scratch);
+    permute1(balls->material, order, n, (Uint8 *) scratch);
+    permute1(balls->shape, order, n, (Uint8 *) scratch);
+    permute4(balls->half_length, order, n, scratch);
+    permute4(balls->half_width, order, n, scratch);
+    permute4(balls->angle, order, n, scratch);
+    permute4(balls->spin, order, n, scratch);
+    permute4(balls->inv_inertia, order, n, scratch);
+    permute4(balls->expiry, order, n, scratch);
+    permute4(balls->still_time, order, n, scratch);
+    permuteLinks(balls->island_next, order, n, balls->remap, scratch);
+    permuteLinks(balls->island_prev, order, n, balls->remap, scratch);
+    permuteLinks(balls->spawned.next, order, n, balls->remap, scratch);
+    permuteLinks(balls->spawned.prev, order, n, balls->remap, scratch);
+    permuteLinks(balls->resting.next, order, n, balls->remap, scratch);
+    permuteLinks(balls->resting.prev, order, n, balls->remap, scratch);
+    permuteMask(balls->idle, order, n, words, (Uint64 *) scratch);
+    permuteMask(balls->shaped, order, n, words, (Uint64 *) scratch);
+    permuteMask(balls->timed, order, n, words, (Uint64 *) scratch);
+
+    BallList *lists[] = {&balls->spawned, &balls->resting};
+    for (size_t l = 0; l < SDL_arraysize(lists); ++l) {
+        if (lists[l]->head == BALL_LIST_NONE) continue;
+        lists[l]->head = balls->remap[lists[l]->head];
+        lists[l]->tail = balls->remap[lists[l]->tail];
+    }
+
+    SDL_memset(balls->visible, 0, words * sizeof(Uint64));
+    for (k = 0; k < n; ++k) balls->visible[k / BALL_MASK_BITS] |= (Uint64) 1 << (k % BALL_MASK_BITS);
+    SDL_memset(balls->swept, 0, words * sizeof(Uint64));
+    SDL_memset(balls->recycled, 0, words * sizeof(Uint64));
 
-            // if ball is almost at rest vertically
-            if (fabsf(ball->vel.y) < 1.0f) {
-                ball->vel.x *= FLOOR_FRICTION;
+    // the free slots follow, as new, lowest first
+    balls->free_count = 0;
+    for (size_t i = balls->capacity; i-- > n;) {
+        resetBody(balls, i);
+        balls->x[i] = balls->y[i] = balls->vx[i] = balls->vy[i] = balls->prev_x[i] = balls->prev_y[i] = 0;
+        balls->expiry[i] = 0;
+        balls->still_time[i] = 0;
+        balls->island_next[i] = i;
+        balls->island_prev[i] = i;
+        balls->spawned.next[i] = balls->spawned.prev[i] = BALL_LIST_NONE;
+        balls->resting.next[i] = balls->resting.prev[i] = BALL_LIST_NONE;
+        balls->free_list[balls->free_count++] = i;
+    }
 
-                if (fabsf(ball->vel.x) < 0.0125f) {
-                    // stop ball completely if horizontal velocity is very small
-                    ball->vel.x = 0;
-                    ball->idle = true;
-                }
+    // every slot holds something else now, old handles and timers must not match it
+    for (size_t i = 0; i < balls->capacity; ++i) {
+        if (++balls->generation[i] == 0) balls->generation[i] = 1;
+    }
+
+    // the countdowns carry on under the new handles, a ball that can't get a timer starts over next step
+    for (size_t w = 0; w < words; ++w) {
+        for (Uint64 bits = balls->timed[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            if (!ScheduleTimer(&balls->lifetimes, balls->expiry[i], i, balls->generation[i])) {
+                ResetBallLifetime(balls, i);
             }
         }
     }
+
+    CompactActiveBalls(balls);
+    SDL_free(buffer);
+    return true;
 }
 
-void ShootBall(Ball *ball, const SDL_Point *m_pos, const SDL_Point *anchor_point) {
-    ball->idle = false;
-    ball->visible = true;
-    ball->remaining_lifetime = BALL_IDLE_LIFETIME_MS;
+BallHandle RemapBallHandle(const BallStore *balls, const BallHandle handle) {
+    if (handle.index >= balls->capacity || balls->remap[handle.index] == BALL_LIST_NONE ||
+        balls->remap_generation[handle.index] != handle.generation) {
+        return BALL_HANDLE_NONE;
+    }
+    return GetBallHandle(balls, balls->remap[handle.index]);
+}
 
-    ball->pos = (SDL_FPoint) {
-            .x = (float) anchor_point->x,
-            .y = (float) anchor_point->y
-    };
+bool IsBallVisible(const BallStore *balls, const size_t i) {
+    return (balls->visible[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1;
+}
+
+bool IsBallIdle(const BallStore *balls, const size_t i) {
+    return (balls->idle[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1;
+}
+
+Uint32 GetBallLifetime(const BallStore *balls, const size_t i) {
+    if (!((balls->timed[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1)) return BALL_IDLE_LIFETIME_MS;
+    return (balls->expiry[i] - balls->lifetimes.now) * 1000 / PHYSICS_HZ;
+}
+
+static void scheduleExpiry(BallStore *balls, const size_t i, const Uint32 ticks) {
+    const Uint32 due = balls->lifetimes.now + ticks;
+    if (!ScheduleTimer(&balls->lifetimes, due, i, balls->generation[i])) return;
+
+    // an earlier timer of the same ball no longer matches expiry and is ignored when it fires
+    const Uint64 bit = (Uint64) 1 << (i % BALL_MASK_BITS);
+    if (balls->timed[i / BALL_MASK_BITS] & bit) listRemove(&balls->resting, i);
+    listAppend(&balls->resting, i);
+    balls->expiry[i] = due;
+    balls->timed[i / BALL_MASK_BITS] |= bit;
+}
+
+void SetBallLifetime(BallStore *balls, const size_t i, const Uint32 ms) {
+    const Uint32 ticks = (ms * PHYSICS_HZ + 999) / 1000;
+    const bool timed = (balls->timed[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1;
+    if (timed && balls->expiry[i] == balls->lifetimes.now + ticks) return;
+
+    scheduleExpiry(balls, i, ticks);
+}
+
+void ResetBallLifetime(BallStore *balls, const size_t i) {
+    const Uint64 bit = (Uint64) 1 << (i % BALL_MASK_BITS);
+    if (!(balls->timed[i / BALL_MASK_BITS] & bit)) return;
+
+    listRemove(&balls->resting, i);
+    balls->timed[i / BALL_MASK_BITS] &= ~bit;
+}
+
+// balls that went idle since the last step start counting down, then the lifetimes move on by one step
+// and the slots whose time is up go back to the pool. the countdown itself costs nothing per idle ball
+static void expireIdleBalls(BallStore *balls) {
+    const size_t words = BALL_MASK_WORDS(balls->capacity);
+
+    for (size_t w = 0; w < words; ++w) {
+        const Uint64 idle = balls->visible[w] & balls->idle[w];
+        Uint64 fresh = idle & ~balls->timed[w];
+
+        for (Uint64 woken = balls->timed[w] & ~idle; woken; woken &= woken - 1) {
+            listRemove(&balls->resting, w * BALL_MASK_BITS + BALL_MASK_CTZ(woken));
+        }
+        balls->timed[w] &= idle;
+
+        for (; fresh; fresh &= fresh - 1) {
+            scheduleExpiry(balls, w * BALL_MASK_BITS + BALL_MASK_CTZ(fresh), IDLE_LIFETIME_TICKS);
+        }
+    }
+
+    for (Uint32 t = AdvanceTimers(&balls->lifetimes); t != TIMER_NONE; t = balls->lifetimes.timers[t].next) {
+        const Timer *timer = &balls->lifetimes.timers[t];
+        const size_t i = timer->id;
+
+        // woken, released or rescheduled since
+        if (balls->generation[i] != timer->tag || balls->expiry[i] != timer->due) continue;
+        if (!((balls->timed[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1)) continue;
+
+        ReleaseBall(balls, i);
+    }
+}
+
+void UpdateBalls(World *world) {
+    BallStore *balls = &world->balls;
+
+    // compact storage: lifetimes and the packed integration kernel only, the float streams go stale
+    if (world->quantized) {
+        expireIdleBalls(balls);
+        IntegrateQuantizedBalls(&world->quantized_balls, balls, STEP_TIME_S);
+        return;
+    }
+
+    SDL_memcpy(balls->prev_x, balls->x, balls->capacity * sizeof(float));
+    SDL_memcpy(balls->prev_y, balls->y, balls->capacity * sizeof(float));
+
+    // the event engine does contacts and motion all on its own, it only shares the lifetimes
+    if (world->engine == SIM_ENGINE_EVENTS) {
+        AdvanceEventSimulation(&world->events, balls, STEP_TIME_S);
+        expireIdleBalls(balls);
+        return;
+    }
+
+    expireIdleBalls(balls);
+
+    // every so often the balls are renumbered in Z-order, so the ones close in space are close in memory too
+    if (balls->sort_interval && balls->lifetimes.now % balls->sort_interval == 0) SortWorldBalls(world);
+
+    // from here on only the live balls are touched
+    CompactActiveBalls(balls);
+
+    // a fluid has no ball contacts, the particles push each other through pressure instead
+    if (world->fluid) {
+        StepFluid(&world->sph, &world->workers, balls, &world->obstacles, &world->terrain, WORLD_GRAVITY, STEP_TIME_S);
+        return;
+    }
+
+    // collision check, only pairs the broadphase finds close enough.
+    // contacts with sleeping balls either wake their island or are resolved against them as static
+    FindCandidatePairs(&world->broadphase, balls);
+    SettleSleepingContacts(world);
+    UpdateConstraints(&world->constraints, balls);
+
+    // in n-body mode the balls pull on each other instead of falling, the pull is evaluated once per step
+    const bool attract = world->nbody && ComputeNBodyForces(&world->gravity, &world->workers, balls);
+    const float gravity = world->nbody ? 0 : WORLD_GRAVITY;
+
+    // the step is split into as many substeps as the last one needed: the candidate pairs carry over,
+    // contacts, fast balls and integration run once per substep
+    const int substeps = ChooseSubsteps(&world->solver, STEP_TIME_S);
+    const float dt = STEP_TIME_S / (float) substeps;
+
+    for (int s = 0; s < substeps; ++s) {
+        ResolveContacts(&world->solver, &world->workers, balls, &world->obstacles, &world->terrain,
+                        world->broadphase.pairs, world->broadphase.pair_count);
+
+        if (attract) ApplyNBodyForces(&world->gravity, balls, dt);
+
+        // balls fast enough to skip past something within one substep are swept to their first impact instead
+        SweepFastBalls(balls, &world->broadphase, &world->obstacles, &world->terrain, gravity, dt);
+
+        // gravity, integration and window bounds (unless the terrain bounds the world) for every other active ball,
+        // circles in the SIMD kernel and capsules and boxes on their own
+        if (IntegrateBalls(balls, gravity, !world->terrain.distance, dt)) world->broadphase.sleepers_dirty = true;
+        IntegrateShapes(balls, gravity, !world->terrain.distance, dt);
+
+        // links pull their balls back together after they moved, before the level geometry has the last word
+        SolveConstraints(&world->constraints, &world->workers, balls, dt);
+
+        // then out of the level geometry, each ball looks up the few obstacles near it in the tree,
+        // and out of the terrain, one field sample each
+        CollideObstacles(&world->obstacles, balls);
+        if (CollideTerrain(&world->terrain, balls)) world->broadphase.sleepers_dirty = true;
+    }
+
+    // islands of touching balls that have all been slow for long enough go to sleep together.
+    // not while the balls pull on each other, slow isn't the same as settled then
+    if (!world->nbody) UpdateIslands(world);
+}
+
+BallHandle ShootBall(BallStore *balls, const SDL_Point *m_pos, const SDL_Point *anchor_point) {
+    const BallHandle handle = SpawnBall(balls);
+    if (!handle.generation) return handle;
+
+    const size_t i = handle.index;
+    balls->idle[i / BALL_MASK_BITS] &= ~((Uint64) 1 << (i % BALL_MASK_BITS));
+    ResetBallLifetime(balls, i);
+    balls->still_time[i] = 0;
+    balls->vx[i] = 0;
+    balls->vy[i] = 0;
+
+    balls->x[i] = (float) anchor_point->x;
+    balls->y[i] = (float) anchor_point->y;
+    balls->prev_x[i] = balls->x[i];
+    balls->prev_y[i] = balls->y[i];
 
     const float magnitude = hypotenuse(
             m_pos->x,
@@ -88,52 +731,85 @@ void ShootBall(Ball *ball, const SDL_Point *m_pos, const SDL_Point *anchor_point
                 DISTANCE_SCALE_EXPONENT
         );
 
-        ball->vel.x = (-((float) (m_pos->x - anchor_point->x) / magnitude) * BALL_SPEED) * powerScale;
-        ball->vel.y = (-((float) (m_pos->y - anchor_point->y) / magnitude) * BALL_SPEED) * powerScale;
+        balls->vx[i] = (-((float) (m_pos->x - anchor_point->x) / magnitude) * BALL_SPEED) * powerScale;
+        balls->vy[i] = (-((float) (m_pos->y - anchor_point->y) / magnitude) * BALL_SPEED) * powerScale;
     }
+
+    return handle;
 }
 
-void HandleCollision(Ball *a, Ball *b) {
-    float dx = b->pos.x - a->pos.x;
-    float dy = b->pos.y - a->pos.y;
-    float distance = sqrtf(dx * dx + dy * dy);
+float PairRestitution(const BallStore *balls, const size_t a, const size_t b) {
+    return fmaxf(balls->materials.restitution[balls->material[a]], balls->materials.restitution[balls->material[b]]);
+}
 
-    // check if balls are colliding
-    if (distance < BALL_RADIUS * 2.0f) {  // or a.r + b.r
-        // normalize collision vector
-        float nx = dx / distance;
-        float ny = dy / distance;
+float HandleCollision(BallStore *balls, const size_t a, const size_t b) {
+    float dx = balls->x[b] - balls->x[a];
+    float dy = balls->y[b] - balls->y[a];
+    float distance_sq = dx * dx + dy * dy;
+    float reach = balls->radius[a] + balls->radius[b];
 
-        // calculate relative velocity in direction of collision
-        float dvx = b->vel.x - a->vel.x;
-        float dvy = b->vel.y - a->vel.y;
-        float dotProduct = dvx * nx + dvy * ny;
+    // check if balls are colliding, on squared distance so pairs that miss never pay for the root
+    if (distance_sq >= reach * reach) return 0;
+    float distance = sqrtf(distance_sq);
 
-        // if the balls are moving apart -> no need for collision resolve
-        if (dotProduct > 0) {
-            return;
-        }
+    // normalize collision vector, balls squeezed onto the same spot (e.g. a corner) get pushed apart sideways
+    float inv_distance = distance > 0 ? 1.0f / distance : 0.0f;
+    float nx = distance > 0 ? dx * inv_distance : 1.0f;
+    float ny = dy * inv_distance;
 
-        // calc impulse scalar with the coefficient of restitution
-        // float impulse = (2.0f * dotProduct) / (a->mass + b->mass);
-        float impulse = -(1 + BALL_BOUNCE) * dotProduct / 2.0f; // divided by 2 for equal mass assumption
+    // each ball's share of the impulse and of the push apart, the lighter one takes more
+    float inv_sum = balls->inv_mass[a] + balls->inv_mass[b];
+    float share_a = balls->inv_mass[a] / inv_sum;
+    float share_b = balls->inv_mass[b] / inv_sum;
 
-        // update velocities based on impulse
-        a->vel.x -= impulse * nx * 0.5f; // a->vel.x -= impulse * b->mass * nx;
-        a->vel.y -= impulse * ny * 0.5f;
-        b->vel.x += impulse * nx * 0.5f;
-        b->vel.y += impulse * ny * 0.5f;
+    // calculate relative velocity in direction of collision
+    float dvx = balls->vx[b] - balls->vx[a];
+    float dvy = balls->vy[b] - balls->vy[a];
+    float dotProduct = dvx * nx + dvy * ny;
+
+    // only balls moving towards each other bounce, but an overlap is pushed out either way
+    if (dotProduct < 0) {
+        // calc impulse scalar with the coefficient of restitution, halved as it always was for two equal balls
+        float impulse = -(1 + PairRestitution(balls, a, b)) * dotProduct / 2.0f;
 
-        // prevent sticking
-        float overlap = 0.5f * (BALL_RADIUS * 2.0f - distance);
-        a->pos.x -= overlap * nx;
-        a->pos.y -= overlap * ny;
-        b->pos.x += overlap * nx;
-        b->pos.y += overlap * ny;
+        // update velocities based on impulse
+        balls->vx[a] -= impulse * nx * share_a;
+        balls->vy[a] -= impulse * ny * share_a;
+        balls->vx[b] += impulse * nx * share_b;
+        balls->vy[b] += impulse * ny * share_b;
     }
+
+    // prevent sticking
+    float penetration = reach - distance;
+    balls->x[a] -= penetration * share_a * nx;
+    balls->y[a] -= penetration * share_a * ny;
+    balls->x[b] += penetration * share_b * nx;
+    balls->y[b] += penetration * share_b * ny;
+
+    return penetration;
 }
 
-size_t getNextAvailableBallIndex(const Ball (*balls)[MAX_BALLS]) {
-    for (size_t i = 0; i < MAX_BALLS; ++i) if (!(*balls)[i].visible) return i;
-    return -1;
+void HandleStaticCollision(BallStore *balls, const size_t a, const size_t b) {
+    float dx = balls->x[b] - balls->x[a];
+    float dy = balls->y[b] - balls->y[a];
+    float distance = sqrtf(dx * dx + dy * dy);
+    float reach = balls->radius[a] + balls->radius[b];
+
+    if (distance < reach && distance > 0) {
+        float nx = dx / distance;
+        float ny = dy / distance;
+        float bounce = PairRestitution(balls, a, b);
+
+        // a moving towards b, reflect that part of its velocity
+        float approach = balls->vx[a] * nx + balls->vy[a] * ny;
+        if (approach > 0) {
+            balls->vx[a] -= (1 + bounce) * approach * nx;
+            balls->vy[a] -= (1 + bounce) * approach * ny;
+        }
+
+        // b doesn't move, so a takes the whole overlap
+        float overlap = reach - distance;
+        balls->x[a] -= overlap * nx;
+        balls->y[a] -= overlap * ny;
+    }
 }
@@ -3,29 +3,200 @@
 
 #include <SDL.h>
 #include <stdbool.h>
+#include "timers.h"
 
-#define MAX_BALLS 16
+#define BALL_POOL_INITIAL_CAPACITY 64
+#define BALL_POOL_MAX_CAPACITY (1 << 20) // the pool doubles on demand up to this many slots
+#define BALL_POOL_POLICY_ENV "SIM_POOL_POLICY" // a BallPoolPolicyName, overrides BALL_POOL_POLICY when set
+#define BALL_POOL_POLICY BALL_POOL_RECYCLE_OLDEST_IDLE
+#define BALL_SORT_INTERVAL 120 // steps between two renumberings of the balls in Z-order, 0 turns them off
+#define BALL_SORT_INTERVAL_ENV "SIM_SORT_INTERVAL" // overrides BALL_SORT_INTERVAL when set
+#define BALL_SORT_CELL (BALL_RADIUS * 2) // px, balls in the same cell of this size share a Z-order key
 #define BALL_RADIUS 12 // default is 12
-#define BALL_SPEED 10.0f
+#define BALL_MIN_RADIUS 4.0f
+#define BALL_MAX_RADIUS 48.0f
+#define BALL_MASS 1.0f // default mass, only the ratio between two balls matters
+#define BALL_SPEED 600.0f // px/s
 #define BALL_BOUNCE 0.75f
 #define BALL_IDLE_LIFETIME_MS 3000
+#define BALL_REST_VELOCITY 60.0f // vertical speed (px/s) under which a floor bounce counts as resting
+#define BALL_IDLE_VELOCITY 0.75f // horizontal speed (px/s) under which a resting ball goes idle
+#define BALL_SLEEP_VELOCITY 30.0f // px/s, slower balls count towards falling asleep
+#define BALL_SLEEP_TIME_MS 500 // how long a whole island has to stay that slow before it sleeps
+#define BALL_WAKE_VELOCITY 180.0f // px/s, approach speed at which a moving ball wakes a sleeping island
 #define DISTANCE_SCALE_THRESHOLD 200.0f // distance at which scaling kicks in
 #define DISTANCE_SCALE_EXPONENT 1.25f // adjust this for more/less curvature
 
+#define BALL_MASK_BITS 64 // balls per flag mask word, slot capacity is rounded up to this
+#define BALL_MASK_WORDS(n) (((n) + BALL_MASK_BITS - 1) / BALL_MASK_BITS)
+#define BALL_MASK_CTZ(bits) ((size_t) __builtin_ctzll(bits)) // lowest set bit, bits must not be 0
+#define BALL_MASK_POPCOUNT(bits) ((size_t) __builtin_popcountll(bits))
+
+#define BALL_MATERIAL_COUNT 256 // material ids are a Uint8
+
+// the materials InitBallStore fills in, the other ids start out as copies of BALL_MATERIAL_DEFAULT
+typedef enum {
+    BALL_MATERIAL_DEFAULT, // BALL_BOUNCE and FLOOR_FRICTION
+    BALL_MATERIAL_RUBBER,
+    BALL_MATERIAL_CLAY,
+    BALL_MATERIAL_PRESET_COUNT
+} BallMaterialPreset;
+
+// what a ball collides as, everything that isn't a contact between two balls sees the bounding circle
+typedef enum {
+    BALL_SHAPE_CIRCLE,
+    BALL_SHAPE_CAPSULE, // a segment 2 * half_length long along the angle, rounded by half_width
+    BALL_SHAPE_BOX, // 2 * half_length along the angle by 2 * half_width across
+    BALL_SHAPE_COUNT
+} BallShape;
+
+// what SpawnBall does when every slot up to max_capacity is taken
+typedef enum {
+    BALL_POOL_REJECT, // no ball
+    BALL_POOL_RECYCLE_OLDEST_IDLE, // releases the ball that has been idle the longest, no ball if none is idle
+    BALL_POOL_RECYCLE_OLDEST, // releases the ball that was spawned first
+    BALL_POOL_POLICY_COUNT
+} BallPoolPolicy;
+
+#define BALL_LIST_NONE ((Uint32) -1)
+
+// balls in the order they joined, linked through their slots: appending, unlinking and finding the oldest are O(1)
+typedef struct {
+    Uint32 head; // oldest, BALL_LIST_NONE when empty
+    Uint32 tail;
+    Uint32 *next; // BALL_LIST_NONE for balls that aren't in the list
+    Uint32 *prev;
+} BallList;
+
+// coefficients per material id, as parallel arrays so a kernel can gather one coefficient for
+// several balls at once
 typedef struct {
-    SDL_FPoint pos;
-    SDL_FPoint vel;
-    bool visible;
-    bool idle;
-    unsigned short remaining_lifetime;
-} Ball;
+    float restitution[BALL_MATERIAL_COUNT]; // share of the approach speed a bounce gives back
+    float friction[BALL_MATERIAL_COUNT]; // share of horizontal speed kept per step rolling on the floor, below 1
+} BallMaterials;
+
+// refers to a slot for as long as the ball in it lives, generation 0 is never valid
+typedef struct {
+    Uint32 index;
+    Uint32 generation;
+} BallHandle;
+
+#define BALL_HANDLE_NONE ((BallHandle) {.index = 0, .generation = 0})
+
+// structure-of-arrays ball storage: one stream per field so the integration kernel can work on
+// several balls per instruction, flags are packed into bitsets (bit i of word i / 64 is ball i).
+// slots are a pool that doubles when the free list runs dry, freeing a slot bumps its generation.
+typedef struct {
+    size_t capacity;
+    size_t max_capacity;
+    float *x;
+    float *y;
+    float *vx;
+    float *vy;
+    float *prev_x; // positions before the last step, for interpolated rendering
+    float *prev_y;
+    float *radius;
+    float *inv_mass;
+    Uint8 *material; // index into materials
+    Uint8 *shape; // BallShape, radius is the bounding circle of anything but a circle
+    float *half_length;
+    float *half_width;
+    float *angle; // rad
+    float *spin; // rad/s
+    float *inv_inertia;
+    Uint32 *expiry; // tick of lifetimes the ball is released at, while it's in timed
+    float *still_time; // seconds spent below BALL_SLEEP_VELOCITY
+    Uint32 *island_next; // sleeping islands are circular lists, a ball not in one links to itself
+    Uint32 *island_prev;
+    Uint64 *visible;
+    Uint64 *idle;
+    Uint64 *swept; // moved by continuous collision detection this step, skipped by the integration kernel
+    Uint64 *shaped; // not a circle, moved by IntegrateShapes instead of the integration kernel
+    Uint64 *timed; // idle with a despawn scheduled on lifetimes
+    Uint64 *recycled; // released and handed out again by SpawnBall since PackNewBalls last looked
+    Uint32 *active; // dense list of visible, non-idle slots, in slot order
+    size_t active_count;
+    Uint32 *generation;
+    Uint32 *free_list;
+    size_t free_count;
+    BallMaterials materials;
+    TimerWheel lifetimes; // ticks once per step, idle balls are released when their timer fires
+    BallPoolPolicy policy;
+    BallList spawned; // every visible ball
+    BallList resting; // every ball in timed, by when its countdown started
+    size_t sort_interval; // BALL_SORT_INTERVAL
+    Uint32 *remap; // slot each slot's ball moved to in the last SortBallStore, BALL_LIST_NONE if it was free
+    Uint32 *remap_generation; // generation each slot had before that
+} BallStore;
+
+bool InitBallStore(BallStore *balls, size_t capacity, size_t max_capacity);
+
+void FreeBallStore(BallStore *balls);
+
+const char *BallPoolPolicyName(BallPoolPolicy policy);
+
+bool CanSpawnBall(const BallStore *balls);
+
+// takes a slot off the free list (growing the pool if needed). once at max_capacity the policy may release
+// a ball to make room, BALL_HANDLE_NONE if it doesn't
+BallHandle SpawnBall(BallStore *balls);
+
+// released slots go back to a default ball: a BALL_RADIUS circle of BALL_MASS and BALL_MATERIAL_DEFAULT
+void ReleaseBall(BallStore *balls, size_t i);
+
+// makes the ball a circle, radius is clamped to [BALL_MIN_RADIUS, BALL_MAX_RADIUS], mass has to be positive
+void SetBallBody(BallStore *balls, size_t i, float radius, float mass, Uint8 material);
+
+// turns the ball into a capsule or a box of the same mass and material, at its current angle.
+// the extents are clamped to BALL_MIN_RADIUS / 2 and scaled down to fit a BALL_MAX_RADIUS bounding circle
+void SetBallShape(BallStore *balls, size_t i, BallShape shape, float half_length, float half_width);
+
+void SetBallMaterial(BallStore *balls, Uint8 material, float restitution, float friction);
+
+// index of a live ball, (size_t) -1 if the handle went stale
+size_t GetBallIndex(const BallStore *balls, BallHandle handle);
+
+BallHandle GetBallHandle(const BallStore *balls, size_t i);
+
+// rebuilds the dense active list from the visible and idle masks
+void CompactActiveBalls(BallStore *balls);
+
+// renumbers the visible balls in Z-order (Morton order) of their position into the lowest slots, so balls
+// that are close in space are close in memory and the free slots follow them. every slot's generation is
+// bumped, so all handles go stale: their holders translate them with RemapBallHandle.
+// false if nothing moved (already in order, or out of memory)
+bool SortBallStore(BallStore *balls);
+
+// the handle a ball got in the last SortBallStore, BALL_HANDLE_NONE if it wasn't live then
+BallHandle RemapBallHandle(const BallStore *balls, BallHandle handle);
+
+bool IsBallVisible(const BallStore *balls, size_t i);
+
+bool IsBallIdle(const BallStore *balls, size_t i);
+
+// ms an idle ball has left before it's released, BALL_IDLE_LIFETIME_MS until its countdown starts
+Uint32 GetBallLifetime(const BallStore *balls, size_t i);
+
+// starts (or moves) the countdown of an idle ball, to release it ms from now
+void SetBallLifetime(BallStore *balls, size_t i, Uint32 ms);
+
+// a ball that stops being idle gets its whole lifetime back the next time it rests
+void ResetBallLifetime(BallStore *balls, size_t i);
+
+typedef struct World World;
+
+// advances the simulation by one fixed step of STEP_TIME_S
+void UpdateBalls(World *world);
 
-void UpdateBalls(Ball (*balls)[MAX_BALLS]);
+BallHandle ShootBall(BallStore *balls, const SDL_Point *m_pos, const SDL_Point *anchor_point);
 
-void ShootBall(Ball *ball, const SDL_Point *m_pos, const SDL_Point *anchor_point);
+// restitution of a contact between two balls, the bouncier material wins
+float PairRestitution(const BallStore *balls, size_t a, size_t b);
 
-void HandleCollision(Ball *a, Ball *b);
+// returns how deep the two balls overlapped before being pushed apart, 0 if they didn't touch
+float HandleCollision(BallStore *balls, size_t a, size_t b);
 
-size_t getNextAvailableBallIndex(const Ball (*balls)[MAX_BALLS]);
+// like HandleCollision, but b is asleep and doesn't move: only a bounces off
+void HandleStaticCollision(BallStore *balls, size_t a, size_t b);
 
 #endif
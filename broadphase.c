@@ -0,0 +1,350 @@
+#include "broadphase.h"
+#include "window.h"
+#include <math.h>
+
+#define GRID_COLS ((WIN_WIDTH + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+#define GRID_ROWS ((WIN_HEIGHT + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+
+
+static bool initGrid(SpatialGrid *grid) {
+    grid->cols = GRID_COLS;
+    grid->rows = GRID_ROWS;
+    grid->cell_start = SDL_calloc(grid->cols * grid->rows + 1, sizeof(Uint32));
+
+    return grid->cell_start != NULL;
+}
+
+static void freeGrid(SpatialGrid *grid) {
+    SDL_free(grid->cell_start);
+    SDL_free(grid->ball_cell);
+    SDL_free(grid->sorted);
+}
+
+bool InitBroadphase(Broadphase *broadphase, const BroadphaseMode mode) {
+    *broadphase = (Broadphase) {.mode = mode};
+    return initGrid(&broadphase->grid) && initGrid(&broadphase->sleeping);
+}
+
+void FreeBroadphase(Broadphase *broadphase) {
+    freeGrid(&broadphase->grid);
+    freeGrid(&broadphase->sleeping);
+    SDL_free(broadphase->small);
+    SDL_free(broadphase->large);
+    SDL_free(broadphase->sleepers);
+    FreeSweepAndPrune(&broadphase->sap);
+    SDL_free(broadphase->pairs);
+    SDL_free(broadphase->nearby);
+    *broadphase = (Broadphase) {0};
+}
+
+const char *BroadphaseModeName(const BroadphaseMode mode) {
+    switch (mode) {
+        case BROADPHASE_GRID:
+            return "grid";
+        case BROADPHASE_SWEEP_AND_PRUNE:
+            return "sweep and prune";
+        case BROADPHASE_ALL_PAIRS:
+        default:
+            return "all pairs";
+    }
+}
+
+static void pushPair(Broadphase *broadphase, BallStore *balls, const Uint32 a, const Uint32 b) {
+    if (broadphase->pair_count == broadphase->pair_capacity) {
+        const size_t capacity = broadphase->pair_capacity ? broadphase->pair_capacity * 2 : 256;
+        BallPair *pairs = SDL_realloc(broadphase->pairs, capacity * sizeof(BallPair));
+
+        if (!pairs) {
+            // nowhere to put it, resolve it on the spot instead of losing it
+            HandleCollision(balls, a, b);
+            return;
+        }
+
+        broadphase->pairs = pairs;
+        broadphase->pair_capacity = capacity;
+    }
+
+    broadphase->pairs[broadphase->pair_count++] = (BallPair) {.a = a, .b = b};
+}
+
+static void allPairs(Broadphase *broadphase, BallStore *balls) {
+    for (size_t i = 0; i < balls->active_count; ++i) {
+        for (size_t j = i + 1; j < balls->active_count; ++j) {
+            pushPair(broadphase, balls, balls->active[i], balls->active[j]);
+        }
+    }
+}
+
+static bool reserveGrid(SpatialGrid *grid, const size_t capacity) {
+    if (capacity <= grid->capacity) return true;
+
+    Uint32 *ball_cell = SDL_realloc(grid->ball_cell, capacity * sizeof(Uint32));
+    if (!ball_cell) return false;
+    grid->ball_cell = ball_cell;
+
+    Uint32 *sorted = SDL_realloc(grid->sorted, capacity * sizeof(Uint32));
+    if (!sorted) return false;
+    grid->sorted = sorted;
+
+    grid->capacity = capacity;
+    return true;
+}
+
+static int cellCoord(const float p, const int cells) {
+    const int c = (int) (p / GRID_CELL_SIZE);
+    return c < 0 ? 0 : (c >= cells ? cells - 1 : c);
+}
+
+// counting sort of the listed balls by cell
+static void buildGrid(SpatialGrid *grid, const BallStore *balls, const Uint32 *list, const size_t count) {
+    const int cells = grid->cols * grid->rows;
+
+    SDL_memset(grid->cell_start, 0, (cells + 1) * sizeof(Uint32));
+
+    for (size_t k = 0; k < count; ++k) {
+        const Uint32 i = list[k];
+        const Uint32 c = cellCoord(balls->y[i], grid->rows) * grid->cols + cellCoord(balls->x[i], grid->cols);
+        grid->ball_cell[i] = c;
+        grid->cell_start[c]++;
+    }
+
+    // prefix sum, cell_start[c] now holds the end of cell c
+    Uint32 total = 0;
+    for (int c = 0; c < cells; ++c) {
+        total += grid->cell_start[c];
+        grid->cell_start[c] = total;
+    }
+    grid->cell_start[cells] = total;
+
+    // scatter, walking each end back down to the start of its cell
+    for (size_t k = count; k-- > 0;) {
+        const Uint32 i = list[k];
+        grid->sorted[--grid->cell_start[grid->ball_cell[i]]] = i;
+    }
+}
+
+static void collideCells(Broadphase *broadphase, BallStore *balls, const int a, const int b) {
+    const SpatialGrid *grid = &broadphase->grid;
+
+    for (Uint32 i = grid->cell_start[a]; i < grid->cell_start[a + 1]; ++i) {
+        for (Uint32 j = grid->cell_start[b]; j < grid->cell_start[b + 1]; ++j) {
+            pushPair(broadphase, balls, grid->sorted[i], grid->sorted[j]);
+        }
+    }
+}
+
+static bool reserveLists(Broadphase *broadphase, const size_t capacity) {
+    if (capacity <= broadphase->list_capacity) return true;
+
+    Uint32 *small = SDL_realloc(broadphase->small, capacity * sizeof(Uint32));
+    if (!small) return false;
+    broadphase->small = small;
+
+    Uint32 *large = SDL_realloc(broadphase->large, capacity * sizeof(Uint32));
+    if (!large) return false;
+    broadphase->large = large;
+
+    broadphase->list_capacity = capacity;
+    return true;
+}
+
+// ball i against every ball of `grid` whose centre may be within i's radius plus `other_radius`
+static void queryGrid(Broadphase *broadphase, BallStore *balls, const SpatialGrid *grid, const Uint32 i,
+                      const float other_radius, const bool sleeping) {
+    const int reach = (int) ceilf((balls->radius[i] + other_radius) / GRID_CELL_SIZE);
+    const int cx = cellCoord(balls->x[i], grid->cols);
+    const int cy = cellCoord(balls->y[i], grid->rows);
+
+    for (int y = SDL_max(cy - reach, 0); y <= SDL_min(cy + reach, grid->rows - 1); ++y) {
+        for (int x = SDL_max(cx - reach, 0); x <= SDL_min(cx + reach, grid->cols - 1); ++x) {
+            const int c = y * grid->cols + x;
+
+            for (Uint32 s = grid->cell_start[c]; s < grid->cell_start[c + 1]; ++s) {
+                const Uint32 j = grid->sorted[s];
+                if (!sleeping || (IsBallVisible(balls, j) && IsBallIdle(balls, j))) pushPair(broadphase, balls, i, j);
+            }
+        }
+    }
+}
+
+static void gridPairs(Broadphase *broadphase, BallStore *balls) {
+    SpatialGrid *grid = &broadphase->grid;
+
+    if (!reserveGrid(grid, balls->capacity) || !reserveLists(broadphase, balls->capacity)) {
+        allPairs(broadphase, balls);
+        return;
+    }
+
+    size_t small_count = 0;
+    size_t large_count = 0;
+    for (size_t k = 0; k < balls->active_count; ++k) {
+        const Uint32 i = balls->active[k];
+        if (balls->radius[i] > GRID_MAX_RADIUS) {
+            broadphase->large[large_count++] = i;
+        } else {
+            broadphase->small[small_count++] = i;
+        }
+    }
+
+    buildGrid(grid, balls, broadphase->small, small_count);
+
+    for (int cy = 0; cy < grid->rows; ++cy) {
+        for (int cx = 0; cx < grid->cols; ++cx) {
+            const int c = cy * grid->cols + cx;
+            if (grid->cell_start[c] == grid->cell_start[c + 1]) continue;
+
+            // pairs inside the cell
+            for (Uint32 i = grid->cell_start[c]; i < grid->cell_start[c + 1]; ++i) {
+                for (Uint32 j = i + 1; j < grid->cell_start[c + 1]; ++j) {
+                    pushPair(broadphase, balls, grid->sorted[i], grid->sorted[j]);
+                }
+            }
+
+            // half of the neighbourhood (right, and the row below), so every pair is visited once
+            if (cx + 1 < grid->cols) collideCells(broadphase, balls, c, c + 1);
+            if (cy + 1 < grid->rows) {
+                if (cx > 0) collideCells(broadphase, balls, c, c + grid->cols - 1);
+                collideCells(broadphase, balls, c, c + grid->cols);
+                if (cx + 1 < grid->cols) collideCells(broadphase, balls, c, c + grid->cols + 1);
+            }
+        }
+    }
+
+    // the large balls against the grid, then against each other
+    for (size_t k = 0; k < large_count; ++k) {
+        queryGrid(broadphase, balls, grid, broadphase->large[k], GRID_MAX_RADIUS, false);
+
+        for (size_t l = k + 1; l < large_count; ++l) {
+            pushPair(broadphase, balls, broadphase->large[k], broadphase->large[l]);
+        }
+    }
+}
+
+static void sweepPairs(Broadphase *broadphase, BallStore *balls) {
+    const SweepAndPrune *sap = &broadphase->sap;
+
+    if (!UpdateSweepAndPrune(&broadphase->sap, balls)) {
+        allPairs(broadphase, balls);
+        return;
+    }
+
+    for (size_t k = 0; k < sap->overlaps.count; ++k) {
+        const BallPair pair = sap->overlaps.pairs[k];
+
+        // the overlap set only knows about x
+        if (fabsf(balls->y[pair.b] - balls->y[pair.a]) >= balls->radius[pair.a] + balls->radius[pair.b]) continue;
+
+        pushPair(broadphase, balls, pair.a, pair.b);
+    }
+}
+
+// the sleeping balls get a grid of their own that is only rebuilt when new balls fall asleep,
+// balls that woke up or disappeared since are skipped when it is queried
+static bool buildSleepingGrid(Broadphase *broadphase, const BallStore *balls) {
+    if (!reserveGrid(&broadphase->sleeping, balls->capacity)) return false;
+
+    if (broadphase->sleeper_capacity < balls->capacity) {
+        Uint32 *sleepers = SDL_realloc(broadphase->sleepers, balls->capacity * sizeof(Uint32));
+        if (!sleepers) return false;
+        broadphase->sleepers = sleepers;
+        broadphase->sleeper_capacity = balls->capacity;
+    }
+
+    size_t count = 0;
+    broadphase->sleeper_radius = 0;
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & balls->idle[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            broadphase->sleeper_radius = fmaxf(broadphase->sleeper_radius, balls->radius[i]);
+            broadphase->sleepers[count++] = i;
+        }
+    }
+
+    buildGrid(&broadphase->sleeping, balls, broadphase->sleepers, count);
+    broadphase->sleepers_dirty = false;
+    return true;
+}
+
+// every active ball against the sleeping balls around it (3x3 cells between default balls),
+// the active ball comes first
+static void sleepingPairs(Broadphase *broadphase, BallStore *balls) {
+    if (broadphase->sleepers_dirty && !buildSleepingGrid(broadphase, balls)) return;
+
+    const SpatialGrid *grid = &broadphase->sleeping;
+    if (!grid->cell_start[grid->cols * grid->rows]) return;
+
+    for (size_t k = 0; k < balls->active_count; ++k) {
+        queryGrid(broadphase, balls, grid, balls->active[k], broadphase->sleeper_radius, true);
+    }
+}
+
+void FindCandidatePairs(Broadphase *broadphase, BallStore *balls) {
+    broadphase->pair_count = 0;
+
+    switch (broadphase->mode) {
+        case BROADPHASE_GRID:
+            gridPairs(broadphase, balls);
+            break;
+        case BROADPHASE_SWEEP_AND_PRUNE:
+            sweepPairs(broadphase, balls);
+            break;
+        case BROADPHASE_ALL_PAIRS:
+        default:
+            allPairs(broadphase, balls);
+            break;
+    }
+
+    sleepingPairs(broadphase, balls);
+}
+
+bool RefreshGrids(Broadphase *broadphase, const BallStore *balls) {
+    if (broadphase->sleepers_dirty && !buildSleepingGrid(broadphase, balls)) return false;
+    if (!reserveGrid(&broadphase->grid, balls->capacity) || !reserveLists(broadphase, balls->capacity)) return false;
+
+    // from the masks, not the active list: balls woken since it was compacted have moved too
+    size_t count = 0;
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            broadphase->small[count++] = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+        }
+    }
+
+    buildGrid(&broadphase->grid, balls, broadphase->small, count);
+    return true;
+}
+
+static bool gatherCells(Broadphase *broadphase, const BallStore *balls, const SpatialGrid *grid, const float min_x,
+                        const float min_y, const float max_x, const float max_y) {
+    for (int y = cellCoord(min_y, grid->rows); y <= cellCoord(max_y, grid->rows); ++y) {
+        for (int x = cellCoord(min_x, grid->cols); x <= cellCoord(max_x, grid->cols); ++x) {
+            const int c = y * grid->cols + x;
+
+            for (Uint32 s = grid->cell_start[c]; s < grid->cell_start[c + 1]; ++s) {
+                const Uint32 j = grid->sorted[s];
+                if (!IsBallVisible(balls, j)) continue;
+
+                if (broadphase->nearby_count == broadphase->nearby_capacity) {
+                    const size_t capacity = broadphase->nearby_capacity ? broadphase->nearby_capacity * 2 : 256;
+                    Uint32 *nearby = SDL_realloc(broadphase->nearby, capacity * sizeof(Uint32));
+                    if (!nearby) return false;
+
+                    broadphase->nearby = nearby;
+                    broadphase->nearby_capacity = capacity;
+                }
+
+                broadphase->nearby[broadphase->nearby_count++] = j;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool FindBallsInBox(Broadphase *broadphase, const BallStore *balls, const float min_x, const float min_y,
+                    const float max_x, const float max_y) {
+    broadphase->nearby_count = 0;
+
+    // sleepers that woke up since are still listed where they fell asleep, and are in the active grid as well
+    return gatherCells(broadphase, balls, &broadphase->grid, min_x, min_y, max_x, max_y) &&
+           gatherCells(broadphase, balls, &broadphase->sleeping, min_x, min_y, max_x, max_y);
+}
@@ -0,0 +1,72 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include "ball.h"
+#include "sweep.h"
+
+#define GRID_CELL_SIZE (BALL_RADIUS * 2) // one default diameter, overlapping balls are always in neighbouring cells
+#define GRID_MAX_RADIUS (GRID_CELL_SIZE * 0.5f) // larger balls stay out of the active grid, see Broadphase
+
+typedef enum {
+    BROADPHASE_ALL_PAIRS,
+    BROADPHASE_GRID,
+    BROADPHASE_SWEEP_AND_PRUNE,
+    BROADPHASE_MODE_COUNT
+} BroadphaseMode;
+
+// uniform grid over the window, rebuilt every step with a counting sort:
+// cell_start[c] .. cell_start[c + 1] is the range of `sorted` holding the balls in cell c
+typedef struct {
+    int cols;
+    int rows;
+    size_t capacity;
+    Uint32 *cell_start;
+    Uint32 *ball_cell;
+    Uint32 *sorted;
+} SpatialGrid;
+
+// the active grid only holds balls up to GRID_MAX_RADIUS, so its cells stay sized for the common ball.
+// the few larger ones are listed separately: each looks through as many cells as its own radius
+// needs, and they are paired with each other directly
+typedef struct {
+    BroadphaseMode mode;
+    SpatialGrid grid;
+    Uint32 *small;
+    Uint32 *large;
+    size_t list_capacity;
+    SweepAndPrune sap;
+    SpatialGrid sleeping; // sleeping balls of any size, static until sleepers_dirty
+    Uint32 *sleepers;
+    size_t sleeper_capacity;
+    float sleeper_radius; // largest radius in the sleeping grid
+    bool sleepers_dirty; // set whenever balls fall asleep
+    BallPair *pairs; // candidate pairs of the last FindCandidatePairs
+    size_t pair_count;
+    size_t pair_capacity;
+    Uint32 *nearby; // balls of the last FindBallsInBox
+    size_t nearby_count;
+    size_t nearby_capacity;
+} Broadphase;
+
+bool InitBroadphase(Broadphase *broadphase, BroadphaseMode mode);
+
+void FreeBroadphase(Broadphase *broadphase);
+
+const char *BroadphaseModeName(BroadphaseMode mode);
+
+// collects every pair of active balls that may touch into broadphase->pairs, followed by the pairs of
+// an active and a sleeping ball (active one first). expects the active list to be up to date (CompactActiveBalls)
+void FindCandidatePairs(Broadphase *broadphase, BallStore *balls);
+
+// rebuilds the active grid over every awake ball of any size where it is now, and the sleeping grid if it is
+// dirty, for FindBallsInBox in the middle of a step. the candidate pairs already found are kept.
+// false if out of memory
+bool RefreshGrids(Broadphase *broadphase, const BallStore *balls);
+
+// the visible balls of both grids (as of the last RefreshGrids) in the cells the box touches go to
+// broadphase->nearby, a ball that woke up since the sleeping grid was built may be listed twice.
+// false if out of memory, the list is incomplete then
+bool FindBallsInBox(Broadphase *broadphase, const BallStore *balls, float min_x, float min_y, float max_x,
+                    float max_y);
+
+#endif
@@ -0,0 +1,230 @@
+#include "ccd.h"
+#include "sleep.h"
+#include "world.h"
+#include <math.h>
+
+typedef enum {
+    IMPACT_NONE,
+    IMPACT_WALL_X,
+    IMPACT_WALL_Y,
+    IMPACT_BALL,
+    IMPACT_OBSTACLE,
+} ImpactKind;
+
+typedef struct {
+    ImpactKind kind;
+    float time;
+    size_t other;
+    float nx; // obstacle or terrain normal, towards the ball
+    float ny;
+} Impact;
+
+
+// time until a coordinate moving at v leaves [lo, hi], if that's within `limit`
+static void wallImpact(Impact *impact, const ImpactKind kind, const float p, const float v, const float lo,
+                       const float hi) {
+    float t = -1.0f;
+    if (v < 0 && p + v * impact->time < lo) t = (lo - p) / v;
+    if (v > 0 && p + v * impact->time > hi) t = (hi - p) / v;
+
+    if (t >= 0 && t < impact->time) *impact = (Impact) {.kind = kind, .time = t};
+}
+
+// earliest time two circles moving relative to each other come within the sum of their radii.
+// pairs that already overlap or move apart are the discrete solver's business
+static void ballImpact(Impact *impact, const BallStore *balls, const size_t a, const size_t b) {
+    const float px = balls->x[a] - balls->x[b];
+    const float py = balls->y[a] - balls->y[b];
+    const float vx = balls->vx[a] - balls->vx[b];
+    const float vy = balls->vy[a] - balls->vy[b];
+
+    const float qa = vx * vx + vy * vy;
+    const float qb = 2.0f * (px * vx + py * vy);
+    const float reach = balls->radius[a] + balls->radius[b];
+    const float qc = px * px + py * py - reach * reach;
+    if (qc <= 0 || qb >= 0 || qa == 0) return;
+
+    const float disc = qb * qb - 4.0f * qa * qc;
+    if (disc < 0) return;
+
+    const float t = (-qb - sqrtf(disc)) / (2.0f * qa);
+    if (t >= 0 && t < impact->time) *impact = (Impact) {.kind = IMPACT_BALL, .time = t, .other = b};
+}
+
+// what the sweeps of one substep share: the grids to look up the other balls in, and the words of balls->swept
+// holding the fast balls
+typedef struct {
+    Broadphase *broadphase;
+    bool grid; // the grids are up to date, otherwise every visible ball is looked at
+    size_t first_word;
+    size_t last_word;
+} Sweep;
+
+typedef struct {
+    float min_x, min_y, max_x, max_y;
+} Box;
+
+static void nearbyImpact(Impact *impact, const BallStore *balls, const size_t a, const size_t b, const Box *box) {
+    if (b == a || balls->x[b] < box->min_x || balls->x[b] > box->max_x || balls->y[b] < box->min_y ||
+        balls->y[b] > box->max_y) {
+        return;
+    }
+
+    ballImpact(impact, balls, a, b);
+}
+
+static Impact firstImpact(const BallStore *balls, const Obstacles *obstacles, const Terrain *terrain,
+                          const Sweep *sweep, const size_t a, const float remaining) {
+    Impact impact = {.kind = IMPACT_NONE, .time = remaining};
+
+    // the terrain replaces the window walls
+    const float r = balls->radius[a];
+    float nx, ny;
+    if (!terrain->distance) {
+        wallImpact(&impact, IMPACT_WALL_X, balls->x[a], balls->vx[a], WORLD_MIN_X(r), WORLD_MAX_X(r));
+        wallImpact(&impact, IMPACT_WALL_Y, balls->y[a], balls->vy[a], WORLD_MIN_Y(r), WORLD_MAX_Y(r));
+    } else if (SweepTerrain(terrain, balls->x[a], balls->y[a], balls->vx[a], balls->vy[a], r, &impact.time, &nx,
+                            &ny)) {
+        impact = (Impact) {.kind = IMPACT_OBSTACLE, .time = impact.time, .nx = nx, .ny = ny};
+    }
+
+    if (SweepObstacles(obstacles, balls->x[a], balls->y[a], balls->vx[a], balls->vy[a], r, &impact.time, &nx, &ny)) {
+        impact = (Impact) {.kind = IMPACT_OBSTACLE, .time = impact.time, .nx = nx, .ny = ny};
+    }
+
+    // everything within reach of the swept path, awake or asleep
+    const float x1 = balls->x[a] + balls->vx[a] * remaining;
+    const float y1 = balls->y[a] + balls->vy[a] * remaining;
+    const float reach = r + BALL_MAX_RADIUS;
+    const Box box = {
+            fminf(balls->x[a], x1) - reach, fminf(balls->y[a], y1) - reach,
+            fmaxf(balls->x[a], x1) + reach, fmaxf(balls->y[a], y1) + reach
+    };
+
+    Broadphase *broadphase = sweep->broadphase;
+    if (sweep->grid && FindBallsInBox(broadphase, balls, box.min_x, box.min_y, box.max_x, box.max_y)) {
+        for (size_t k = 0; k < broadphase->nearby_count; ++k) {
+            nearbyImpact(&impact, balls, a, broadphase->nearby[k], &box);
+        }
+
+        // the swept balls may have left the cells they are listed in
+        for (size_t w = sweep->first_word; w <= sweep->last_word; ++w) {
+            for (Uint64 bits = balls->swept[w]; bits; bits &= bits - 1) {
+                nearbyImpact(&impact, balls, a, w * BALL_MASK_BITS + BALL_MASK_CTZ(bits), &box);
+            }
+        }
+
+        return impact;
+    }
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            nearbyImpact(&impact, balls, a, w * BALL_MASK_BITS + BALL_MASK_CTZ(bits), &box);
+        }
+    }
+
+    return impact;
+}
+
+// same impulse as HandleCollision, at the moment of touching so there is no overlap to push out
+static void bounceBalls(BallStore *balls, const size_t a, const size_t b) {
+    if (IsBallIdle(balls, b)) WakeIsland(balls, b);
+
+    const float dx = balls->x[b] - balls->x[a];
+    const float dy = balls->y[b] - balls->y[a];
+    const float distance = sqrtf(dx * dx + dy * dy);
+    const float nx = dx / distance;
+    const float ny = dy / distance;
+
+    const float dot = (balls->vx[b] - balls->vx[a]) * nx + (balls->vy[b] - balls->vy[a]) * ny;
+    if (dot > 0) return;
+
+    // the lighter ball takes the larger share, halved as in HandleCollision so a ball just over the sweep
+    // threshold bounces exactly as hard as one just under it
+    const float inv_sum = balls->inv_mass[a] + balls->inv_mass[b];
+    const float share_a = balls->inv_mass[a] / inv_sum;
+    const float share_b = balls->inv_mass[b] / inv_sum;
+    const float impulse = -(1 + PairRestitution(balls, a, b)) * dot / 2.0f;
+    balls->vx[a] -= impulse * nx * share_a;
+    balls->vy[a] -= impulse * ny * share_a;
+    balls->vx[b] += impulse * nx * share_b;
+    balls->vy[b] += impulse * ny * share_b;
+}
+
+static void sweepBall(BallStore *balls, const Obstacles *obstacles, const Terrain *terrain, const Sweep *sweep,
+                      const size_t i, const float gravity, const float dt) {
+    const float r = balls->radius[i];
+    const float bounce = balls->materials.restitution[balls->material[i]];
+
+    // gravity first, as in the integration kernel
+    balls->vy[i] += gravity * dt;
+
+    float remaining = dt;
+    for (int n = 0; n < BALL_CCD_MAX_IMPACTS && remaining > 0; ++n) {
+        const Impact impact = firstImpact(balls, obstacles, terrain, sweep, i, remaining);
+
+        balls->x[i] += balls->vx[i] * impact.time;
+        balls->y[i] += balls->vy[i] * impact.time;
+        remaining -= impact.time;
+
+        switch (impact.kind) {
+            case IMPACT_WALL_X:
+                balls->vx[i] = -balls->vx[i] * bounce;
+                break;
+            case IMPACT_WALL_Y:
+                balls->vy[i] = -balls->vy[i] * bounce;
+                break;
+            case IMPACT_BALL:
+                bounceBalls(balls, i, impact.other);
+                break;
+            case IMPACT_OBSTACLE: {
+                const float approach = balls->vx[i] * impact.nx + balls->vy[i] * impact.ny;
+                balls->vx[i] -= (1 + bounce) * approach * impact.nx;
+                balls->vy[i] -= (1 + bounce) * approach * impact.ny;
+                break;
+            }
+            case IMPACT_NONE:
+            default:
+                remaining = 0;
+                break;
+        }
+    }
+
+    balls->x[i] += balls->vx[i] * remaining;
+    balls->y[i] += balls->vy[i] * remaining;
+    if (terrain->distance) return;
+
+    balls->x[i] = fminf(fmaxf(balls->x[i], WORLD_MIN_X(r)), WORLD_MAX_X(r));
+    balls->y[i] = fminf(fmaxf(balls->y[i], WORLD_MIN_Y(r)), WORLD_MAX_Y(r));
+}
+
+void SweepFastBalls(BallStore *balls, Broadphase *broadphase, const Obstacles *obstacles, const Terrain *terrain,
+                    const float gravity, const float dt) {
+    Sweep sweep = {.broadphase = broadphase, .first_word = SIZE_MAX};
+
+    // the fast balls are picked first, before any of them moves
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        balls->swept[w] = 0;
+
+        // only circles, a sweep knows nothing of corners
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w] & ~balls->shaped[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const float limit = balls->radius[i] / dt;
+            if (balls->vx[i] * balls->vx[i] + balls->vy[i] * balls->vy[i] <= limit * limit) continue;
+
+            balls->swept[w] |= (Uint64) 1 << (i % BALL_MASK_BITS);
+            sweep.first_word = SDL_min(sweep.first_word, w);
+            sweep.last_word = w;
+        }
+    }
+
+    // slow scenes never pay for the grids
+    if (sweep.first_word == SIZE_MAX) return;
+    sweep.grid = RefreshGrids(broadphase, balls);
+
+    for (size_t w = sweep.first_word; w <= sweep.last_word; ++w) {
+        for (Uint64 bits = balls->swept[w]; bits; bits &= bits - 1) {
+            sweepBall(balls, obstacles, terrain, &sweep, w * BALL_MASK_BITS + BALL_MASK_CTZ(bits), gravity, dt);
+        }
+    }
+}
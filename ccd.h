@@ -0,0 +1,19 @@
+#ifndef CCD_H
+#define CCD_H
+
+#include "ball.h"
+#include "broadphase.h"
+#include "obstacles.h"
+#include "terrain.h"
+
+#define BALL_CCD_MAX_IMPACTS 4 // impacts handled per ball and step, the rest of the step is travelled unchecked
+
+// moves every active ball that would travel more than its own radius within dt seconds along its path,
+// stopping at the exact time of impact with a wall, an obstacle or another ball, bouncing, and carrying on for the rest
+// of dt. with terrain loaded its surface takes the walls' place. those balls are flagged in balls->swept so the
+// integration kernel skips them. gravity as for IntegrateBalls. the other balls are looked up in broadphase's grids,
+// the active one is rebuilt for it whenever there is a fast ball
+void SweepFastBalls(BallStore *balls, Broadphase *broadphase, const Obstacles *obstacles, const Terrain *terrain,
+                    float gravity, float dt);
+
+#endif
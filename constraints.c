@@ -0,0 +1,220 @@
+#include "constraints.h"
+#include <math.h>
+
+typedef struct {
+    BallStore *balls;
+    const Constraint *list;
+    float dt;
+} ConstraintTask;
+
+
+void FreeConstraints(Constraints *constraints) {
+    SDL_free(constraints->list);
+    SDL_free(constraints->scratch);
+    SDL_free(constraints->color);
+    SDL_free(constraints->ball_colors);
+    *constraints = (Constraints) {0};
+}
+
+static bool reserveConstraints(Constraints *constraints, const size_t count) {
+    if (count <= constraints->capacity) return true;
+
+    const size_t capacity = SDL_max(count, constraints->capacity * 2);
+
+    Constraint *list = SDL_realloc(constraints->list, capacity * sizeof(Constraint));
+    if (!list) return false;
+    constraints->list = list;
+
+    Constraint *scratch = SDL_realloc(constraints->scratch, capacity * sizeof(Constraint));
+    if (!scratch) return false;
+    constraints->scratch = scratch;
+
+    Uint8 *color = SDL_realloc(constraints->color, capacity * sizeof(Uint8));
+    if (!color) return false;
+    constraints->color = color;
+
+    constraints->capacity = capacity;
+    return true;
+}
+
+bool AddConstraint(Constraints *constraints, const BallStore *balls, const BallHandle a, const BallHandle b,
+                   const float rest_length, const float compliance, const float damping) {
+    const size_t i = GetBallIndex(balls, a);
+    const size_t j = GetBallIndex(balls, b);
+    if (i == (size_t) -1 || j == (size_t) -1 || i == j) return false;
+    if (!reserveConstraints(constraints, constraints->count + 1)) return false;
+
+    const float dx = balls->x[j] - balls->x[i];
+    const float dy = balls->y[j] - balls->y[i];
+
+    constraints->list[constraints->count++] = (Constraint) {
+            .a = a.index,
+            .b = b.index,
+            .generation_a = a.generation,
+            .generation_b = b.generation,
+            .rest_length = rest_length < 0 ? sqrtf(dx * dx + dy * dy) : rest_length,
+            .compliance = fmaxf(compliance, 0),
+            .damping = fmaxf(damping, 0)
+    };
+    constraints->dirty = true;
+    return true;
+}
+
+void ClearConstraints(Constraints *constraints) {
+    constraints->count = 0;
+    constraints->batch_count = 0;
+    constraints->dirty = false;
+}
+
+// greedy colouring in list order, then a counting sort of the constraints by colour into scratch
+static bool buildBatches(Constraints *constraints, const size_t ball_capacity) {
+    if (ball_capacity > constraints->ball_capacity) {
+        Uint64 *ball_colors = SDL_realloc(constraints->ball_colors, ball_capacity * sizeof(Uint64));
+        if (!ball_colors) return false;
+        SDL_memset(ball_colors + constraints->ball_capacity, 0,
+                   (ball_capacity - constraints->ball_capacity) * sizeof(Uint64));
+        constraints->ball_colors = ball_colors;
+        constraints->ball_capacity = ball_capacity;
+    }
+
+    Uint32 *start = constraints->batch_start;
+    Uint64 *ball_colors = constraints->ball_colors;
+    SDL_memset(start, 0, sizeof(constraints->batch_start));
+
+    for (size_t k = 0; k < constraints->count; ++k) {
+        const Constraint *link = &constraints->list[k];
+        const Uint64 taken = ball_colors[link->a] | ball_colors[link->b];
+
+        int color = CONSTRAINT_MAX_COLORS;
+        if (taken != ~(Uint64) 0) {
+            color = (int) BALL_MASK_CTZ(~taken);
+            ball_colors[link->a] |= (Uint64) 1 << color;
+            ball_colors[link->b] |= (Uint64) 1 << color;
+        }
+
+        constraints->color[k] = color;
+        start[color + 1]++;
+    }
+
+    for (int c = 0; c <= CONSTRAINT_MAX_COLORS; ++c) start[c + 1] += start[c];
+
+    constraints->batch_count = 0;
+    for (int c = 0; c <= CONSTRAINT_MAX_COLORS; ++c) {
+        if (start[c + 1] > start[c]) constraints->batch_count = c + 1;
+    }
+
+    // stable scatter keeps the list order inside a batch, and clears the colours for the next rebuild
+    Uint32 cursor[CONSTRAINT_MAX_COLORS + 1];
+    SDL_memcpy(cursor, start, sizeof(cursor));
+    for (size_t k = 0; k < constraints->count; ++k) {
+        const Constraint link = constraints->list[k];
+        constraints->scratch[cursor[constraints->color[k]]++] = link;
+        ball_colors[link.a] = 0;
+        ball_colors[link.b] = 0;
+    }
+
+    Constraint *list = constraints->list;
+    constraints->list = constraints->scratch;
+    constraints->scratch = list;
+    return true;
+}
+
+void UpdateConstraints(Constraints *constraints, const BallStore *balls) {
+    // a released ball takes its constraints with it, whoever gets its slot next is a different ball
+    size_t kept = 0;
+    for (size_t k = 0; k < constraints->count; ++k) {
+        const Constraint link = constraints->list[k];
+        if (balls->generation[link.a] != link.generation_a || balls->generation[link.b] != link.generation_b ||
+            !IsBallVisible(balls, link.a) || !IsBallVisible(balls, link.b)) {
+            continue;
+        }
+        constraints->list[kept++] = link;
+    }
+
+    if (kept != constraints->count) constraints->dirty = true;
+    constraints->count = kept;
+
+    // out of memory leaves the flag set, the solver then takes the whole list on one thread
+    if (constraints->dirty && buildBatches(constraints, balls->capacity)) constraints->dirty = false;
+}
+
+void RemapConstraints(Constraints *constraints, const BallStore *balls) {
+    // a link to a ball that was already gone becomes a link to BALL_HANDLE_NONE, UpdateConstraints drops it
+    for (size_t k = 0; k < constraints->count; ++k) {
+        Constraint *link = &constraints->list[k];
+        const BallHandle a = RemapBallHandle(balls, (BallHandle) {.index = link->a, .generation = link->generation_a});
+        const BallHandle b = RemapBallHandle(balls, (BallHandle) {.index = link->b, .generation = link->generation_b});
+        link->a = a.index;
+        link->b = b.index;
+        link->generation_a = a.generation;
+        link->generation_b = b.generation;
+    }
+}
+
+static void solveSerial(BallStore *balls, const Constraint *list, const size_t count, const float dt) {
+    for (size_t k = 0; k < count; ++k) {
+        const Constraint *link = &list[k];
+        const Uint32 a = link->a;
+        const Uint32 b = link->b;
+
+        const float wa = IsBallIdle(balls, a) ? 0 : balls->inv_mass[a];
+        const float wb = IsBallIdle(balls, b) ? 0 : balls->inv_mass[b];
+        if (wa + wb <= 0) continue;
+
+        const float dx = balls->x[b] - balls->x[a];
+        const float dy = balls->y[b] - balls->y[a];
+        const float distance = sqrtf(dx * dx + dy * dy);
+        if (distance <= 0) continue;
+
+        const float nx = dx / distance;
+        const float ny = dy / distance;
+        const float error = distance - link->rest_length;
+
+        // XPBD with one pass per substep: the multiplier starts at 0 each time, compliance is scaled by dt^2.
+        // the damping term counts how fast the link is stretching now
+        const float alpha = link->compliance / (dt * dt);
+        const float gamma = alpha * link->damping / dt;
+        const float stretching = ((balls->vx[b] - balls->vx[a]) * nx + (balls->vy[b] - balls->vy[a]) * ny) * dt;
+        const float correction = (error + gamma * stretching) / ((1.0f + gamma) * (wa + wb) + alpha);
+
+        // positions move towards each other and the velocities follow them, as if the substep had
+        // integrated to the corrected positions
+        const float move_a = wa * correction;
+        const float move_b = wb * correction;
+        balls->x[a] += move_a * nx;
+        balls->y[a] += move_a * ny;
+        balls->x[b] -= move_b * nx;
+        balls->y[b] -= move_b * ny;
+        balls->vx[a] += move_a * nx / dt;
+        balls->vy[a] += move_a * ny / dt;
+        balls->vx[b] -= move_b * nx / dt;
+        balls->vy[b] -= move_b * ny / dt;
+    }
+}
+
+static void solveBatchSlice(void *ctx, const size_t begin, const size_t end) {
+    const ConstraintTask *task = ctx;
+    solveSerial(task->balls, task->list + begin, end - begin, task->dt);
+}
+
+void SolveConstraints(Constraints *constraints, WorkerPool *workers, BallStore *balls, const float dt) {
+    if (!constraints->count) return;
+
+    if (constraints->dirty) {
+        solveSerial(balls, constraints->list, constraints->count, dt);
+        return;
+    }
+
+    // one batch per phase, the last (overflow) batch may share balls so it stays on this thread
+    for (int c = 0; c < constraints->batch_count; ++c) {
+        const size_t begin = constraints->batch_start[c];
+        const size_t size = constraints->batch_start[c + 1] - begin;
+
+        if (c == CONSTRAINT_MAX_COLORS || size < CONSTRAINT_MIN_PARALLEL_BATCH || workers->thread_count <= 1) {
+            solveSerial(balls, constraints->list + begin, size, dt);
+        } else {
+            ConstraintTask task = {.balls = balls, .list = constraints->list + begin, .dt = dt};
+            RunParallel(workers, size, solveBatchSlice, &task);
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef CONSTRAINTS_H
+#define CONSTRAINTS_H
+
+#include "ball.h"
+#include "workers.h"
+
+#define CONSTRAINT_MAX_COLORS 64 // constraints that don't fit in these go into one last batch run on a single thread
+#define CONSTRAINT_MIN_PARALLEL_BATCH 256 // smaller batches aren't worth waking the workers for
+#define CONSTRAINT_RIGID 0.0f // compliance of a rod, anything above is a spring
+#define CONSTRAINT_REST_CURRENT (-1.0f) // rest length: whatever the distance is when the constraint is added
+
+// keeps two balls rest_length apart. compliance is the inverse stiffness (px/unit of force, 0 is rigid),
+// damping (s) takes out motion along the link. the generations let a step notice a released ball
+typedef struct {
+    Uint32 a;
+    Uint32 b;
+    Uint32 generation_a;
+    Uint32 generation_b;
+    float rest_length;
+    float compliance;
+    float damping;
+} Constraint;
+
+// distance constraints between balls (chains, ropes, soft bodies) solved with XPBD: once per substep,
+// after integration, every constraint moves its two balls towards rest_length and their velocities with them.
+// the constraints live in one flat array, kept in batch order: greedy colouring puts no ball twice in a
+// batch, so a batch is solved by all threads at once without locks, and since the array persists between
+// steps it's only recoloured when a constraint comes or goes. like the contact batches the result doesn't
+// depend on the thread count
+typedef struct {
+    size_t count;
+    size_t capacity;
+    Constraint *list;
+    Constraint *scratch; // recolouring target, swapped with list
+    Uint8 *color;
+    size_t ball_capacity;
+    Uint64 *ball_colors; // colours already taken by each ball's constraints
+    Uint32 batch_start[CONSTRAINT_MAX_COLORS + 2];
+    int batch_count;
+    bool dirty; // the batches have to be rebuilt
+} Constraints;
+
+void FreeConstraints(Constraints *constraints);
+
+// links two live balls, rest_length < 0 takes their current distance. false for a stale handle,
+// a ball linked to itself or when memory runs out
+bool AddConstraint(Constraints *constraints, const BallStore *balls, BallHandle a, BallHandle b,
+                   float rest_length, float compliance, float damping);
+
+void ClearConstraints(Constraints *constraints);
+
+// once per step before the substeps: drops constraints on released balls and rebuilds the batches if needed
+void UpdateConstraints(Constraints *constraints, const BallStore *balls);
+
+// follows the balls to their new slots after SortBallStore, the batches stay as they are
+void RemapConstraints(Constraints *constraints, const BallStore *balls);
+
+// one XPBD pass over dt seconds. idle balls count as fixed, a constraint between two of them is skipped
+void SolveConstraints(Constraints *constraints, WorkerPool *workers, BallStore *balls, float dt);
+
+#endif
@@ -0,0 +1,639 @@
+#include "events.h"
+#include "world.h"
+#include <math.h>
+
+#define NO_BALL ((Uint32) -1)
+#define NO_LIST ((Uint32) -1)
+#define IDLE_LIFETIME_S (BALL_IDLE_LIFETIME_MS / 1000.0)
+#define ROLL_DECAY_TIME(friction) (-STEP_TIME_S / logf(friction)) // s, rolling slows down like on the stepped floor
+
+typedef struct {
+    float x;
+    float y;
+    float vx;
+    float vy;
+} BallState;
+
+typedef struct {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+} Box;
+
+
+static bool reserveSimulation(EventSimulation *sim, const size_t capacity) {
+    if (!sim->heads) {
+        sim->cols = (WIN_WIDTH + EVENT_CELL_SIZE - 1) / EVENT_CELL_SIZE;
+        sim->rows = (WIN_HEIGHT + EVENT_CELL_SIZE - 1) / EVENT_CELL_SIZE;
+        sim->heads = SDL_malloc((sim->cols * sim->rows + 1) * sizeof(Uint32));
+        if (!sim->heads) return false;
+        SDL_memset(sim->heads, 0xFF, (sim->cols * sim->rows + 1) * sizeof(Uint32));
+    }
+
+    if (capacity <= sim->capacity) return true;
+
+#define GROW(field)                                                                      \
+    do {                                                                                 \
+        void *grown = SDL_realloc(sim->field, capacity * sizeof(*sim->field));          \
+        if (!grown) return false;                                                        \
+        sim->field = grown;                                                              \
+    } while (0)
+
+    GROW(t0);
+    GROW(x0);
+    GROW(y0);
+    GROW(vx0);
+    GROW(vy0);
+    GROW(roll_time);
+    GROW(motion);
+    GROW(stamp);
+    GROW(generation);
+    GROW(joined);
+    GROW(list);
+    GROW(next);
+    GROW(prev);
+#undef GROW
+
+    const size_t added = capacity - sim->capacity;
+    SDL_memset(sim->stamp + sim->capacity, 0, added * sizeof(Uint32));
+    SDL_memset(sim->generation + sim->capacity, 0, added * sizeof(Uint32));
+    SDL_memset(sim->list + sim->capacity, 0xFF, added * sizeof(Uint32));
+    sim->capacity = capacity;
+    return true;
+}
+
+void FreeEventSimulation(EventSimulation *sim) {
+    SDL_free(sim->t0);
+    SDL_free(sim->x0);
+    SDL_free(sim->y0);
+    SDL_free(sim->vx0);
+    SDL_free(sim->vy0);
+    SDL_free(sim->roll_time);
+    SDL_free(sim->motion);
+    SDL_free(sim->stamp);
+    SDL_free(sim->generation);
+    SDL_free(sim->joined);
+    SDL_free(sim->heap);
+    SDL_free(sim->heads);
+    SDL_free(sim->list);
+    SDL_free(sim->next);
+    SDL_free(sim->prev);
+    *sim = (EventSimulation) {0};
+}
+
+static bool isTracked(const EventSimulation *sim, const BallStore *balls, const size_t i) {
+    return sim->generation[i] == balls->generation[i] && IsBallVisible(balls, i);
+}
+
+// --- where the balls are: resting ones by cell, the moving ones all in the list after the cells
+
+static Uint32 movingList(const EventSimulation *sim) {
+    return (Uint32) (sim->cols * sim->rows);
+}
+
+// on floats, so a box without bounds covers the whole grid
+static int cellCoord(const float p, const int cells) {
+    const float c = p / EVENT_CELL_SIZE;
+    if (!(c >= 0)) return 0;
+    return c >= (float) cells ? cells - 1 : (int) c;
+}
+
+static void unlistBall(EventSimulation *sim, const size_t i) {
+    const Uint32 list = sim->list[i];
+    if (list == NO_LIST) return;
+
+    if (sim->prev[i] != NO_BALL) {
+        sim->next[sim->prev[i]] = sim->next[i];
+    } else {
+        sim->heads[list] = sim->next[i];
+    }
+    if (sim->next[i] != NO_BALL) sim->prev[sim->next[i]] = sim->prev[i];
+    sim->list[i] = NO_LIST;
+}
+
+static void listBall(EventSimulation *sim, const size_t i, const Uint32 list) {
+    unlistBall(sim, i);
+
+    sim->list[i] = list;
+    sim->prev[i] = NO_BALL;
+    sim->next[i] = sim->heads[list];
+    if (sim->heads[list] != NO_BALL) sim->prev[sim->heads[list]] = (Uint32) i;
+    sim->heads[list] = (Uint32) i;
+}
+
+// --- priority queue, a binary min-heap on time
+
+static void pushEvent(EventSimulation *sim, const BallEvent event) {
+    if (sim->heap_count == sim->heap_capacity) {
+        const size_t capacity = sim->heap_capacity ? sim->heap_capacity * 2 : 1024;
+        BallEvent *heap = SDL_realloc(sim->heap, capacity * sizeof(BallEvent));
+        if (!heap) return; // the ball goes on without a prediction until something runs into it
+        sim->heap = heap;
+        sim->heap_capacity = capacity;
+    }
+
+    size_t k = sim->heap_count++;
+    while (k > 0 && sim->heap[(k - 1) / 2].time > event.time) {
+        sim->heap[k] = sim->heap[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    sim->heap[k] = event;
+}
+
+static void siftDown(EventSimulation *sim, size_t k) {
+    const BallEvent event = sim->heap[k];
+
+    for (;;) {
+        size_t child = 2 * k + 1;
+        if (child >= sim->heap_count) break;
+        if (child + 1 < sim->heap_count && sim->heap[child + 1].time < sim->heap[child].time) child++;
+        if (sim->heap[child].time >= event.time) break;
+
+        sim->heap[k] = sim->heap[child];
+        k = child;
+    }
+    sim->heap[k] = event;
+}
+
+static BallEvent popEvent(EventSimulation *sim) {
+    const BallEvent event = sim->heap[0];
+    sim->heap[0] = sim->heap[--sim->heap_count];
+    if (sim->heap_count) siftDown(sim, 0);
+    return event;
+}
+
+// stale events pile up in the heap until they're popped, throw them out in one go once there are too many
+static void compactHeap(EventSimulation *sim, const BallStore *balls) {
+    size_t count = 0;
+
+    for (size_t k = 0; k < sim->heap_count; ++k) {
+        const BallEvent event = sim->heap[k];
+        if (!isTracked(sim, balls, event.a) || event.stamp_a != sim->stamp[event.a]) continue;
+        sim->heap[count++] = event;
+    }
+
+    sim->heap_count = count;
+    for (size_t k = count / 2; k-- > 0;) siftDown(sim, k);
+}
+
+// --- closed-form paths
+
+static BallState evaluate(const EventSimulation *sim, const size_t i, const double time) {
+    const float dt = (float) (time - sim->t0[i]);
+    BallState state = {sim->x0[i], sim->y0[i], sim->vx0[i], sim->vy0[i]};
+
+    switch (sim->motion[i]) {
+        case MOTION_FLYING:
+            state.x += state.vx * dt;
+            state.y += (state.vy + 0.5f * WORLD_GRAVITY * dt) * dt;
+            state.vy += WORLD_GRAVITY * dt;
+            break;
+        case MOTION_ROLLING: {
+            const float tau = sim->roll_time[i];
+            const float decay = expf(-dt / tau);
+            state.x += state.vx * tau * (1.0f - decay);
+            state.vx *= decay;
+            break;
+        }
+        case MOTION_RESTING:
+        default:
+            // t0 is when it came to rest, it stays where it is
+            break;
+    }
+
+    return state;
+}
+
+// how fast ball i can be moving at any point within the next `span` seconds
+static float speedBound(const EventSimulation *sim, const size_t i, const BallState *state, const float span) {
+    switch (sim->motion[i]) {
+        case MOTION_FLYING:
+            return fabsf(state->vx) + fabsf(state->vy) + WORLD_GRAVITY * span;
+        case MOTION_ROLLING:
+            return fabsf(state->vx);
+        case MOTION_RESTING:
+        default:
+            return 0;
+    }
+}
+
+// a ball on the floor that isn't bouncing off it rolls
+static BallMotion motionFor(const BallStore *balls, const size_t i, const BallState *state) {
+    const float floor_y = WORLD_MAX_Y(balls->radius[i]);
+    if (state->y >= floor_y - EVENT_CONTACT_EPSILON && state->vy >= 0 && state->vy < BALL_REST_VELOCITY) {
+        return MOTION_ROLLING;
+    }
+    return MOTION_FLYING;
+}
+
+// starts a new path for ball i at `time`, invalidating every event predicted from the old one
+static void setPath(EventSimulation *sim, BallStore *balls, const size_t i, const double time, BallState state,
+                    const BallMotion motion) {
+    const Uint64 bit = (Uint64) 1 << (i % BALL_MASK_BITS);
+
+    if (motion == MOTION_ROLLING) {
+        state.y = WORLD_MAX_Y(balls->radius[i]);
+        state.vy = 0;
+    }
+
+    if (motion == MOTION_RESTING) {
+        state.vx = 0;
+        state.vy = 0;
+        balls->idle[i / BALL_MASK_BITS] |= bit;
+
+        // rested since `time`: the lifetimes count down the rest, for the fade and after a switch of engine
+        const double left = time + IDLE_LIFETIME_S - sim->now;
+        SetBallLifetime(balls, i, (Uint32) SDL_clamp(left * 1000.0, 0, BALL_IDLE_LIFETIME_MS));
+    } else {
+        balls->idle[i / BALL_MASK_BITS] &= ~bit;
+        ResetBallLifetime(balls, i);
+    }
+
+    sim->t0[i] = time;
+    sim->x0[i] = state.x;
+    sim->y0[i] = state.y;
+    sim->vx0[i] = state.vx;
+    sim->vy0[i] = state.vy;
+    sim->roll_time[i] = ROLL_DECAY_TIME(balls->materials.friction[balls->material[i]]);
+    sim->motion[i] = (Uint8) motion;
+    sim->stamp[i]++;
+
+    const Uint32 list = motion == MOTION_RESTING
+                        ? (Uint32) (cellCoord(state.y, sim->rows) * sim->cols + cellCoord(state.x, sim->cols))
+                        : movingList(sim);
+    listBall(sim, i, list);
+}
+
+// --- prediction
+
+static void earliest(BallEvent *event, const double time, const EventKind kind) {
+    if (time < event->time) {
+        event->time = time;
+        event->kind = kind;
+    }
+}
+
+// what ball i's path sweeps over from now until `until`
+static Box pathBox(const EventSimulation *sim, const size_t i, const double until) {
+    if (until == INFINITY) return (Box) {-INFINITY, -INFINITY, INFINITY, INFINITY};
+
+    const BallState from = evaluate(sim, i, sim->now);
+    const BallState to = evaluate(sim, i, until);
+    Box box = {fminf(from.x, to.x), fminf(from.y, to.y), fmaxf(from.x, to.x), fmaxf(from.y, to.y)};
+
+    // a flight may turn around in between, x only ever goes one way
+    const double apex = sim->t0[i] - sim->vy0[i] / WORLD_GRAVITY;
+    if (sim->motion[i] == MOTION_FLYING && apex > sim->now && apex < until) {
+        box.min_y = fminf(box.min_y, evaluate(sim, i, apex).y);
+    }
+
+    return box;
+}
+
+static bool boxesMeet(const Box *a, const Box *b, const float reach) {
+    return a->min_x - reach <= b->max_x && b->min_x <= a->max_x + reach && a->min_y - reach <= b->max_y &&
+           b->min_y <= a->max_y + reach;
+}
+
+// the next wall, floor, stop or expiry ball i's own path runs into
+static BallEvent pathEvent(const EventSimulation *sim, const BallStore *balls, const size_t i) {
+    BallEvent event = {.time = INFINITY, .a = i, .b = NO_BALL};
+    const float r = balls->radius[i];
+    const float tau = sim->roll_time[i];
+    const double t0 = sim->t0[i];
+    const float x = sim->x0[i];
+    const float y = sim->y0[i];
+    const float vx = sim->vx0[i];
+    const float vy = sim->vy0[i];
+
+    switch (sim->motion[i]) {
+        case MOTION_FLYING: {
+            if (vx < 0) earliest(&event, t0 + (WORLD_MIN_X(r) - x) / vx, EVENT_WALL_X);
+            if (vx > 0) earliest(&event, t0 + (WORLD_MAX_X(r) - x) / vx, EVENT_WALL_X);
+
+            // y(t) = y + vy t + g t^2 / 2, the ceiling is only reached on the way up
+            if (vy < 0) {
+                const float disc = vy * vy - 2.0f * WORLD_GRAVITY * (y - WORLD_MIN_Y(r));
+                if (disc >= 0) earliest(&event, t0 + (-vy - sqrtf(disc)) / WORLD_GRAVITY, EVENT_CEILING);
+            }
+            const float disc = fmaxf(vy * vy + 2.0f * WORLD_GRAVITY * (WORLD_MAX_Y(r) - y), 0);
+            earliest(&event, t0 + (-vy + sqrtf(disc)) / WORLD_GRAVITY, EVENT_FLOOR);
+            break;
+        }
+        case MOTION_ROLLING: {
+            // x(t) = x + vx tau (1 - e^(-t / tau)), so it only gets so far before stopping
+            const float speed = fabsf(vx);
+            earliest(&event, speed > BALL_IDLE_VELOCITY ? t0 + tau * logf(speed / BALL_IDLE_VELOCITY) : t0, EVENT_STOP);
+
+            if (vx != 0) {
+                const float reach = ((vx < 0 ? WORLD_MIN_X(r) : WORLD_MAX_X(r)) - x) / (vx * tau);
+                if (reach < 1.0f) earliest(&event, t0 - tau * log1pf(-reach), EVENT_WALL_X);
+            }
+            break;
+        }
+        case MOTION_RESTING:
+        default:
+            earliest(&event, t0 + IDLE_LIFETIME_S, EVENT_EXPIRE);
+            break;
+    }
+
+    return event;
+}
+
+// earliest time from now on at which balls i and j touch while closing in, INFINITY if not before horizon
+static double contactTime(const EventSimulation *sim, const BallStore *balls, const size_t i, const size_t j,
+                          const double horizon) {
+    const float span = (float) (horizon - sim->now);
+    const float reach = balls->radius[i] + balls->radius[j];
+    BallState a = evaluate(sim, i, sim->now);
+    BallState b = evaluate(sim, j, sim->now);
+
+    if (sim->motion[i] == MOTION_FLYING && sim->motion[j] == MOTION_FLYING) {
+        // the same gravity pulls on both, relative to each other they move in a straight line:
+        // |d + dv t| = reach, the smaller root in a form that doesn't cancel
+        const float dx = b.x - a.x;
+        const float dy = b.y - a.y;
+        const float dvx = b.vx - a.vx;
+        const float dvy = b.vy - a.vy;
+        const float qb = dx * dvx + dy * dvy;
+        const float qc = dx * dx + dy * dy - reach * reach;
+        if (qb >= 0) return INFINITY;
+        if (qc <= 0) return sim->now;
+
+        const float disc = qb * qb - (dvx * dvx + dvy * dvy) * qc;
+        if (disc < 0) return INFINITY;
+
+        const float t = qc / (-qb + sqrtf(disc));
+        return t <= span ? sim->now + t : INFINITY;
+    }
+
+    // anything else: conservative advancement, never stepping further than the gap could close
+    // at the fastest both balls might be moving before the horizon
+    const float bound = speedBound(sim, i, &a, span) + speedBound(sim, j, &b, span);
+    if (bound <= 0) return INFINITY;
+
+    float t = 0;
+    for (int n = 0; n < EVENT_SWEEP_ITERATIONS; ++n) {
+        if (n) {
+            a = evaluate(sim, i, sim->now + t);
+            b = evaluate(sim, j, sim->now + t);
+        }
+
+        const float dx = b.x - a.x;
+        const float dy = b.y - a.y;
+        const float gap = sqrtf(dx * dx + dy * dy) - reach;
+        if (gap < EVENT_CONTACT_EPSILON && dx * (b.vx - a.vx) + dy * (b.vy - a.vy) < 0) return sim->now + t;
+
+        t += fmaxf(gap, EVENT_CONTACT_EPSILON) / bound;
+        if (t > span) return INFINITY;
+    }
+
+    // not there yet, the event just makes ball i look again from that point
+    return sim->now + t;
+}
+
+static void considerBall(EventSimulation *sim, const BallStore *balls, BallEvent *event, const size_t i,
+                        const size_t j) {
+    const double time = contactTime(sim, balls, i, j, event->time);
+    if (time < event->time) {
+        event->time = time;
+        event->kind = EVENT_BALL;
+        event->b = j;
+    }
+}
+
+// queues the first thing ball i runs into. only balls whose paths come within reach of i's before its own next
+// event can get in first: the moving ones are culled on the boxes of both paths, the resting ones are looked up
+// in the cells around i's. balls that are gone are dropped from the lists on the way
+static void predict(EventSimulation *sim, const BallStore *balls, const size_t i) {
+    BallEvent event = pathEvent(sim, balls, i);
+    const Box box = pathBox(sim, i, event.time);
+    const float r = balls->radius[i] + EVENT_CONTACT_EPSILON;
+
+    for (Uint32 j = sim->heads[movingList(sim)], after; j != NO_BALL; j = after) {
+        after = sim->next[j];
+        if (j == i) continue;
+        if (!isTracked(sim, balls, j)) {
+            unlistBall(sim, j);
+            continue;
+        }
+
+        const Box other = pathBox(sim, j, event.time);
+        if (boxesMeet(&box, &other, r + balls->radius[j])) considerBall(sim, balls, &event, i, j);
+    }
+
+    if (sim->motion[i] != MOTION_RESTING) {
+        const float reach = r + BALL_MAX_RADIUS;
+
+        for (int y = cellCoord(box.min_y - reach, sim->rows); y <= cellCoord(box.max_y + reach, sim->rows); ++y) {
+            for (int x = cellCoord(box.min_x - reach, sim->cols); x <= cellCoord(box.max_x + reach, sim->cols); ++x) {
+                for (Uint32 j = sim->heads[y * sim->cols + x], after; j != NO_BALL; j = after) {
+                    after = sim->next[j];
+                    if (!isTracked(sim, balls, j)) {
+                        unlistBall(sim, j);
+                        continue;
+                    }
+
+                    const Box other = {sim->x0[j], sim->y0[j], sim->x0[j], sim->y0[j]};
+                    if (boxesMeet(&box, &other, r + balls->radius[j])) considerBall(sim, balls, &event, i, j);
+                }
+            }
+        }
+    }
+
+    if (event.time == INFINITY) return;
+    event.stamp_a = sim->stamp[i];
+    event.stamp_b = event.b != NO_BALL ? sim->stamp[event.b] : 0;
+    pushEvent(sim, event);
+}
+
+// --- events
+
+static void collide(EventSimulation *sim, BallStore *balls, const size_t i, const size_t j) {
+    BallState a = evaluate(sim, i, sim->now);
+    BallState b = evaluate(sim, j, sim->now);
+    const float dx = b.x - a.x;
+    const float dy = b.y - a.y;
+    const float distance = sqrtf(dx * dx + dy * dy);
+    const float nx = distance > 0 ? dx / distance : 1.0f;
+    const float ny = distance > 0 ? dy / distance : 0.0f;
+    const float closing = (b.vx - a.vx) * nx + (b.vy - a.vy) * ny;
+    const float bounce = PairRestitution(balls, i, j);
+
+    if (distance > balls->radius[i] + balls->radius[j] + EVENT_CONTACT_EPSILON || closing >= 0) {
+        // an advancement that ran out of iterations, or a contact that rounding made miss: look again
+        predict(sim, balls, i);
+        return;
+    }
+
+    // resting balls don't move, and a rolling ball landed on from above is held up by the floor:
+    // either way the other ball takes the whole bounce. the impulse is HandleCollision's halved one, which can
+    // leave a pair still closing: the stepped engine pushes such an overlap apart, here they leave at
+    // EVENT_SEPARATION_SPEED instead of meeting again at this same instant, but never faster than a full bounce
+    const bool i_holds = sim->motion[i] == MOTION_RESTING ||
+                         (sim->motion[i] == MOTION_ROLLING && sim->motion[j] == MOTION_FLYING && ny < 0);
+    const bool j_holds = sim->motion[j] == MOTION_RESTING ||
+                         (sim->motion[j] == MOTION_ROLLING && sim->motion[i] == MOTION_FLYING && ny > 0);
+
+    if (i_holds || j_holds) {
+        const bool i_moves = j_holds;
+        const size_t m = i_moves ? i : j;
+        BallState *s = i_moves ? &a : &b;
+        const float sx = i_moves ? nx : -nx; // from the moving ball to the resting one
+        const float sy = i_moves ? ny : -ny;
+        const float approach = s->vx * sx + s->vy * sy;
+        const float impulse = fminf(fmaxf((1 + bounce) * approach / 2.0f, approach + EVENT_SEPARATION_SPEED),
+                                    (1 + bounce) * approach);
+        s->vx -= impulse * sx;
+        s->vy -= impulse * sy;
+
+        // too slow to bounce off a ball below it: it stays there
+        const bool perched = sy > 0 && impulse - approach < BALL_REST_VELOCITY;
+        setPath(sim, balls, m, sim->now, *s, perched ? MOTION_RESTING : motionFor(balls, m, s));
+    } else {
+        // the lighter ball takes the larger share of the change in closing speed
+        const float inv_sum = balls->inv_mass[i] + balls->inv_mass[j];
+        const float share_a = balls->inv_mass[i] / inv_sum;
+        const float share_b = balls->inv_mass[j] / inv_sum;
+        const float impulse = fminf(fmaxf(-(1 + bounce) * closing / 2.0f, EVENT_SEPARATION_SPEED - closing),
+                                    -(1 + bounce) * closing);
+        a.vx -= impulse * nx * share_a;
+        a.vy -= impulse * ny * share_a;
+        b.vx += impulse * nx * share_b;
+        b.vy += impulse * ny * share_b;
+
+        setPath(sim, balls, i, sim->now, a, motionFor(balls, i, &a));
+        setPath(sim, balls, j, sim->now, b, motionFor(balls, j, &b));
+    }
+
+    predict(sim, balls, i);
+    predict(sim, balls, j);
+}
+
+static void handleEvent(EventSimulation *sim, BallStore *balls, const BallEvent *event) {
+    const size_t i = event->a;
+    BallState state = evaluate(sim, i, sim->now);
+    BallMotion motion = sim->motion[i];
+    const float r = balls->radius[i];
+    const float bounce = balls->materials.restitution[balls->material[i]];
+
+    switch (event->kind) {
+        case EVENT_WALL_X:
+            if (state.x < (WORLD_MIN_X(r) + WORLD_MAX_X(r)) * 0.5f) {
+                state.x = WORLD_MIN_X(r);
+                state.vx = fabsf(state.vx) * bounce;
+            } else {
+                state.x = WORLD_MAX_X(r);
+                state.vx = -fabsf(state.vx) * bounce;
+            }
+            break;
+        case EVENT_CEILING:
+            state.y = WORLD_MIN_Y(r);
+            state.vy = fabsf(state.vy) * bounce;
+            break;
+        case EVENT_FLOOR:
+            state.y = WORLD_MAX_Y(r);
+            state.vy = -fabsf(state.vy) * bounce;
+            motion = -state.vy < BALL_REST_VELOCITY ? MOTION_ROLLING : MOTION_FLYING;
+            break;
+        case EVENT_STOP:
+            motion = MOTION_RESTING;
+            break;
+        case EVENT_EXPIRE:
+            ReleaseBall(balls, i);
+            unlistBall(sim, i);
+            sim->generation[i] = 0;
+            sim->stamp[i]++;
+            return;
+        case EVENT_BALL:
+        default:
+            collide(sim, balls, i, event->b);
+            return;
+    }
+
+    setPath(sim, balls, i, sim->now, state, motion);
+    predict(sim, balls, i);
+}
+
+// gives every visible ball the simulation doesn't know yet a path, then predicts them once all have one
+static void pickUpBalls(EventSimulation *sim, BallStore *balls) {
+    size_t count = 0;
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            if (sim->generation[i] == balls->generation[i]) continue;
+
+            const BallState state = {balls->x[i], balls->y[i], balls->vx[i], balls->vy[i]};
+            sim->generation[i] = balls->generation[i];
+
+            if (IsBallIdle(balls, i)) {
+                // rested for as long as its lifetime has been counting down
+                const double rested = (BALL_IDLE_LIFETIME_MS - GetBallLifetime(balls, i)) / 1000.0;
+                setPath(sim, balls, i, sim->now - rested, state, MOTION_RESTING);
+            } else {
+                setPath(sim, balls, i, sim->now, state, motionFor(balls, i, &state));
+            }
+            sim->joined[count++] = i;
+        }
+    }
+
+    for (size_t k = 0; k < count; ++k) predict(sim, balls, sim->joined[k]);
+}
+
+bool StartEventSimulation(EventSimulation *sim, BallStore *balls) {
+    if (!reserveSimulation(sim, balls->capacity)) return false;
+
+    // forget every path and event, all balls join again
+    SDL_memset(sim->generation, 0, sim->capacity * sizeof(Uint32));
+    SDL_memset(sim->list, 0xFF, sim->capacity * sizeof(Uint32));
+    SDL_memset(sim->heads, 0xFF, (sim->cols * sim->rows + 1) * sizeof(Uint32));
+    sim->heap_count = 0;
+    pickUpBalls(sim, balls);
+    return true;
+}
+
+void AdvanceEventSimulation(EventSimulation *sim, BallStore *balls, const double seconds) {
+    if (!reserveSimulation(sim, balls->capacity)) return;
+    pickUpBalls(sim, balls);
+
+    const double target = sim->now + seconds;
+    const size_t budget = (size_t) (seconds * EVENT_MAX_PER_SECOND) + 1;
+    sim->event_count = 0;
+
+    // events the budget cut off stay queued and are handled late, at the start of the next advance
+    while (sim->heap_count && sim->heap[0].time <= target && sim->event_count < budget) {
+        const BallEvent event = popEvent(sim);
+        if (event.time > sim->now) sim->now = event.time;
+
+        // a's path changed since, it predicted again back then
+        if (!isTracked(sim, balls, event.a) || event.stamp_a != sim->stamp[event.a]) continue;
+
+        // only the other ball's path changed: this was a's next event, so a needs a new one
+        if (event.b != NO_BALL && (!isTracked(sim, balls, event.b) || event.stamp_b != sim->stamp[event.b])) {
+            predict(sim, balls, event.a);
+            continue;
+        }
+
+        handleEvent(sim, balls, &event);
+        sim->event_count++;
+    }
+
+    sim->now = target;
+    if (sim->heap_count > EVENT_HEAP_SLACK * balls->capacity) compactHeap(sim, balls);
+
+    // the rest of the engine and the renderer see plain positions and velocities
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const BallState state = evaluate(sim, i, sim->now);
+            const float r = balls->radius[i];
+
+            balls->x[i] = fminf(fmaxf(state.x, WORLD_MIN_X(r)), WORLD_MAX_X(r));
+            balls->y[i] = fminf(fmaxf(state.y, WORLD_MIN_Y(r)), WORLD_MAX_Y(r));
+            balls->vx[i] = state.vx;
+            balls->vy[i] = state.vy;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "ball.h"
+
+#define EVENT_MAX_PER_SECOND 1000000 // of simulated time, guards against endless bounce cascades
+#define EVENT_HEAP_SLACK 4 // the queue is rebuilt once it holds this many entries per ball
+#define EVENT_CONTACT_EPSILON 0.01f // px, balls closer than this count as touching
+#define EVENT_SEPARATION_SPEED 30.0f // px/s two balls leave a contact with at least, stands in for the overlap push
+#define EVENT_SWEEP_ITERATIONS 64 // conservative advancement steps before a pair is checked again later
+#define EVENT_CELL_SIZE (BALL_RADIUS * 2) // px, cells of the grid the resting balls are looked up in
+
+// between events a ball follows one of these closed-form paths
+typedef enum {
+    MOTION_FLYING, // projectile under gravity
+    MOTION_ROLLING, // on the floor, horizontal speed decaying by floor friction
+    MOTION_RESTING // still, collides as a static ball until its lifetime runs out
+} BallMotion;
+
+typedef enum {
+    EVENT_WALL_X,
+    EVENT_CEILING,
+    EVENT_FLOOR,
+    EVENT_STOP, // a rolling ball comes to rest
+    EVENT_EXPIRE, // a resting ball's lifetime is over
+    EVENT_BALL,
+} EventKind;
+
+// `a` predicted it, b is the other ball of an EVENT_BALL. an event is stale once either ball's stamp moved on
+typedef struct {
+    double time;
+    Uint32 a;
+    Uint32 b;
+    Uint32 stamp_a;
+    Uint32 stamp_b;
+    EventKind kind;
+} BallEvent;
+
+// event-driven engine: every ball keeps the earliest wall, floor or ball contact its path runs into in a
+// min-heap, and the clock jumps straight from one event to the next. ball i's path starts at time t0[i]
+// from x0/y0/vx0/vy0, the BallStore only gets the evaluated positions at the end of each advance
+typedef struct {
+    size_t capacity;
+    double now;
+    double *t0;
+    float *x0;
+    float *y0;
+    float *vx0;
+    float *vy0;
+    float *roll_time; // s, how quickly rolling slows down with the ball's material
+    Uint8 *motion;
+    Uint32 *stamp; // bumped whenever the ball's path changes
+    Uint32 *generation; // generation of the ball the path belongs to, new balls are picked up on a mismatch
+    BallEvent *heap;
+    size_t heap_count;
+    size_t heap_capacity;
+    Uint32 *joined; // scratch list of balls picked up in one go
+    size_t event_count; // events handled by the last advance
+    // resting balls are listed in the grid cell they rest in, flying and rolling ones in one list after the
+    // cells: heads[c] is the first ball of list c, next and prev link each ball into the list `list` names
+    int cols;
+    int rows;
+    Uint32 *heads;
+    Uint32 *list;
+    Uint32 *next;
+    Uint32 *prev;
+} EventSimulation;
+
+// takes over the current state of every visible ball, idle ones as resting
+bool StartEventSimulation(EventSimulation *sim, BallStore *balls);
+
+void FreeEventSimulation(EventSimulation *sim);
+
+// handles every event up to `seconds` from now and leaves the resulting state in the BallStore.
+// balls spawned since the last call join first
+void AdvanceEventSimulation(EventSimulation *sim, BallStore *balls, double seconds);
+
+#endif
@@ -0,0 +1,448 @@
+#include "fluid.h"
+#include "world.h"
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 2D kernels of radius h: poly6 for density, the gradient of spiky for pressure, the laplacian of the
+// viscosity kernel for viscosity. the (h^2 - r^2)^3, (h - r)^2 and (h - r) parts are left to the passes
+#define FLUID_H_SQ (FLUID_SMOOTHING * FLUID_SMOOTHING)
+#define FLUID_POLY6 (4.0f / ((float) M_PI * FLUID_H_SQ * FLUID_H_SQ * FLUID_H_SQ * FLUID_H_SQ))
+#define FLUID_SPIKY_GRAD (30.0f / ((float) M_PI * FLUID_H_SQ * FLUID_H_SQ * FLUID_SMOOTHING))
+#define FLUID_VISCOSITY_LAPLACIAN (40.0f / ((float) M_PI * FLUID_H_SQ * FLUID_H_SQ * FLUID_SMOOTHING))
+
+typedef struct {
+    Fluid *fluid;
+    BallStore *balls;
+    const Obstacles *obstacles;
+    const Terrain *terrain;
+    float gravity;
+    float dt;
+} FluidTask;
+
+
+void InitFluid(Fluid *fluid) {
+    *fluid = (Fluid) {0};
+
+    // what a particle in a square lattice at FLUID_SPACING sees, so a fluid at rest is under no pressure
+    float density = 0;
+    for (int y = -2; y <= 2; ++y) {
+        for (int x = -2; x <= 2; ++x) {
+            const float r_sq = (float) (x * x + y * y) * FLUID_SPACING * FLUID_SPACING;
+            const float q = fmaxf(FLUID_H_SQ - r_sq, 0);
+            density += BALL_MASS * FLUID_POLY6 * q * q * q;
+        }
+    }
+    fluid->rest_density = density;
+}
+
+void FreeFluid(Fluid *fluid) {
+    SDL_free(fluid->order);
+    SDL_free(fluid->cell);
+    SDL_free(fluid->awake);
+    SDL_free(fluid->x);
+    SDL_free(fluid->y);
+    SDL_free(fluid->vx);
+    SDL_free(fluid->vy);
+    SDL_free(fluid->mass);
+    SDL_free(fluid->density);
+    SDL_free(fluid->pressure);
+    SDL_free(fluid->ax);
+    SDL_free(fluid->ay);
+    SDL_free(fluid->neighbours);
+    SDL_free(fluid->neighbour_count);
+    SDL_free(fluid->cell_start);
+    *fluid = (Fluid) {0};
+}
+
+static bool reserveFluid(Fluid *fluid, const size_t capacity) {
+    if (capacity <= fluid->capacity) return true;
+
+#define GROW(field, count)                                                             \
+    do {                                                                               \
+        void *grown = SDL_realloc(fluid->field, (count) * sizeof(*fluid->field));      \
+        if (!grown) return false;                                                      \
+        fluid->field = grown;                                                          \
+    } while (0)
+
+    GROW(order, capacity);
+    GROW(cell, capacity);
+    GROW(awake, capacity);
+    GROW(x, capacity);
+    GROW(y, capacity);
+    GROW(vx, capacity);
+    GROW(vy, capacity);
+    GROW(mass, capacity);
+    GROW(density, capacity);
+    GROW(pressure, capacity);
+    GROW(ax, capacity);
+    GROW(ay, capacity);
+    GROW(neighbours, capacity * FLUID_MAX_NEIGHBOURS);
+    GROW(neighbour_count, capacity);
+#undef GROW
+
+    fluid->capacity = capacity;
+    return true;
+}
+
+// --- cell list
+
+// counting sort of the visible balls by grid cell, false if memory runs out
+static bool sortParticles(Fluid *fluid, const BallStore *balls) {
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    size_t n = 0;
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            min_x = fminf(min_x, balls->x[i]);
+            min_y = fminf(min_y, balls->y[i]);
+            max_x = fmaxf(max_x, balls->x[i]);
+            max_y = fmaxf(max_y, balls->y[i]);
+            n++;
+        }
+    }
+
+    fluid->count = n;
+    if (!n) return true;
+
+    // h-sized cells, or larger ones if the particles are spread too far for that many
+    float cell_size = FLUID_SMOOTHING;
+    int columns, rows;
+    for (;;) {
+        columns = (int) ((max_x - min_x) / cell_size) + 1;
+        rows = (int) ((max_y - min_y) / cell_size) + 1;
+        if ((size_t) columns * (size_t) rows <= FLUID_MAX_CELLS) break;
+        cell_size *= 2.0f;
+    }
+
+    const size_t cells = (size_t) columns * (size_t) rows;
+    if (cells + 1 > fluid->cell_capacity) {
+        Uint32 *cell_start = SDL_realloc(fluid->cell_start, (cells + 1) * sizeof(Uint32));
+        if (!cell_start) return false;
+        fluid->cell_start = cell_start;
+        fluid->cell_capacity = cells + 1;
+    }
+
+    fluid->columns = columns;
+    fluid->rows = rows;
+    fluid->cell_size = cell_size;
+    fluid->min_x = min_x;
+    fluid->min_y = min_y;
+
+    Uint32 *start = fluid->cell_start;
+    SDL_memset(start, 0, (cells + 1) * sizeof(Uint32));
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const int cx = (int) ((balls->x[i] - min_x) / cell_size);
+            const int cy = (int) ((balls->y[i] - min_y) / cell_size);
+            fluid->cell[i] = (Uint32) (cy * columns + cx);
+            start[fluid->cell[i]]++;
+        }
+    }
+
+    Uint32 sum = 0;
+    for (size_t c = 0; c < cells; ++c) {
+        const Uint32 count = start[c];
+        start[c] = sum;
+        sum += count;
+    }
+
+    // scattering moves every start to the next cell's, shifting them back restores them
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            fluid->order[start[fluid->cell[i]]++] = (Uint32) i;
+        }
+    }
+    for (size_t c = cells; c > 0; --c) start[c] = start[c - 1];
+    start[0] = 0;
+
+    for (size_t k = 0; k < n; ++k) {
+        const Uint32 i = fluid->order[k];
+        fluid->x[k] = balls->x[i];
+        fluid->y[k] = balls->y[i];
+        fluid->vx[k] = balls->vx[i];
+        fluid->vy[k] = balls->vy[i];
+        fluid->mass[k] = 1.0f / balls->inv_mass[i];
+        fluid->awake[k] = !IsBallIdle(balls, i);
+    }
+    return true;
+}
+
+// every particle within h from the 3 x 3 cells around each one, itself first so a full list still has it and
+// the density is never 0. a full list swaps its farthest neighbour for any closer one, so a compressed fluid keeps
+// the nearest whichever side they are on; only pairs near the two cut-offs can be in one list but not the other.
+// the list is padded with the particle itself up to a multiple of 4 so the SIMD passes can always load whole groups
+static void neighbourTask(void *ctx, const size_t begin, const size_t end) {
+    Fluid *fluid = ((const FluidTask *) ctx)->fluid;
+    float distance_sq[FLUID_MAX_NEIGHBOURS];
+
+    for (size_t k = begin; k < end; ++k) {
+        Uint32 *list = &fluid->neighbours[k * FLUID_MAX_NEIGHBOURS];
+        list[0] = (Uint32) k;
+        int count = 1;
+        int farthest = 0; // only looked at once the list is full
+
+        const int cx = (int) ((fluid->x[k] - fluid->min_x) / fluid->cell_size);
+        const int cy = (int) ((fluid->y[k] - fluid->min_y) / fluid->cell_size);
+        const int x0 = SDL_max(cx - 1, 0), x1 = SDL_min(cx + 1, fluid->columns - 1);
+        const int y0 = SDL_max(cy - 1, 0), y1 = SDL_min(cy + 1, fluid->rows - 1);
+
+        // a row of cells is one run of particles
+        for (int y = y0; y <= y1; ++y) {
+            const Uint32 first = fluid->cell_start[y * fluid->columns + x0];
+            const Uint32 last = fluid->cell_start[y * fluid->columns + x1 + 1];
+
+            for (Uint32 j = first; j < last; ++j) {
+                const float dx = fluid->x[j] - fluid->x[k];
+                const float dy = fluid->y[j] - fluid->y[k];
+                const float r_sq = dx * dx + dy * dy;
+                if (j == k || r_sq >= FLUID_H_SQ) continue;
+
+                if (count < FLUID_MAX_NEIGHBOURS) {
+                    distance_sq[count] = r_sq;
+                    list[count++] = j;
+                    if (count < FLUID_MAX_NEIGHBOURS) continue;
+                } else if (r_sq < distance_sq[farthest]) {
+                    distance_sq[farthest] = r_sq;
+                    list[farthest] = j;
+                } else {
+                    continue;
+                }
+
+                // the particle itself in slot 0 is never swapped out
+                farthest = 1;
+                for (int n = 2; n < FLUID_MAX_NEIGHBOURS; ++n) {
+                    if (distance_sq[n] > distance_sq[farthest]) farthest = n;
+                }
+            }
+        }
+
+        fluid->neighbour_count[k] = (Uint8) count;
+        while (count % 4) list[count++] = (Uint32) k;
+    }
+}
+
+// --- passes
+
+#if defined(__SSE2__)
+
+static inline __m128 gather4(const float *values, const Uint32 *index) {
+    return _mm_setr_ps(values[index[0]], values[index[1]], values[index[2]], values[index[3]]);
+}
+
+// all ones in the lanes of a group that hold real neighbours
+static inline __m128 laneMask(const int remaining) {
+    return _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(remaining)));
+}
+
+static inline float sum4(const __m128 v) {
+    const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+static void densityTask(void *ctx, const size_t begin, const size_t end) {
+    Fluid *fluid = ((const FluidTask *) ctx)->fluid;
+
+    for (size_t k = begin; k < end; ++k) {
+        const Uint32 *list = &fluid->neighbours[k * FLUID_MAX_NEIGHBOURS];
+        const int count = fluid->neighbour_count[k];
+        const __m128 px = _mm_set1_ps(fluid->x[k]);
+        const __m128 py = _mm_set1_ps(fluid->y[k]);
+        __m128 sum = _mm_setzero_ps();
+
+        for (int j = 0; j < count; j += 4) {
+            const __m128 dx = _mm_sub_ps(gather4(fluid->x, list + j), px);
+            const __m128 dy = _mm_sub_ps(gather4(fluid->y, list + j), py);
+            const __m128 r_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            const __m128 q = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(FLUID_H_SQ), r_sq), _mm_setzero_ps());
+            const __m128 mass = _mm_and_ps(gather4(fluid->mass, list + j), laneMask(count - j));
+            sum = _mm_add_ps(sum, _mm_mul_ps(mass, _mm_mul_ps(q, _mm_mul_ps(q, q))));
+        }
+
+        fluid->density[k] = FLUID_POLY6 * sum4(sum);
+        fluid->pressure[k] = FLUID_STIFFNESS * fmaxf(fluid->density[k] - fluid->rest_density, 0);
+    }
+}
+
+static void forceTask(void *ctx, const size_t begin, const size_t end) {
+    Fluid *fluid = ((const FluidTask *) ctx)->fluid;
+    const __m128 zero = _mm_setzero_ps();
+
+    for (size_t k = begin; k < end; ++k) {
+        if (!fluid->awake[k]) continue;
+
+        const Uint32 *list = &fluid->neighbours[k * FLUID_MAX_NEIGHBOURS];
+        const int count = fluid->neighbour_count[k];
+        const __m128 px = _mm_set1_ps(fluid->x[k]);
+        const __m128 py = _mm_set1_ps(fluid->y[k]);
+        const __m128 pvx = _mm_set1_ps(fluid->vx[k]);
+        const __m128 pvy = _mm_set1_ps(fluid->vy[k]);
+        const __m128 pressure = _mm_set1_ps(fluid->pressure[k]);
+        __m128 ax = zero, ay = zero, drag_x = zero, drag_y = zero;
+
+        for (int j = 0; j < count; j += 4) {
+            const Uint32 *index = list + j;
+            const __m128 dx = _mm_sub_ps(px, gather4(fluid->x, index));
+            const __m128 dy = _mm_sub_ps(py, gather4(fluid->y, index));
+            const __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+            const __m128 hr = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(FLUID_SMOOTHING), r), zero);
+
+            // mass over density of each neighbour, 0 in the padding lanes
+            const __m128 share = _mm_and_ps(_mm_div_ps(gather4(fluid->mass, index), gather4(fluid->density, index)),
+                                            laneMask(count - j));
+
+            // pressure pushes apart along the line between them; a particle on top of another has no line
+            const __m128 mean_pressure = _mm_mul_ps(_mm_add_ps(pressure, gather4(fluid->pressure, index)),
+                                                    _mm_set1_ps(0.5f * FLUID_SPIKY_GRAD));
+            const __m128 push = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(share, mean_pressure), _mm_mul_ps(hr, hr)),
+                                           _mm_max_ps(r, _mm_set1_ps(1e-6f)));
+            ax = _mm_add_ps(ax, _mm_mul_ps(push, dx));
+            ay = _mm_add_ps(ay, _mm_mul_ps(push, dy));
+
+            // viscosity pulls towards the neighbours' velocity
+            const __m128 drag = _mm_mul_ps(_mm_mul_ps(share, hr),
+                                           _mm_set1_ps(FLUID_VISCOSITY * FLUID_VISCOSITY_LAPLACIAN));
+            drag_x = _mm_add_ps(drag_x, _mm_mul_ps(drag, _mm_sub_ps(gather4(fluid->vx, index), pvx)));
+            drag_y = _mm_add_ps(drag_y, _mm_mul_ps(drag, _mm_sub_ps(gather4(fluid->vy, index), pvy)));
+        }
+
+        fluid->ax[k] = sum4(ax) / fluid->density[k] + sum4(drag_x);
+        fluid->ay[k] = sum4(ay) / fluid->density[k] + sum4(drag_y);
+    }
+}
+
+#else
+
+static void densityTask(void *ctx, const size_t begin, const size_t end) {
+    Fluid *fluid = ((const FluidTask *) ctx)->fluid;
+
+    for (size_t k = begin; k < end; ++k) {
+        const Uint32 *list = &fluid->neighbours[k * FLUID_MAX_NEIGHBOURS];
+        float sum = 0;
+
+        for (int n = 0; n < fluid->neighbour_count[k]; ++n) {
+            const Uint32 j = list[n];
+            const float dx = fluid->x[j] - fluid->x[k];
+            const float dy = fluid->y[j] - fluid->y[k];
+            const float q = fmaxf(FLUID_H_SQ - (dx * dx + dy * dy), 0);
+            sum += fluid->mass[j] * q * q * q;
+        }
+
+        fluid->density[k] = FLUID_POLY6 * sum;
+        fluid->pressure[k] = FLUID_STIFFNESS * fmaxf(fluid->density[k] - fluid->rest_density, 0);
+    }
+}
+
+static void forceTask(void *ctx, const size_t begin, const size_t end) {
+    Fluid *fluid = ((const FluidTask *) ctx)->fluid;
+
+    for (size_t k = begin; k < end; ++k) {
+        if (!fluid->awake[k]) continue;
+
+        const Uint32 *list = &fluid->neighbours[k * FLUID_MAX_NEIGHBOURS];
+        float ax = 0, ay = 0, drag_x = 0, drag_y = 0;
+
+        for (int n = 0; n < fluid->neighbour_count[k]; ++n) {
+            const Uint32 j = list[n];
+            const float dx = fluid->x[k] - fluid->x[j];
+            const float dy = fluid->y[k] - fluid->y[j];
+            const float r = sqrtf(dx * dx + dy * dy);
+            const float hr = fmaxf(FLUID_SMOOTHING - r, 0);
+            const float share = fluid->mass[j] / fluid->density[j];
+
+            const float mean_pressure = (fluid->pressure[k] + fluid->pressure[j]) * 0.5f * FLUID_SPIKY_GRAD;
+            const float push = share * mean_pressure * hr * hr / fmaxf(r, 1e-6f);
+            ax += push * dx;
+            ay += push * dy;
+
+            const float drag = share * hr * FLUID_VISCOSITY * FLUID_VISCOSITY_LAPLACIAN;
+            drag_x += drag * (fluid->vx[j] - fluid->vx[k]);
+            drag_y += drag * (fluid->vy[j] - fluid->vy[k]);
+        }
+
+        fluid->ax[k] = ax / fluid->density[k] + drag_x;
+        fluid->ay[k] = ay / fluid->density[k] + drag_y;
+    }
+}
+
+#endif
+
+// moves each awake particle's ball and keeps it inside the walls or terrain and out of obstacles
+static void driftTask(void *ctx, const size_t begin, const size_t end) {
+    const FluidTask *task = ctx;
+    Fluid *fluid = task->fluid;
+    BallStore *balls = task->balls;
+    const float dt = task->dt;
+    const float max_accel = FLUID_MAX_TRAVEL / (dt * dt);
+
+    for (size_t k = begin; k < end; ++k) {
+        if (!fluid->awake[k]) continue;
+
+        const Uint32 i = fluid->order[k];
+        const float r = balls->radius[i];
+        const float bounce = balls->materials.restitution[balls->material[i]];
+
+        // pressure grows without bound with the density, a fluid packed far beyond rest would blow apart. only
+        // the fluid's own push is limited, gravity and whatever speed the particle already has are left alone
+        float ax = fluid->ax[k], ay = fluid->ay[k];
+        const float accel_sq = ax * ax + ay * ay;
+        if (accel_sq > max_accel * max_accel) {
+            const float scale = max_accel / sqrtf(accel_sq);
+            ax *= scale;
+            ay *= scale;
+        }
+
+        balls->vx[i] = fluid->vx[k] + ax * dt;
+        balls->vy[i] = fluid->vy[k] + (ay + task->gravity) * dt;
+        balls->x[i] += balls->vx[i] * dt;
+        balls->y[i] += balls->vy[i] * dt;
+
+        if (task->terrain->distance) {
+            CollideBallTerrain(task->terrain, balls, i);
+        } else {
+            if (balls->x[i] < WORLD_MIN_X(r) || balls->x[i] > WORLD_MAX_X(r)) {
+                balls->vx[i] = -balls->vx[i] * bounce;
+                balls->x[i] = fminf(fmaxf(balls->x[i], WORLD_MIN_X(r)), WORLD_MAX_X(r));
+            }
+            if (balls->y[i] < WORLD_MIN_Y(r) || balls->y[i] > WORLD_MAX_Y(r)) {
+                balls->vy[i] = -balls->vy[i] * bounce;
+                balls->y[i] = fminf(fmaxf(balls->y[i], WORLD_MIN_Y(r)), WORLD_MAX_Y(r));
+            }
+        }
+        CollideBallObstacles(task->obstacles, balls, i);
+
+        fluid->x[k] = balls->x[i];
+        fluid->y[k] = balls->y[i];
+        fluid->vx[k] = balls->vx[i];
+        fluid->vy[k] = balls->vy[i];
+    }
+}
+
+bool StepFluid(Fluid *fluid, WorkerPool *workers, BallStore *balls, const Obstacles *obstacles,
+               const Terrain *terrain, const float gravity, const float dt) {
+    if (!reserveFluid(fluid, balls->capacity) || !sortParticles(fluid, balls)) return false;
+    if (!fluid->count) return true;
+
+    FluidTask task = {
+            .fluid = fluid,
+            .balls = balls,
+            .obstacles = obstacles,
+            .terrain = terrain,
+            .gravity = gravity,
+            .dt = dt / FLUID_SUBSTEPS
+    };
+
+    // the lists are found once a step, particles move only a fraction of h in that time
+    RunParallel(workers, fluid->count, neighbourTask, &task);
+
+    for (int s = 0; s < FLUID_SUBSTEPS; ++s) {
+        RunParallel(workers, fluid->count, densityTask, &task);
+        RunParallel(workers, fluid->count, forceTask, &task);
+        RunParallel(workers, fluid->count, driftTask, &task);
+    }
+    return true;
+}
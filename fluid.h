@@ -0,0 +1,59 @@
+#ifndef FLUID_H
+#define FLUID_H
+
+#include "ball.h"
+#include "obstacles.h"
+#include "terrain.h"
+#include "workers.h"
+
+#define FLUID_SMOOTHING 16.0f // px, kernel radius h: particles further apart don't interact
+#define FLUID_SPACING (FLUID_SMOOTHING * 0.5f) // px between particles at rest density
+#define FLUID_STIFFNESS 1.5e6f // px^2/s^2, pressure per unit of density above rest, the speed of sound squared
+#define FLUID_VISCOSITY 150.0f // px^2/s
+#define FLUID_SUBSTEPS 4 // density and forces per step, the speed of sound has to stay below 0.4 h per substep
+#define FLUID_MAX_TRAVEL (FLUID_SMOOTHING * 0.25f) // px the SPH forces alone can move a particle in a substep
+#define FLUID_MAX_NEIGHBOURS 48 // per particle, a fluid compressed beyond that keeps the nearest ones
+#define FLUID_MAX_CELLS (1 << 22) // the grid covers the particles' bounds, a wider spread coarsens the cells
+
+// smoothed-particle hydrodynamics on the ball pool: each visible ball is a fluid particle. a step sorts them
+// into a grid of h-sized cells (counting sort, so every cell is a contiguous run) and gathers each particle's
+// neighbours within h from its 3 x 3 cells once; every substep then runs a density pass and a pressure and
+// viscosity force pass over those lists, both split across the worker pool with 4 neighbours per SIMD lane group.
+// idle balls are part of the fluid but don't move, nothing goes idle while it's on
+typedef struct {
+    size_t capacity; // particles, the same as the ball capacity
+    size_t count;
+    float rest_density;
+    Uint32 *order; // ball index of each sorted particle
+    Uint32 *cell; // grid cell of each ball during the sort
+    Uint8 *awake;
+    float *x; // sorted particle state
+    float *y;
+    float *vx;
+    float *vy;
+    float *mass;
+    float *density;
+    float *pressure;
+    float *ax; // acceleration from the last force pass
+    float *ay;
+    Uint32 *neighbours; // FLUID_MAX_NEIGHBOURS per particle, sorted indices
+    Uint8 *neighbour_count;
+    size_t cell_capacity;
+    Uint32 *cell_start; // first particle of each cell, one past the last at the end
+    int columns;
+    int rows;
+    float cell_size;
+    float min_x;
+    float min_y;
+} Fluid;
+
+void InitFluid(Fluid *fluid);
+
+void FreeFluid(Fluid *fluid);
+
+// one step of dt seconds for every visible ball as a fluid particle: SPH forces and uniform gravity,
+// then the window walls (or terrain) and obstacles. false if memory runs out, the balls aren't moved then
+bool StepFluid(Fluid *fluid, WorkerPool *workers, BallStore *balls, const Obstacles *obstacles,
+               const Terrain *terrain, float gravity, float dt);
+
+#endif
@@ -0,0 +1,492 @@
+#include "integrate.h"
+#include "simd.h"
+#include "window.h"
+#include "world.h"
+#include <math.h>
+
+#if SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX512
+#include <immintrin.h>
+#define INTEGRATE_LANES 16
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX2
+#include <immintrin.h>
+#define INTEGRATE_LANES 8
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_SSE2
+#include <emmintrin.h>
+#define INTEGRATE_LANES 4
+#else
+#define INTEGRATE_LANES 1
+#endif
+
+
+#if SIMD_BUILD_LEVEL >= SIMD_LEVEL_SSE2
+
+static inline __m128 select4(const __m128 a, const __m128 b, const __m128 mask) {
+    return _mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b));
+}
+
+// radius and material coefficients of balls i .. i + 3
+static inline void loadBody4(const BallStore *balls, const size_t i, __m128 *radius, __m128 *restitution,
+                             __m128 *friction) {
+    const BallMaterials *materials = &balls->materials;
+    const Uint8 *m = &balls->material[i];
+
+    *radius = _mm_loadu_ps(&balls->radius[i]);
+    *restitution = _mm_setr_ps(materials->restitution[m[0]], materials->restitution[m[1]],
+                               materials->restitution[m[2]], materials->restitution[m[3]]);
+    *friction = _mm_setr_ps(materials->friction[m[0]], materials->friction[m[1]],
+                            materials->friction[m[2]], materials->friction[m[3]]);
+}
+
+// one step for 4 balls held in registers, shared by the float and the quantized kernel.
+// lanes outside `active` keep their values, returns the active balls that went idle.
+// without walls nothing is ever out of bounds, the terrain keeps the balls in instead
+static inline __m128 step4(__m128 *px, __m128 *py, __m128 *pvx, __m128 *pvy, const __m128 radius,
+                           const __m128 restitution, const __m128 friction, const __m128 active, const float gravity,
+                           const bool walls, const float dt) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 bounce = _mm_xor_ps(restitution, sign);
+    const __m128 min_x = walls ? radius : _mm_set1_ps(-INFINITY);
+    const __m128 max_x = walls ? _mm_sub_ps(_mm_set1_ps((float) WIN_WIDTH), radius) : _mm_set1_ps(INFINITY);
+    const __m128 min_y = min_x;
+    const __m128 max_y = walls ? _mm_sub_ps(_mm_set1_ps((float) WIN_HEIGHT), radius) : _mm_set1_ps(INFINITY);
+    const __m128 x = *px;
+    const __m128 y = *py;
+    const __m128 vx = *pvx;
+    const __m128 vy = *pvy;
+
+    // update the ball position
+    __m128 nvx = vx;
+    __m128 nvy = _mm_add_ps(vy, _mm_set1_ps(gravity * dt));
+    __m128 nx = _mm_add_ps(x, _mm_mul_ps(nvx, _mm_set1_ps(dt)));
+    __m128 ny = _mm_add_ps(y, _mm_mul_ps(nvy, _mm_set1_ps(dt)));
+
+    // boundary checking horizontal
+    const __m128 hit_x = _mm_or_ps(_mm_cmplt_ps(nx, min_x), _mm_cmpgt_ps(nx, max_x));
+    nvx = select4(nvx, _mm_mul_ps(nvx, bounce), hit_x);
+    nx = _mm_min_ps(_mm_max_ps(nx, min_x), max_x);
+
+    // boundary checking vertical
+    const __m128 hit_y = _mm_or_ps(_mm_cmplt_ps(ny, min_y), _mm_cmpgt_ps(ny, max_y));
+    nvy = select4(nvy, _mm_mul_ps(nvy, bounce), hit_y);
+    ny = _mm_min_ps(_mm_max_ps(ny, min_y), max_y);
+
+    // if ball is almost at rest vertically: floor friction, and stop it once it barely moves
+    const __m128 rest = _mm_and_ps(hit_y, _mm_cmplt_ps(_mm_andnot_ps(sign, nvy), _mm_set1_ps(BALL_REST_VELOCITY)));
+    nvx = select4(nvx, _mm_mul_ps(nvx, friction), rest);
+    const __m128 stop = _mm_and_ps(active, _mm_and_ps(
+            rest,
+            _mm_cmplt_ps(_mm_andnot_ps(sign, nvx), _mm_set1_ps(BALL_IDLE_VELOCITY))
+    ));
+    nvx = _mm_andnot_ps(stop, nvx);
+
+    *px = select4(x, nx, active);
+    *py = select4(y, ny, active);
+    *pvx = select4(vx, nvx, active);
+    *pvy = select4(vy, nvy, active);
+    return stop;
+}
+
+#else
+
+// one step for a single ball, returns whether it went idle
+static Uint32 stepBall(float *x, float *y, float *vx, float *vy, const float radius, const float restitution,
+                       const float friction, const float gravity, const bool walls, const float dt) {
+    // update the ball position
+    *vy += gravity * dt;
+
+    *x += *vx * dt;
+    *y += *vy * dt;
+    if (!walls) return 0;
+
+    // boundary checking horizontal
+    if (*x < WORLD_MIN_X(radius) || *x > WORLD_MAX_X(radius)) {
+        *vx = -*vx * restitution;
+        *x = fminf(fmaxf(*x, WORLD_MIN_X(radius)), WORLD_MAX_X(radius));
+    }
+
+    // boundary checking vertical
+    if (*y < WORLD_MIN_Y(radius) || *y > WORLD_MAX_Y(radius)) {
+        *vy = -*vy * restitution;
+        *y = fminf(fmaxf(*y, WORLD_MIN_Y(radius)), WORLD_MAX_Y(radius));
+
+        // if ball is almost at rest vertically
+        if (fabsf(*vy) < BALL_REST_VELOCITY) {
+            *vx *= friction;
+
+            if (fabsf(*vx) < BALL_IDLE_VELOCITY) {
+                // stop ball completely if horizontal velocity is very small
+                *vx = 0;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+#if INTEGRATE_LANES == 16
+
+// 16 balls per iteration, `lanes` holds one active bit per ball; returns the balls that went idle.
+// AVX-512F has no float logic, so signs are flipped on the integer side and selects go through masks
+static Uint32 integrateLanes(BallStore *balls, const size_t i, const Uint32 lanes, const float gravity,
+                             const bool walls, const float dt) {
+    const __mmask16 active = (__mmask16) lanes;
+    const __m512i sign = _mm512_set1_epi32((int) 0x80000000);
+
+    // radius and material coefficients, the latter gathered from the material table by id
+    const __m512i material = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) &balls->material[i]));
+    const __m512 bounce = _mm512_castsi512_ps(_mm512_xor_si512(
+            _mm512_castps_si512(_mm512_i32gather_ps(material, balls->materials.restitution, 4)),
+            sign
+    ));
+    const __m512 friction = _mm512_i32gather_ps(material, balls->materials.friction, 4);
+    const __m512 radius = _mm512_loadu_ps(&balls->radius[i]);
+    const __m512 far = _mm512_set1_ps(INFINITY);
+    const __m512 min_x = walls ? radius : _mm512_set1_ps(-INFINITY);
+    const __m512 max_x = walls ? _mm512_sub_ps(_mm512_set1_ps((float) WIN_WIDTH), radius) : far;
+    const __m512 min_y = min_x;
+    const __m512 max_y = walls ? _mm512_sub_ps(_mm512_set1_ps((float) WIN_HEIGHT), radius) : far;
+
+    const __m512 x = _mm512_loadu_ps(&balls->x[i]);
+    const __m512 y = _mm512_loadu_ps(&balls->y[i]);
+    const __m512 vx = _mm512_loadu_ps(&balls->vx[i]);
+    const __m512 vy = _mm512_loadu_ps(&balls->vy[i]);
+
+    // update the ball position
+    __m512 nvx = vx;
+    __m512 nvy = _mm512_add_ps(vy, _mm512_set1_ps(gravity * dt));
+    __m512 nx = _mm512_add_ps(x, _mm512_mul_ps(nvx, _mm512_set1_ps(dt)));
+    __m512 ny = _mm512_add_ps(y, _mm512_mul_ps(nvy, _mm512_set1_ps(dt)));
+
+    // boundary checking horizontal
+    const __mmask16 hit_x = _mm512_cmp_ps_mask(nx, min_x, _CMP_LT_OQ) | _mm512_cmp_ps_mask(nx, max_x, _CMP_GT_OQ);
+    nvx = _mm512_mask_mul_ps(nvx, hit_x, nvx, bounce);
+    nx = _mm512_min_ps(_mm512_max_ps(nx, min_x), max_x);
+
+    // boundary checking vertical
+    const __mmask16 hit_y = _mm512_cmp_ps_mask(ny, min_y, _CMP_LT_OQ) | _mm512_cmp_ps_mask(ny, max_y, _CMP_GT_OQ);
+    nvy = _mm512_mask_mul_ps(nvy, hit_y, nvy, bounce);
+    ny = _mm512_min_ps(_mm512_max_ps(ny, min_y), max_y);
+
+    // if ball is almost at rest vertically: floor friction, and stop it once it barely moves
+    const __mmask16 rest = hit_y & _mm512_cmp_ps_mask(
+            _mm512_abs_ps(nvy), _mm512_set1_ps(BALL_REST_VELOCITY), _CMP_LT_OQ
+    );
+    nvx = _mm512_mask_mul_ps(nvx, rest, nvx, friction);
+    const __mmask16 stop = active & rest & _mm512_cmp_ps_mask(
+            _mm512_abs_ps(nvx), _mm512_set1_ps(BALL_IDLE_VELOCITY), _CMP_LT_OQ
+    );
+    nvx = _mm512_maskz_mov_ps((__mmask16) ~stop, nvx);
+
+    _mm512_storeu_ps(&balls->x[i], _mm512_mask_blend_ps(active, x, nx));
+    _mm512_storeu_ps(&balls->y[i], _mm512_mask_blend_ps(active, y, ny));
+    _mm512_storeu_ps(&balls->vx[i], _mm512_mask_blend_ps(active, vx, nvx));
+    _mm512_storeu_ps(&balls->vy[i], _mm512_mask_blend_ps(active, vy, nvy));
+
+    return stop;
+}
+
+#elif INTEGRATE_LANES == 8
+
+// 8 balls per iteration, `lanes` holds one active bit per ball; returns the balls that went idle
+static Uint32 integrateLanes(BallStore *balls, const size_t i, const Uint32 lanes, const float gravity,
+                             const bool walls, const float dt) {
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 active = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+            _mm256_and_si256(_mm256_set1_epi32((int) lanes), lane_bits),
+            lane_bits
+    ));
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    // radius and material coefficients, the latter gathered from the material table by id
+    const __m256i material = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &balls->material[i]));
+    const __m256 bounce = _mm256_xor_ps(_mm256_i32gather_ps(balls->materials.restitution, material, 4), sign);
+    const __m256 friction = _mm256_i32gather_ps(balls->materials.friction, material, 4);
+    const __m256 radius = _mm256_loadu_ps(&balls->radius[i]);
+    const __m256 far = _mm256_set1_ps(INFINITY);
+    const __m256 min_x = walls ? radius : _mm256_xor_ps(far, sign);
+    const __m256 max_x = walls ? _mm256_sub_ps(_mm256_set1_ps((float) WIN_WIDTH), radius) : far;
+    const __m256 min_y = min_x;
+    const __m256 max_y = walls ? _mm256_sub_ps(_mm256_set1_ps((float) WIN_HEIGHT), radius) : far;
+
+    const __m256 x = _mm256_loadu_ps(&balls->x[i]);
+    const __m256 y = _mm256_loadu_ps(&balls->y[i]);
+    const __m256 vx = _mm256_loadu_ps(&balls->vx[i]);
+    const __m256 vy = _mm256_loadu_ps(&balls->vy[i]);
+
+    // update the ball position
+    __m256 nvx = vx;
+    __m256 nvy = _mm256_add_ps(vy, _mm256_set1_ps(gravity * dt));
+    __m256 nx = _mm256_add_ps(x, _mm256_mul_ps(nvx, _mm256_set1_ps(dt)));
+    __m256 ny = _mm256_add_ps(y, _mm256_mul_ps(nvy, _mm256_set1_ps(dt)));
+
+    // boundary checking horizontal
+    const __m256 hit_x = _mm256_or_ps(
+            _mm256_cmp_ps(nx, min_x, _CMP_LT_OQ),
+            _mm256_cmp_ps(nx, max_x, _CMP_GT_OQ)
+    );
+    nvx = _mm256_blendv_ps(nvx, _mm256_mul_ps(nvx, bounce), hit_x);
+    nx = _mm256_min_ps(_mm256_max_ps(nx, min_x), max_x);
+
+    // boundary checking vertical
+    const __m256 hit_y = _mm256_or_ps(
+            _mm256_cmp_ps(ny, min_y, _CMP_LT_OQ),
+            _mm256_cmp_ps(ny, max_y, _CMP_GT_OQ)
+    );
+    nvy = _mm256_blendv_ps(nvy, _mm256_mul_ps(nvy, bounce), hit_y);
+    ny = _mm256_min_ps(_mm256_max_ps(ny, min_y), max_y);
+
+    // if ball is almost at rest vertically: floor friction, and stop it once it barely moves
+    const __m256 rest = _mm256_and_ps(hit_y, _mm256_cmp_ps(
+            _mm256_andnot_ps(sign, nvy), _mm256_set1_ps(BALL_REST_VELOCITY), _CMP_LT_OQ
+    ));
+    nvx = _mm256_blendv_ps(nvx, _mm256_mul_ps(nvx, friction), rest);
+    const __m256 stop = _mm256_and_ps(active, _mm256_and_ps(rest, _mm256_cmp_ps(
+            _mm256_andnot_ps(sign, nvx), _mm256_set1_ps(BALL_IDLE_VELOCITY), _CMP_LT_OQ
+    )));
+    nvx = _mm256_andnot_ps(stop, nvx);
+
+    _mm256_storeu_ps(&balls->x[i], _mm256_blendv_ps(x, nx, active));
+    _mm256_storeu_ps(&balls->y[i], _mm256_blendv_ps(y, ny, active));
+    _mm256_storeu_ps(&balls->vx[i], _mm256_blendv_ps(vx, nvx, active));
+    _mm256_storeu_ps(&balls->vy[i], _mm256_blendv_ps(vy, nvy, active));
+
+    return (Uint32) _mm256_movemask_ps(stop);
+}
+
+#elif INTEGRATE_LANES == 4
+
+// 4 balls per iteration, `lanes` holds one active bit per ball; returns the balls that went idle
+static Uint32 integrateLanes(BallStore *balls, const size_t i, const Uint32 lanes, const float gravity,
+                             const bool walls, const float dt) {
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32((int) lanes), lane_bits),
+            lane_bits
+    ));
+
+    __m128 x = _mm_loadu_ps(&balls->x[i]);
+    __m128 y = _mm_loadu_ps(&balls->y[i]);
+    __m128 vx = _mm_loadu_ps(&balls->vx[i]);
+    __m128 vy = _mm_loadu_ps(&balls->vy[i]);
+    __m128 radius, restitution, friction;
+    loadBody4(balls, i, &radius, &restitution, &friction);
+
+    const __m128 stop = step4(&x, &y, &vx, &vy, radius, restitution, friction, active, gravity, walls, dt);
+
+    _mm_storeu_ps(&balls->x[i], x);
+    _mm_storeu_ps(&balls->y[i], y);
+    _mm_storeu_ps(&balls->vx[i], vx);
+    _mm_storeu_ps(&balls->vy[i], vy);
+
+    return (Uint32) _mm_movemask_ps(stop);
+}
+
+#else
+
+// scalar fallback, one ball per iteration
+static Uint32 integrateLanes(BallStore *balls, const size_t i, const Uint32 lanes, const float gravity,
+                             const bool walls, const float dt) {
+    if (!lanes) return 0;
+    const Uint8 m = balls->material[i];
+    return stepBall(&balls->x[i], &balls->y[i], &balls->vx[i], &balls->vy[i], balls->radius[i],
+                    balls->materials.restitution[m], balls->materials.friction[m], gravity, walls, dt);
+}
+
+#endif
+
+size_t SIMD_KERNEL(IntegrateBalls)(BallStore *balls, const float gravity, const bool walls, const float dt) {
+    const size_t words = BALL_MASK_WORDS(balls->capacity);
+    size_t idle_count = 0;
+
+    for (size_t w = 0; w < words; ++w) {
+        // balls the CCD pass already moved this step are left alone, as are the shapes IntegrateShapes moves
+        const Uint64 active = balls->visible[w] & ~balls->idle[w] & ~balls->swept[w] & ~balls->shaped[w];
+        if (!active) continue;
+
+        Uint64 went_idle = 0;
+        for (size_t lane = 0; lane < BALL_MASK_BITS; lane += INTEGRATE_LANES) {
+            const Uint32 lanes = (Uint32) (active >> lane) & ((1u << INTEGRATE_LANES) - 1);
+            if (!lanes) continue;
+
+            went_idle |= (Uint64) integrateLanes(balls, w * BALL_MASK_BITS + lane, lanes, gravity, walls, dt) << lane;
+        }
+
+        balls->idle[w] |= went_idle;
+        idle_count += BALL_MASK_POPCOUNT(went_idle);
+    }
+
+    return idle_count;
+}
+
+#if SIMD_BUILD_LEVEL >= SIMD_LEVEL_SSE2
+
+// the 16-bit streams fill one SSE2 register per field, the wider builds run the same code
+#define PACKED_LANES 8
+
+// same as HalfToFloat, on 4 halves zero-extended to 32 bits
+static inline __m128i halfToFloat4(const __m128i half) {
+    const __m128i magnitude = _mm_and_si128(half, _mm_set1_epi32(0x7FFF));
+    const __m128i sign = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x8000)), 16);
+    const __m128i bits = _mm_add_epi32(_mm_slli_epi32(magnitude, 13), _mm_set1_epi32(0x38000000));
+    return _mm_or_si128(sign, _mm_and_si128(_mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x3FF)), bits));
+}
+
+// same rounding, flushing and clamping as FloatToHalf
+static inline __m128i floatToHalf4(const __m128 value) {
+    const __m128i bits = _mm_castps_si128(value);
+    const __m128i sign = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x8000));
+    const __m128i magnitude = _mm_and_si128(bits, _mm_set1_epi32(0x7FFFFFFF));
+    const __m128i tiny = _mm_cmplt_epi32(magnitude, _mm_set1_epi32(0x38800000));
+    const __m128i huge = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x477FEFFF));
+
+    __m128i half = _mm_srli_epi32(_mm_add_epi32(magnitude, _mm_set1_epi32(0x1000 - 0x38000000)), 13);
+    half = _mm_andnot_si128(tiny, half);
+    half = _mm_or_si128(_mm_andnot_si128(huge, half), _mm_and_si128(huge, _mm_set1_epi32(0x7BFF)));
+    return _mm_or_si128(half, sign);
+}
+
+// two vectors of 32-bit values that fit in 16 bits into one vector of 16-bit values (SSE2 only packs signed)
+static inline __m128i packU16(const __m128i lo, const __m128i hi) {
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    return _mm_xor_si128(
+            _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias)),
+            _mm_set1_epi16((short) 0x8000)
+    );
+}
+
+// 8 packed balls per iteration, unpacked into two groups of 4 float lanes and packed straight back
+static Uint32 integratePacked(QuantizedBalls *quantized, const BallStore *balls, const size_t i, const Uint32 lanes,
+                              const float dt) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128 scale = _mm_set1_ps(QUANT_SCALE);
+    const __m128 inverse_scale = _mm_set1_ps(1.0f / QUANT_SCALE);
+    const __m128i low16 = _mm_set1_epi32(0xFFFF);
+    const __m128i low8 = _mm_set1_epi32(0xFF);
+
+    const __m128i cell = _mm_loadu_si128((const __m128i *) &quantized->cell[i]);
+    const __m128i qx = _mm_loadu_si128((const __m128i *) &quantized->qx[i]);
+    const __m128i qy = _mm_loadu_si128((const __m128i *) &quantized->qy[i]);
+    const __m128i hvx = _mm_loadu_si128((const __m128i *) &quantized->vx[i]);
+    const __m128i hvy = _mm_loadu_si128((const __m128i *) &quantized->vy[i]);
+
+    __m128i out_cell[2], out_qx[2], out_qy[2], out_vx[2], out_vy[2];
+    Uint32 went_idle = 0;
+
+    for (int h = 0; h < 2; ++h) {
+        const __m128i c = h ? _mm_unpackhi_epi16(cell, zero) : _mm_unpacklo_epi16(cell, zero);
+        const __m128i ox = h ? _mm_unpackhi_epi16(qx, zero) : _mm_unpacklo_epi16(qx, zero);
+        const __m128i oy = h ? _mm_unpackhi_epi16(qy, zero) : _mm_unpacklo_epi16(qy, zero);
+        const __m128i ovx = h ? _mm_unpackhi_epi16(hvx, zero) : _mm_unpacklo_epi16(hvx, zero);
+        const __m128i ovy = h ? _mm_unpackhi_epi16(hvy, zero) : _mm_unpacklo_epi16(hvy, zero);
+
+        // cell and offset together are a 24-bit fixed-point coordinate
+        __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c, low8), 16), ox)),
+                              inverse_scale);
+        __m128 y = _mm_mul_ps(_mm_cvtepi32_ps(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(c, 8), 16), oy)),
+                              inverse_scale);
+        __m128 vx = _mm_castsi128_ps(halfToFloat4(ovx));
+        __m128 vy = _mm_castsi128_ps(halfToFloat4(ovy));
+
+        const __m128 active = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                _mm_and_si128(_mm_set1_epi32((int) (lanes >> (4 * h))), lane_bits),
+                lane_bits
+        ));
+        __m128 radius, restitution, friction;
+        loadBody4(balls, i + 4 * h, &radius, &restitution, &friction);
+        const __m128 stop = step4(&x, &y, &vx, &vy, radius, restitution, friction, active, WORLD_GRAVITY, true, dt);
+        went_idle |= (Uint32) _mm_movemask_ps(stop) << (4 * h);
+
+        // an untouched lane converts back to exactly what it was loaded from
+        const __m128i fx = _mm_cvtps_epi32(_mm_mul_ps(x, scale));
+        const __m128i fy = _mm_cvtps_epi32(_mm_mul_ps(y, scale));
+        out_cell[h] = _mm_or_si128(_mm_srli_epi32(fx, 16), _mm_slli_epi32(_mm_srli_epi32(fy, 16), 8));
+        out_qx[h] = _mm_and_si128(fx, low16);
+        out_qy[h] = _mm_and_si128(fy, low16);
+        out_vx[h] = floatToHalf4(vx);
+        out_vy[h] = floatToHalf4(vy);
+    }
+
+    _mm_storeu_si128((__m128i *) &quantized->cell[i], packU16(out_cell[0], out_cell[1]));
+    _mm_storeu_si128((__m128i *) &quantized->qx[i], packU16(out_qx[0], out_qx[1]));
+    _mm_storeu_si128((__m128i *) &quantized->qy[i], packU16(out_qy[0], out_qy[1]));
+    _mm_storeu_si128((__m128i *) &quantized->vx[i], packU16(out_vx[0], out_vx[1]));
+    _mm_storeu_si128((__m128i *) &quantized->vy[i], packU16(out_vy[0], out_vy[1]));
+
+    return went_idle;
+}
+
+#else
+
+#define PACKED_LANES 1
+
+// scalar fallback, one packed ball per iteration
+static Uint32 integratePacked(QuantizedBalls *quantized, const BallStore *balls, const size_t i, const Uint32 lanes,
+                              const float dt) {
+    if (!lanes) return 0;
+
+    const Uint32 cell = quantized->cell[i];
+    float x = (float) (((cell & 0xFF) << 16) | quantized->qx[i]) / QUANT_SCALE;
+    float y = (float) (((cell >> 8) << 16) | quantized->qy[i]) / QUANT_SCALE;
+    float vx = HalfToFloat(quantized->vx[i]);
+    float vy = HalfToFloat(quantized->vy[i]);
+
+    const Uint8 m = balls->material[i];
+    const Uint32 went_idle = stepBall(&x, &y, &vx, &vy, balls->radius[i], balls->materials.restitution[m],
+                                      balls->materials.friction[m], WORLD_GRAVITY, true, dt);
+
+    const Sint32 fx = (Sint32) lrintf(x * QUANT_SCALE);
+    const Sint32 fy = (Sint32) lrintf(y * QUANT_SCALE);
+    quantized->cell[i] = (Uint16) ((fx >> 16) | ((fy >> 16) << 8));
+    quantized->qx[i] = (Uint16) fx;
+    quantized->qy[i] = (Uint16) fy;
+    quantized->vx[i] = FloatToHalf(vx);
+    quantized->vy[i] = FloatToHalf(vy);
+    return went_idle;
+}
+
+#endif
+
+size_t SIMD_KERNEL(IntegrateQuantizedBalls)(QuantizedBalls *quantized, BallStore *balls, const float dt) {
+    if (!ReserveQuantizedBalls(quantized, balls->capacity)) return 0;
+    PackNewBalls(quantized, balls);
+
+    const size_t words = BALL_MASK_WORDS(balls->capacity);
+    size_t idle_count = 0;
+
+    for (size_t w = 0; w < words; ++w) {
+        const Uint64 active = balls->visible[w] & ~balls->idle[w];
+        if (!active) continue;
+
+        Uint64 went_idle = 0;
+        for (size_t lane = 0; lane < BALL_MASK_BITS; lane += PACKED_LANES) {
+            const Uint32 lanes = (Uint32) (active >> lane) & ((1u << PACKED_LANES) - 1);
+            if (!lanes) continue;
+
+            went_idle |= (Uint64) integratePacked(quantized, balls, w * BALL_MASK_BITS + lane, lanes, dt) << lane;
+        }
+
+        balls->idle[w] |= went_idle;
+        idle_count += BALL_MASK_POPCOUNT(went_idle);
+    }
+
+    return idle_count;
+}
+
+#if SIMD_DISPATCH && SIMD_BUILD_LEVEL == SIMD_LEVEL_SCALAR
+
+SIMD_DECLARE_KERNEL(size_t, IntegrateBalls, (BallStore *balls, float gravity, bool walls, float dt));
+SIMD_DECLARE_KERNEL(size_t, IntegrateQuantizedBalls, (QuantizedBalls *quantized, BallStore *balls, float dt));
+
+size_t IntegrateBalls(BallStore *balls, const float gravity, const bool walls, const float dt) {
+    return SIMD_SELECT(IntegrateBalls)(balls, gravity, walls, dt);
+}
+
+size_t IntegrateQuantizedBalls(QuantizedBalls *quantized, BallStore *balls, const float dt) {
+    return SIMD_SELECT(IntegrateQuantizedBalls)(quantized, balls, dt);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef INTEGRATE_H
+#define INTEGRATE_H
+
+#include "ball.h"
+#include "quantize.h"
+
+// advances every visible, non-idle ball by dt seconds: gravity (px/s^2, downwards), integration and, with walls,
+// window-bounds bounce. balls that come to rest on the floor are flagged idle, returns how many did.
+size_t IntegrateBalls(BallStore *balls, float gravity, bool walls, float dt);
+
+// the same step on the quantized streams, packing any ball that isn't packed yet first.
+// the float streams aren't touched
+size_t IntegrateQuantizedBalls(QuantizedBalls *quantized, BallStore *balls, float dt);
+
+#endif
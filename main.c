@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdbool.h>
 
 #define SDL_MAIN_HANDLED // needs to be set before SDL.h is imported
@@ -5,16 +6,118 @@
 #include <SDL.h>
 #include "ball.h"
 #include "render.h"
+#include "simd.h"
 #include "window.h"
+#include "world.h"
 
 
-Ball balls[MAX_BALLS] = {0};
+#define SHOT_CHAIN_LINKS 12 // balls in a chain shot
+#define SHOT_BLOB_BALLS 10 // a middle ball and a ring of the rest
+#define SHOT_BLOB_SPREAD 3.0f // ring radius in ball radii, wide enough that ring neighbours don't touch
+#define SHOT_BLOB_COMPLIANCE 2e-3f // springiness of a blob
+#define SHOT_BLOB_DAMPING 0.02f
+
+
+// how the balls of one shot hang together
+typedef enum {
+    SHOT_SINGLE,
+    SHOT_CHAIN, // rigid links, trailing behind the first ball
+    SHOT_BLOB, // a ring on springs around the first ball
+} ShotShape;
+
+// what the next shot spawns, cycled with M
+typedef struct {
+    const char *name;
+    float radius; // or the half width of a capsule or box
+    float mass;
+    Uint8 material;
+    ShotShape shape;
+    BallShape collider; // for single balls
+    float half_length; // of a capsule or box
+} ShotBody;
+
+static const ShotBody shot_bodies[] = {
+        {"default", BALL_RADIUS, BALL_MASS, BALL_MATERIAL_DEFAULT, SHOT_SINGLE, BALL_SHAPE_CIRCLE, 0},
+        {"small rubber", BALL_RADIUS * 0.5f, BALL_MASS * 0.25f, BALL_MATERIAL_RUBBER, SHOT_SINGLE,
+                BALL_SHAPE_CIRCLE, 0},
+        {"large clay", BALL_RADIUS * 2.5f, BALL_MASS * 6.0f, BALL_MATERIAL_CLAY, SHOT_SINGLE, BALL_SHAPE_CIRCLE, 0},
+        {"capsule", BALL_RADIUS * 0.5f, BALL_MASS, BALL_MATERIAL_DEFAULT, SHOT_SINGLE, BALL_SHAPE_CAPSULE, BALL_RADIUS},
+        {"crate", BALL_RADIUS, BALL_MASS * 2.0f, BALL_MATERIAL_CLAY, SHOT_SINGLE, BALL_SHAPE_BOX, BALL_RADIUS * 1.5f},
+        {"chain", BALL_RADIUS * 0.5f, BALL_MASS * 0.25f, BALL_MATERIAL_DEFAULT, SHOT_CHAIN, BALL_SHAPE_CIRCLE, 0},
+        {"soft blob", BALL_RADIUS * 0.75f, BALL_MASS * 0.5f, BALL_MATERIAL_RUBBER, SHOT_BLOB, BALL_SHAPE_CIRCLE, 0},
+};
+
+World world = {0};
+int shot_body = 0;
 
 SDL_Point anchor_point = {};
 SDL_Point mouse_pos = {};
 bool m_down = false;
 
 
+// fires the balls of one shot and links them up as its shape asks
+static void shoot(const ShotBody *body) {
+    const BallHandle first = ShootBall(&world.balls, &mouse_pos, &anchor_point);
+    if (!first.generation) return;
+    SetBallBody(&world.balls, first.index, body->radius, body->mass, body->material);
+    if (body->collider != BALL_SHAPE_CIRCLE) {
+        SetBallShape(&world.balls, first.index, body->collider, body->half_length, body->radius);
+    }
+
+    // links only hold on the fixed-step engine with float storage
+    if (body->shape == SHOT_SINGLE || world.engine != SIM_ENGINE_STEPPED || world.quantized || world.fluid) return;
+
+    BallStore *balls = &world.balls;
+    const float x = balls->x[first.index];
+    const float y = balls->y[first.index];
+    const float speed = sqrtf(balls->vx[first.index] * balls->vx[first.index] +
+                              balls->vy[first.index] * balls->vy[first.index]);
+    const float back_x = speed > 0 ? -balls->vx[first.index] / speed : 0;
+    const float back_y = speed > 0 ? -balls->vy[first.index] / speed : 1.0f;
+    const int count = body->shape == SHOT_CHAIN ? SHOT_CHAIN_LINKS : SHOT_BLOB_BALLS;
+
+    BallHandle previous = first;
+    BallHandle ring = BALL_HANDLE_NONE;
+    for (int k = 1; k < count; ++k) {
+        const BallHandle handle = ShootBall(balls, &mouse_pos, &anchor_point);
+        if (!handle.generation) break;
+        SetBallBody(balls, handle.index, body->radius, body->mass, body->material);
+
+        const size_t i = handle.index;
+        if (body->shape == SHOT_CHAIN) {
+            balls->x[i] = x + back_x * body->radius * 2.0f * (float) k;
+            balls->y[i] = y + back_y * body->radius * 2.0f * (float) k;
+        } else {
+            const float angle = 2.0f * (float) M_PI * (float) (k - 1) / (float) (count - 1);
+            balls->x[i] = x + cosf(angle) * body->radius * SHOT_BLOB_SPREAD;
+            balls->y[i] = y + sinf(angle) * body->radius * SHOT_BLOB_SPREAD;
+        }
+        balls->prev_x[i] = balls->x[i];
+        balls->prev_y[i] = balls->y[i];
+
+        if (body->shape == SHOT_CHAIN) {
+            AddConstraint(&world.constraints, balls, previous, handle, CONSTRAINT_REST_CURRENT, CONSTRAINT_RIGID, 0);
+        } else {
+            AddConstraint(&world.constraints, balls, first, handle, CONSTRAINT_REST_CURRENT,
+                          SHOT_BLOB_COMPLIANCE, SHOT_BLOB_DAMPING);
+            if (ring.generation) {
+                AddConstraint(&world.constraints, balls, previous, handle, CONSTRAINT_REST_CURRENT,
+                              SHOT_BLOB_COMPLIANCE, SHOT_BLOB_DAMPING);
+            } else {
+                ring = handle;
+            }
+        }
+        previous = handle;
+    }
+
+    // close the ring
+    if (ring.generation && previous.index != ring.index) {
+        AddConstraint(&world.constraints, balls, previous, ring, CONSTRAINT_REST_CURRENT,
+                      SHOT_BLOB_COMPLIANCE, SHOT_BLOB_DAMPING);
+    }
+}
+
+
 int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[]) {
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         SDL_Log("SDL_Init Error: %s\n", SDL_GetError());
@@ -36,14 +139,46 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (!InitWorld(&world, 0)) {
+        SDL_Log("Failed to create world\n");
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
+    SDL_Log("Kernels: %s\n", SimdLevelName(GetSimdLevel()));
+
+    // level geometry, optional
+    const char *level = SDL_getenv(OBSTACLE_LEVEL_ENV);
+    if (level && !LoadObstacles(&world.obstacles, level)) {
+        SDL_Log("Failed to load level %s\n", level);
+        FreeObstacles(&world.obstacles);
+    }
+
+    // terrain, optional, takes the place of the window walls
+    const char *terrain = SDL_getenv(TERRAIN_FILE_ENV);
+    if (terrain && !LoadTerrain(&world.terrain, terrain)) {
+        SDL_Log("Failed to load terrain %s\n", terrain);
+        FreeTerrain(&world.terrain);
+    }
+
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_Texture *terrain_texture = world.terrain.distance ? CreateTerrainTexture(renderer, &world.terrain, 0x806850FF)
+                                                          : NULL;
 
     bool running = true;
     bool paused = false;
     SDL_Event event;
 
+    const double counter_frequency = (double) SDL_GetPerformanceFrequency();
+    Uint64 last_counter = SDL_GetPerformanceCounter();
+    double accumulator = 0.0;
+
     while (running) {
+        const Uint64 frame_start = SDL_GetPerformanceCounter();
+        const double frame_time = (double) (frame_start - last_counter) / counter_frequency;
+        last_counter = frame_start;
+
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
@@ -54,7 +189,7 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
             }
             if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
                 m_down = false;
-                ShootBall(&balls[getNextAvailableBallIndex(&balls)], &mouse_pos, &anchor_point);
+                shoot(&shot_bodies[shot_body]);
             }
             if (event.type == SDL_MOUSEMOTION) {
                 mouse_pos.x = event.button.x;
@@ -68,6 +203,48 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
                     case SDL_SCANCODE_SPACE:
                         paused = !paused;
                         break;
+                    case SDL_SCANCODE_B:
+                        world.broadphase.mode = (world.broadphase.mode + 1) % BROADPHASE_MODE_COUNT;
+                        SDL_Log("Broadphase: %s\n", BroadphaseModeName(world.broadphase.mode));
+                        break;
+                    case SDL_SCANCODE_E:
+                        if (SetSimulationEngine(&world, (world.engine + 1) % SIM_ENGINE_COUNT)) {
+                            SDL_Log("Engine: %s\n", SimulationEngineName(world.engine));
+                        }
+                        break;
+                    case SDL_SCANCODE_C:
+                        if (SetQuantizedStorage(&world, !world.quantized)) {
+                            SDL_Log("Storage: %s\n", world.quantized ? "quantized" : "float");
+                        }
+                        break;
+                    case SDL_SCANCODE_M:
+                        shot_body = (shot_body + 1) % (int) SDL_arraysize(shot_bodies);
+                        SDL_Log("Shooting: %s\n", shot_bodies[shot_body].name);
+                        break;
+                    case SDL_SCANCODE_F:
+                        FastForwardWorld(&world, FAST_FORWARD_S);
+                        break;
+                    case SDL_SCANCODE_P:
+                        world.balls.policy = (world.balls.policy + 1) % BALL_POOL_POLICY_COUNT;
+                        SDL_Log("Full pool: %s\n", BallPoolPolicyName(world.balls.policy));
+                        break;
+                    case SDL_SCANCODE_G:
+                        if (SetNBodyGravity(&world, !world.nbody)) {
+                            SDL_Log("Gravity: %s\n", world.nbody ? "n-body" : "uniform");
+                        }
+                        break;
+                    case SDL_SCANCODE_L:
+                        if (SetFluidMode(&world, !world.fluid)) {
+                            SDL_Log("Balls: %s\n", world.fluid ? "fluid" : "rigid");
+                        }
+                        break;
+                    case SDL_SCANCODE_LEFTBRACKET:
+                    case SDL_SCANCODE_RIGHTBRACKET: {
+                        const float step = event.key.keysym.scancode == SDL_SCANCODE_LEFTBRACKET ? -0.1f : 0.1f;
+                        world.gravity.theta = SDL_clamp(world.gravity.theta + step, NBODY_MIN_THETA, NBODY_MAX_THETA);
+                        SDL_Log("Opening angle: %.1f\n", world.gravity.theta);
+                        break;
+                    }
                     default:
                         break;
                 }
@@ -76,25 +253,52 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
 
         if (!paused) {
             // --- UPDATE
-            UpdateBalls(&balls);
+            // as many fixed steps as real time asks for, capped so a slow frame can't snowball
+            accumulator += frame_time;
+            int steps = 0;
+            while (accumulator >= STEP_TIME_S && steps < MAX_STEPS_PER_FRAME) {
+                UpdateBalls(&world);
+                accumulator -= STEP_TIME_S;
+                steps++;
+            }
+            if (accumulator >= STEP_TIME_S) accumulator = 0.0;
 
             // --- RENDER
             SDL_SetRenderDrawColor(renderer, 64, 63, 64, 255);
             SDL_RenderClear(renderer);
 
+            if (terrain_texture) RenderTerrain(renderer, terrain_texture, &world.terrain);
+
+            SetRenderColor(renderer, 0xA0A0A0FF);
+            RenderObstacles(renderer, &world.obstacles);
+
             SetRenderColor(renderer, 0xFFFFFFFF);
-            RenderBalls(renderer, &balls);
+            if (world.quantized) {
+                RenderQuantizedBalls(renderer, &world.quantized_balls, &world.balls,
+                                     (float) (accumulator / STEP_TIME_S));
+            } else {
+                RenderBalls(renderer, &world.balls, (float) (accumulator / STEP_TIME_S));
+            }
 
-            if (m_down && getNextAvailableBallIndex(&balls) != -1) {
+            SetRenderColor(renderer, 0xFFC040FF);
+            RenderConstraints(renderer, &world.constraints, &world.balls, (float) (accumulator / STEP_TIME_S));
+
+            if (m_down && CanSpawnBall(&world.balls)) {
                 RenderBallShooter(renderer, &mouse_pos, &anchor_point);
             }
 
             SDL_RenderPresent(renderer);
         }
 
-        SDL_Delay(FRAME_DELAY_MS);
+        // sleep off whatever is left of this display frame
+        const double elapsed = (double) (SDL_GetPerformanceCounter() - frame_start) / counter_frequency;
+        if (elapsed < FRAME_TIME_S) {
+            SDL_Delay((Uint32) ((FRAME_TIME_S - elapsed) * 1000.0));
+        }
     }
 
+    FreeWorld(&world);
+    if (terrain_texture) SDL_DestroyTexture(terrain_texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,364 @@
+#include "narrowphase.h"
+#include "simd.h"
+#include <math.h>
+
+// both kernels are written once against the lane helpers below, for 16 lanes with AVX-512, 8 with AVX2 and
+// 4 with SSE2. a short group at the end repeats its first pair in the unused lanes and leaves them unstored,
+// so every pair goes through the same instructions wherever it lands in a group
+#if SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX512
+#include <immintrin.h>
+#define NARROWPHASE_LANES 16
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX2
+#include <immintrin.h>
+#define NARROWPHASE_LANES 8
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_SSE2
+#include <emmintrin.h>
+#define NARROWPHASE_LANES 4
+#else
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#define NARROWPHASE_LANES 1
+#endif
+
+
+#if NARROWPHASE_LANES == 16
+
+typedef __m512 Lanes;
+typedef __mmask16 LaneMask;
+typedef __m512i LaneIndex;
+
+// the a and b indices of 16 pairs, in pair order
+static inline void splitPairs(const BallPair *group, LaneIndex *a, LaneIndex *b) {
+    const __m512i lo = _mm512_loadu_si512(group);
+    const __m512i hi = _mm512_loadu_si512(group + 8);
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    *a = _mm512_permutex2var_epi32(lo, even, hi);
+    *b = _mm512_permutex2var_epi32(lo, _mm512_add_epi32(even, _mm512_set1_epi32(1)), hi);
+}
+
+static inline Lanes gather(const float *stream, const LaneIndex index) {
+    return _mm512_i32gather_ps(index, stream, 4);
+}
+static inline Lanes load(const float *values) { return _mm512_loadu_ps(values); }
+static inline void store(float *values, const Lanes v) { _mm512_storeu_ps(values, v); }
+static inline Lanes splat(const float value) { return _mm512_set1_ps(value); }
+static inline Lanes add(const Lanes a, const Lanes b) { return _mm512_add_ps(a, b); }
+static inline Lanes sub(const Lanes a, const Lanes b) { return _mm512_sub_ps(a, b); }
+static inline Lanes mul(const Lanes a, const Lanes b) { return _mm512_mul_ps(a, b); }
+static inline Lanes divide(const Lanes a, const Lanes b) { return _mm512_div_ps(a, b); }
+
+// the estimate of the narrower builds, half by half: rsqrt14 is closer, but would give other results
+static inline Lanes rsqrt(const Lanes a) {
+    const __m256 lo = _mm256_rsqrt_ps(_mm512_castps512_ps256(a));
+    const __m256 hi = _mm256_rsqrt_ps(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+    return _mm512_castpd_ps(_mm512_insertf64x4(
+            _mm512_castps_pd(_mm512_castps256_ps512(lo)),
+            _mm256_castps_pd(hi),
+            1
+    ));
+}
+
+static inline Lanes keep(const LaneMask mask, const Lanes a) { return _mm512_maskz_mov_ps(mask, a); }
+static inline LaneMask both(const LaneMask a, const LaneMask b) { return a & b; }
+static inline LaneMask less(const Lanes a, const Lanes b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline LaneMask notGreaterEqual(const Lanes a, const Lanes b) { return _mm512_cmp_ps_mask(a, b, _CMP_NGE_UQ); }
+static inline Lanes blend(const Lanes a, const Lanes b, const LaneMask mask) {
+    return _mm512_mask_blend_ps(mask, a, b);
+}
+static inline Uint32 laneBits(const LaneMask mask) { return mask; }
+
+#elif NARROWPHASE_LANES == 8
+
+typedef __m256 Lanes;
+typedef __m256 LaneMask;
+typedef __m256i LaneIndex;
+
+// the a and b indices of 8 pairs, in pair order
+static inline void splitPairs(const BallPair *group, LaneIndex *a, LaneIndex *b) {
+    const __m256 lo = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) group));
+    const __m256 hi = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) (group + 4)));
+    // the shuffle leaves pairs 0 1 4 5 2 3 6 7, the permute puts them back in order
+    *a = _mm256_castpd_si256(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0x88)), 0xD8));
+    *b = _mm256_castpd_si256(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0xDD)), 0xD8));
+}
+
+static inline Lanes gather(const float *stream, const LaneIndex index) {
+    return _mm256_i32gather_ps(stream, index, 4);
+}
+static inline Lanes load(const float *values) { return _mm256_loadu_ps(values); }
+static inline void store(float *values, const Lanes v) { _mm256_storeu_ps(values, v); }
+static inline Lanes splat(const float value) { return _mm256_set1_ps(value); }
+static inline Lanes add(const Lanes a, const Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes sub(const Lanes a, const Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes mul(const Lanes a, const Lanes b) { return _mm256_mul_ps(a, b); }
+static inline Lanes divide(const Lanes a, const Lanes b) { return _mm256_div_ps(a, b); }
+static inline Lanes rsqrt(const Lanes a) { return _mm256_rsqrt_ps(a); }
+static inline Lanes keep(const LaneMask mask, const Lanes a) { return _mm256_and_ps(mask, a); }
+static inline LaneMask both(const LaneMask a, const LaneMask b) { return _mm256_and_ps(a, b); }
+static inline LaneMask less(const Lanes a, const Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline LaneMask notGreaterEqual(const Lanes a, const Lanes b) { return _mm256_cmp_ps(a, b, _CMP_NGE_UQ); }
+static inline Lanes blend(const Lanes a, const Lanes b, const LaneMask mask) { return _mm256_blendv_ps(a, b, mask); }
+static inline Uint32 laneBits(const LaneMask mask) { return (Uint32) _mm256_movemask_ps(mask); }
+
+#elif NARROWPHASE_LANES == 4
+
+typedef __m128 Lanes;
+typedef __m128 LaneMask;
+typedef struct {
+    Uint32 lane[4];
+} LaneIndex;
+
+// the a and b indices of 4 pairs, in pair order
+static inline void splitPairs(const BallPair *group, LaneIndex *a, LaneIndex *b) {
+    *a = (LaneIndex) {{group[0].a, group[1].a, group[2].a, group[3].a}};
+    *b = (LaneIndex) {{group[0].b, group[1].b, group[2].b, group[3].b}};
+}
+
+static inline Lanes gather(const float *stream, const LaneIndex index) {
+    return _mm_setr_ps(stream[index.lane[0]], stream[index.lane[1]], stream[index.lane[2]], stream[index.lane[3]]);
+}
+static inline Lanes load(const float *values) { return _mm_loadu_ps(values); }
+static inline void store(float *values, const Lanes v) { _mm_storeu_ps(values, v); }
+static inline Lanes splat(const float value) { return _mm_set1_ps(value); }
+static inline Lanes add(const Lanes a, const Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes sub(const Lanes a, const Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes mul(const Lanes a, const Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes divide(const Lanes a, const Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes rsqrt(const Lanes a) { return _mm_rsqrt_ps(a); }
+static inline Lanes keep(const LaneMask mask, const Lanes a) { return _mm_and_ps(mask, a); }
+static inline LaneMask both(const LaneMask a, const LaneMask b) { return _mm_and_ps(a, b); }
+static inline LaneMask less(const Lanes a, const Lanes b) { return _mm_cmplt_ps(a, b); }
+static inline LaneMask notGreaterEqual(const Lanes a, const Lanes b) { return _mm_cmpnge_ps(a, b); }
+static inline Lanes blend(const Lanes a, const Lanes b, const LaneMask mask) {
+    return _mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b));
+}
+static inline Uint32 laneBits(const LaneMask mask) { return (Uint32) _mm_movemask_ps(mask); }
+
+#endif
+
+#if NARROWPHASE_LANES > 1
+
+// the touching pairs of one full group go to contacts, n of the lanes count
+static inline size_t filterGroup(const BallStore *balls, const BallPair *group, const size_t n, BallPair *contacts) {
+    LaneIndex a, b;
+    splitPairs(group, &a, &b);
+
+    // same test as the scalar dx * dx + dy * dy >= reach * reach, a NaN distance counts as touching
+    const Lanes dx = sub(gather(balls->x, b), gather(balls->x, a));
+    const Lanes dy = sub(gather(balls->y, b), gather(balls->y, a));
+    const Lanes reach = add(gather(balls->radius, a), gather(balls->radius, b));
+    const Uint32 touching = laneBits(notGreaterEqual(add(mul(dx, dx), mul(dy, dy)), mul(reach, reach)));
+
+    // branchless compaction: every pair is written, only the touching ones move the cursor on
+    size_t kept = 0;
+    for (size_t l = 0; l < n; ++l) {
+        contacts[kept] = group[l];
+        kept += (touching >> l) & 1;
+    }
+    return kept;
+}
+
+size_t SIMD_KERNEL(FindContacts)(const BallStore *balls, const BallPair *pairs, const size_t count,
+                                 BallPair *contacts, float *max_approach) {
+    size_t kept = 0;
+    size_t k = 0;
+    for (; k + NARROWPHASE_LANES <= count; k += NARROWPHASE_LANES) {
+        kept += filterGroup(balls, pairs + k, NARROWPHASE_LANES, contacts + kept);
+    }
+    if (k < count) {
+        BallPair group[NARROWPHASE_LANES];
+        for (size_t l = 0; l < NARROWPHASE_LANES; ++l) group[l] = pairs[k + l < count ? k + l : k];
+        kept += filterGroup(balls, group, count - k, contacts + kept);
+    }
+
+    // only real contacts get their closing speed looked at, squared until the fastest is known
+    float fastest = 0;
+    for (size_t c = 0; c < kept; ++c) {
+        const size_t a = contacts[c].a;
+        const size_t b = contacts[c].b;
+        const float dvx = balls->vx[b] - balls->vx[a];
+        const float dvy = balls->vy[b] - balls->vy[a];
+        fastest = fmaxf(fastest, dvx * dvx + dvy * dvy);
+    }
+    *max_approach = fmaxf(*max_approach, sqrtf(fastest));
+
+    return kept;
+}
+
+// one full group of contacts, n of the lanes are stored
+static inline void resolveGroup(BallStore *balls, const BallPair *group, const size_t n, float *depth) {
+    LaneIndex a, b;
+    splitPairs(group, &a, &b);
+
+    float bounce[NARROWPHASE_LANES];
+    for (size_t l = 0; l < NARROWPHASE_LANES; ++l) bounce[l] = PairRestitution(balls, group[l].a, group[l].b);
+
+    Lanes xa = gather(balls->x, a), ya = gather(balls->y, a);
+    Lanes xb = gather(balls->x, b), yb = gather(balls->y, b);
+    Lanes vxa = gather(balls->vx, a), vya = gather(balls->vy, a);
+    Lanes vxb = gather(balls->vx, b), vyb = gather(balls->vy, b);
+
+    const Lanes dx = sub(xb, xa);
+    const Lanes dy = sub(yb, ya);
+    const Lanes d2 = add(mul(dx, dx), mul(dy, dy));
+    const Lanes reach = add(gather(balls->radius, a), gather(balls->radius, b));
+    const LaneMask touching = less(d2, mul(reach, reach));
+
+    // 1 / distance from the estimate and one Newton step, balls on the same spot get pushed apart sideways
+    const LaneMask apart = less(splat(0), d2);
+    Lanes inv = rsqrt(d2);
+    inv = mul(inv, sub(splat(1.5f), mul(mul(mul(splat(0.5f), d2), inv), inv)));
+    const Lanes distance = keep(apart, mul(d2, inv));
+    const Lanes nx = blend(splat(1.0f), mul(dx, inv), apart);
+    const Lanes ny = keep(apart, mul(dy, inv));
+
+    // each ball's share of the impulse and of the push apart, the lighter one takes more
+    const Lanes inv_mass_a = gather(balls->inv_mass, a);
+    const Lanes inv_mass_b = gather(balls->inv_mass, b);
+    const Lanes inv_sum = divide(splat(1.0f), add(inv_mass_a, inv_mass_b));
+    const Lanes share_a = mul(inv_mass_a, inv_sum);
+    const Lanes share_b = mul(inv_mass_b, inv_sum);
+
+    // lanes that don't close in get no impulse, lanes that don't touch neither impulse nor push
+    const Lanes dot = add(mul(sub(vxb, vxa), nx), mul(sub(vyb, vya), ny));
+    const LaneMask bouncing = both(touching, less(dot, splat(0)));
+    const Lanes impulse = keep(bouncing, mul(mul(sub(splat(-1.0f), load(bounce)), dot), splat(0.5f)));
+    vxa = sub(vxa, mul(mul(impulse, nx), share_a));
+    vya = sub(vya, mul(mul(impulse, ny), share_a));
+    vxb = add(vxb, mul(mul(impulse, nx), share_b));
+    vyb = add(vyb, mul(mul(impulse, ny), share_b));
+
+    const Lanes penetration = keep(touching, sub(reach, distance));
+    xa = sub(xa, mul(mul(penetration, share_a), nx));
+    ya = sub(ya, mul(mul(penetration, share_a), ny));
+    xb = add(xb, mul(mul(penetration, share_b), nx));
+    yb = add(yb, mul(mul(penetration, share_b), ny));
+
+    // no ball is in the batch twice, so the lanes scatter back without stepping on each other
+    float out[8][NARROWPHASE_LANES];
+    store(out[0], xa), store(out[1], ya), store(out[2], xb), store(out[3], yb);
+    store(out[4], vxa), store(out[5], vya), store(out[6], vxb), store(out[7], vyb);
+    for (size_t l = 0; l < n; ++l) {
+        const size_t i = group[l].a;
+        const size_t j = group[l].b;
+        balls->x[i] = out[0][l], balls->y[i] = out[1][l];
+        balls->x[j] = out[2][l], balls->y[j] = out[3][l];
+        balls->vx[i] = out[4][l], balls->vy[i] = out[5][l];
+        balls->vx[j] = out[6][l], balls->vy[j] = out[7][l];
+    }
+
+    if (n == NARROWPHASE_LANES) {
+        store(depth, penetration);
+    } else {
+        float lanes[NARROWPHASE_LANES];
+        store(lanes, penetration);
+        for (size_t l = 0; l < n; ++l) depth[l] = lanes[l];
+    }
+}
+
+void SIMD_KERNEL(ResolveCircleBatch)(BallStore *balls, const BallPair *contacts, const size_t count, float *depth) {
+    size_t k = 0;
+    for (; k + NARROWPHASE_LANES <= count; k += NARROWPHASE_LANES) {
+        resolveGroup(balls, contacts + k, NARROWPHASE_LANES, depth + k);
+    }
+    if (k < count) {
+        BallPair group[NARROWPHASE_LANES];
+        for (size_t l = 0; l < NARROWPHASE_LANES; ++l) group[l] = contacts[k + l < count ? k + l : k];
+        resolveGroup(balls, group, count - k, depth + k);
+    }
+}
+
+#else
+
+// scalar fallback, one pair per iteration
+size_t SIMD_KERNEL(FindContacts)(const BallStore *balls, const BallPair *pairs, const size_t count,
+                                 BallPair *contacts, float *max_approach) {
+    size_t kept = 0;
+    float fastest = 0;
+
+    for (size_t k = 0; k < count; ++k) {
+        const size_t a = pairs[k].a;
+        const size_t b = pairs[k].b;
+        const float dx = balls->x[b] - balls->x[a];
+        const float dy = balls->y[b] - balls->y[a];
+        const float reach = balls->radius[a] + balls->radius[b];
+        if (dx * dx + dy * dy >= reach * reach) continue;
+
+        const float dvx = balls->vx[b] - balls->vx[a];
+        const float dvy = balls->vy[b] - balls->vy[a];
+        fastest = fmaxf(fastest, dvx * dvx + dvy * dvy);
+        contacts[kept++] = pairs[k];
+    }
+
+    *max_approach = fmaxf(*max_approach, sqrtf(fastest));
+    return kept;
+}
+
+// the estimate the SIMD builds start from, where the CPU has one
+static inline float rsqrtEstimate(const float x) {
+#if defined(__SSE__)
+    return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+// the lanes' arithmetic one contact at a time, step for step, so every level comes out the same
+void SIMD_KERNEL(ResolveCircleBatch)(BallStore *balls, const BallPair *contacts, const size_t count, float *depth) {
+    for (size_t k = 0; k < count; ++k) {
+        const size_t a = contacts[k].a;
+        const size_t b = contacts[k].b;
+        const float dx = balls->x[b] - balls->x[a];
+        const float dy = balls->y[b] - balls->y[a];
+        const float d2 = dx * dx + dy * dy;
+        const float reach = balls->radius[a] + balls->radius[b];
+        const bool touching = d2 < reach * reach;
+
+        const bool apart = 0 < d2;
+        float inv = rsqrtEstimate(d2);
+        inv = inv * (1.5f - 0.5f * d2 * inv * inv);
+        const float distance = apart ? d2 * inv : 0.0f;
+        const float nx = apart ? dx * inv : 1.0f;
+        const float ny = apart ? dy * inv : 0.0f;
+
+        const float inv_sum = 1.0f / (balls->inv_mass[a] + balls->inv_mass[b]);
+        const float share_a = balls->inv_mass[a] * inv_sum;
+        const float share_b = balls->inv_mass[b] * inv_sum;
+
+        const float dot = (balls->vx[b] - balls->vx[a]) * nx + (balls->vy[b] - balls->vy[a]) * ny;
+        const bool bouncing = touching && dot < 0;
+        const float impulse = bouncing ? (-1.0f - PairRestitution(balls, a, b)) * dot * 0.5f : 0.0f;
+        balls->vx[a] -= impulse * nx * share_a;
+        balls->vy[a] -= impulse * ny * share_a;
+        balls->vx[b] += impulse * nx * share_b;
+        balls->vy[b] += impulse * ny * share_b;
+
+        const float penetration = touching ? reach - distance : 0.0f;
+        balls->x[a] -= penetration * share_a * nx;
+        balls->y[a] -= penetration * share_a * ny;
+        balls->x[b] += penetration * share_b * nx;
+        balls->y[b] += penetration * share_b * ny;
+        depth[k] = penetration;
+    }
+}
+
+#endif
+
+#if SIMD_DISPATCH && SIMD_BUILD_LEVEL == SIMD_LEVEL_SCALAR
+
+SIMD_DECLARE_KERNEL(size_t, FindContacts, (const BallStore *balls, const BallPair *pairs, size_t count,
+                                           BallPair *contacts, float *max_approach));
+SIMD_DECLARE_KERNEL(void, ResolveCircleBatch, (BallStore *balls, const BallPair *contacts, size_t count,
+                                               float *depth));
+
+size_t FindContacts(const BallStore *balls, const BallPair *pairs, const size_t count, BallPair *contacts,
+                    float *max_approach) {
+    return SIMD_SELECT(FindContacts)(balls, pairs, count, contacts, max_approach);
+}
+
+void ResolveCircleBatch(BallStore *balls, const BallPair *contacts, const size_t count, float *depth) {
+    SIMD_SELECT(ResolveCircleBatch)(balls, contacts, count, depth);
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef NARROWPHASE_H
+#define NARROWPHASE_H
+
+#include "ball.h"
+#include "sweep.h"
+
+// keeps the candidate pairs whose bounding circles overlap, in their order, testing several pairs per
+// instruction on squared distance. contacts needs room for count pairs. the fastest approach speed among
+// the kept pairs is folded into *max_approach
+size_t FindContacts(const BallStore *balls, const BallPair *pairs, size_t count, BallPair *contacts,
+                    float *max_approach);
+
+// HandleCollision for count circle-circle contacts of which no two share a ball (one colour batch),
+// several contacts per instruction, with the normal from a refined reciprocal square root. depth as
+// HandleCollision
+void ResolveCircleBatch(BallStore *balls, const BallPair *contacts, size_t count, float *depth);
+
+#endif
@@ -0,0 +1,388 @@
+#include "nbody.h"
+#include <math.h>
+
+#define NBODY_CELLS 65536.0f // Morton grid cells per side of the root, 16 bits per axis
+
+typedef struct {
+    NBody *nbody;
+    const BallStore *balls;
+} ForceTask;
+
+
+void InitNBody(NBody *nbody, float theta) {
+    *nbody = (NBody) {0};
+
+    // kept in the same range as the keys keep it, so asking for 0 gets the closest to exact there is
+    const char *env = SDL_getenv(NBODY_THETA_ENV);
+    if (env) theta = (float) SDL_atof(env);
+    nbody->theta = SDL_clamp(theta, NBODY_MIN_THETA, NBODY_MAX_THETA);
+}
+
+void FreeNBody(NBody *nbody) {
+    SDL_free(nbody->codes);
+    SDL_free(nbody->order);
+    SDL_free(nbody->sort_codes);
+    SDL_free(nbody->sort_order);
+    SDL_free(nbody->x);
+    SDL_free(nbody->y);
+    SDL_free(nbody->mass);
+    SDL_free(nbody->nodes);
+    SDL_free(nbody->tasks);
+    SDL_free(nbody->top);
+    SDL_free(nbody->ax);
+    SDL_free(nbody->ay);
+    *nbody = (NBody) {0};
+}
+
+static bool reserveNBody(NBody *nbody, const size_t capacity) {
+    if (capacity <= nbody->capacity) return true;
+
+#define GROW(field, count)                                                             \
+    do {                                                                               \
+        void *grown = SDL_realloc(nbody->field, (count) * sizeof(*nbody->field));      \
+        if (!grown) return false;                                                      \
+        nbody->field = grown;                                                          \
+    } while (0)
+
+    GROW(codes, capacity);
+    GROW(order, capacity);
+    GROW(sort_codes, capacity);
+    GROW(sort_order, capacity);
+    GROW(x, capacity);
+    GROW(y, capacity);
+    GROW(mass, capacity);
+    GROW(nodes, 2 * capacity);
+    GROW(ax, capacity);
+    GROW(ay, capacity);
+#undef GROW
+
+    SDL_memset(nbody->ax + nbody->capacity, 0, (capacity - nbody->capacity) * sizeof(float));
+    SDL_memset(nbody->ay + nbody->capacity, 0, (capacity - nbody->capacity) * sizeof(float));
+    nbody->capacity = capacity;
+    return true;
+}
+
+// --- sorting
+
+// spreads the low 16 bits out to the even bits
+static Uint32 spreadBits(Uint32 v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// the other way round, the even bits packed into the low 16
+static Uint32 packBits(Uint32 v) {
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+static void codeTask(void *ctx, const size_t begin, const size_t end) {
+    NBody *nbody = ctx;
+    const float scale = NBODY_CELLS / nbody->size;
+
+    for (size_t k = begin; k < end; ++k) {
+        const Uint32 qx = (Uint32) SDL_min((nbody->x[k] - nbody->min_x) * scale, NBODY_CELLS - 1);
+        const Uint32 qy = (Uint32) SDL_min((nbody->y[k] - nbody->min_y) * scale, NBODY_CELLS - 1);
+        nbody->codes[k] = spreadBits(qx) | (spreadBits(qy) << 1);
+    }
+}
+
+// LSD radix sort of the codes, 8 bits a pass, carrying the ball index and the body along.
+// passes where every code has the same digit are skipped
+static void sortBodies(NBody *nbody) {
+    const size_t n = nbody->body_count;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t k = 0; k < n; ++k) offsets[(nbody->codes[k] >> shift) & 0xFF]++;
+        if (offsets[(nbody->codes[0] >> shift) & 0xFF] == n) continue;
+
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            const size_t count = offsets[d];
+            offsets[d] = sum;
+            sum += count;
+        }
+
+        for (size_t k = 0; k < n; ++k) {
+            const size_t to = offsets[(nbody->codes[k] >> shift) & 0xFF]++;
+            nbody->sort_codes[to] = nbody->codes[k];
+            nbody->sort_order[to] = nbody->order[k];
+        }
+
+        Uint32 *swap = nbody->codes;
+        nbody->codes = nbody->sort_codes;
+        nbody->sort_codes = swap;
+        swap = nbody->order;
+        nbody->order = nbody->sort_order;
+        nbody->sort_order = swap;
+    }
+}
+
+// --- tree
+
+// quadrant of a code at `depth`, 0 being the root's children
+static Uint32 digitAt(const Uint32 code, const int depth) {
+    return (code >> (30 - 2 * depth)) & 3;
+}
+
+// first body in [begin, end) whose digit at `depth` is above d, the codes are sorted
+static Uint32 digitEnd(const NBody *nbody, Uint32 begin, Uint32 end, const int depth, const Uint32 d) {
+    while (begin < end) {
+        const Uint32 mid = begin + (end - begin) / 2;
+        if (digitAt(nbody->codes[mid], depth) <= d) begin = mid + 1;
+        else end = mid;
+    }
+    return begin;
+}
+
+// lays out node `slot` over [begin, end) in the smallest cell holding all of them: a leaf, or 2 to 4 children
+// at area, area + 1, ... whose body ranges go to bounds. returns the child count, 0 for a leaf
+static int splitNode(NBody *nbody, const Uint32 slot, const Uint32 area, const Uint32 begin, const Uint32 end,
+                     Uint32 *bounds) {
+    NBodyNode *node = &nbody->nodes[slot];
+
+    // the leading digits every code agrees on
+    const Uint32 diff = nbody->codes[begin] ^ nbody->codes[end - 1];
+    const int depth = diff ? __builtin_clz(diff) / 2 : 16;
+    const Uint32 prefix = depth ? nbody->codes[begin] & (0xFFFFFFFFu << (32 - 2 * depth)) : 0;
+
+    node->size = nbody->size / (float) (1 << depth);
+    node->cell_x = nbody->min_x + (float) packBits(prefix) * nbody->size / NBODY_CELLS;
+    node->cell_y = nbody->min_y + (float) packBits(prefix >> 1) * nbody->size / NBODY_CELLS;
+
+    if (end - begin <= NBODY_LEAF_SIZE || depth == 16) {
+        node->leaf = true;
+        node->first = begin;
+        node->count = end - begin;
+        return 0;
+    }
+
+    int count = 0;
+    bounds[0] = begin;
+    for (Uint32 d = 0; d < 4; ++d) {
+        const Uint32 next = digitEnd(nbody, bounds[count], end, depth, d);
+        if (next > bounds[count]) bounds[++count] = next;
+    }
+
+    node->leaf = false;
+    node->first = area;
+    node->count = (Uint32) count;
+    return count;
+}
+
+// where the descendants of child c go: after the children, each earlier child's m bodies taking 2m - 2 slots
+static Uint32 childArea(const Uint32 area, const int count, const Uint32 *bounds, const int c) {
+    Uint32 child_area = area + (Uint32) count;
+    for (int k = 0; k < c; ++k) child_area += 2 * (bounds[k + 1] - bounds[k]) - 2;
+    return child_area;
+}
+
+static void sumNode(NBody *nbody, NBodyNode *node) {
+    float mass = 0, x = 0, y = 0;
+
+    if (node->leaf) {
+        for (Uint32 k = node->first; k < node->first + node->count; ++k) {
+            mass += nbody->mass[k];
+            x += nbody->mass[k] * nbody->x[k];
+            y += nbody->mass[k] * nbody->y[k];
+        }
+    } else {
+        for (Uint32 k = node->first; k < node->first + node->count; ++k) {
+            const NBodyNode *child = &nbody->nodes[k];
+            mass += child->mass;
+            x += child->mass * child->x;
+            y += child->mass * child->y;
+        }
+    }
+
+    node->mass = mass;
+    node->x = x / mass;
+    node->y = y / mass;
+}
+
+static void buildNode(NBody *nbody, const Uint32 slot, const Uint32 area, const Uint32 begin, const Uint32 end) {
+    Uint32 bounds[5];
+    const int count = splitNode(nbody, slot, area, begin, end, bounds);
+
+    for (int c = 0; c < count; ++c) {
+        buildNode(nbody, area + (Uint32) c, childArea(area, count, bounds, c), bounds[c], bounds[c + 1]);
+    }
+    sumNode(nbody, &nbody->nodes[slot]);
+}
+
+static void buildTask(void *ctx, const size_t begin, const size_t end) {
+    NBody *nbody = ctx;
+
+    for (size_t k = begin; k < end; ++k) {
+        const NBodyTask *task = &nbody->tasks[k];
+        buildNode(nbody, task->slot, task->area, task->begin, task->end);
+    }
+}
+
+// the top of the tree, down to subtrees of at most `split` bodies which are left to the workers
+static bool planNode(NBody *nbody, const Uint32 slot, const Uint32 area, const Uint32 begin, const Uint32 end,
+                     const Uint32 split) {
+#define GROW(field, count, capacity)                                                        \
+    do {                                                                                    \
+        if (nbody->count == nbody->capacity) {                                              \
+            const size_t grown_capacity = nbody->capacity ? nbody->capacity * 2 : 64;       \
+            void *grown = SDL_realloc(nbody->field, grown_capacity * sizeof(*nbody->field)); \
+            if (!grown) return false;                                                       \
+            nbody->field = grown;                                                           \
+            nbody->capacity = grown_capacity;                                               \
+        }                                                                                   \
+    } while (0)
+
+    if (end - begin <= split) {
+        GROW(tasks, task_count, task_capacity);
+        nbody->tasks[nbody->task_count++] = (NBodyTask) {.slot = slot, .area = area, .begin = begin, .end = end};
+        return true;
+    }
+
+    GROW(top, top_count, top_capacity);
+#undef GROW
+    nbody->top[nbody->top_count++] = slot;
+
+    Uint32 bounds[5];
+    const int count = splitNode(nbody, slot, area, begin, end, bounds);
+    for (int c = 0; c < count; ++c) {
+        if (!planNode(nbody, area + (Uint32) c, childArea(area, count, bounds, c), bounds[c], bounds[c + 1], split)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool buildTree(NBody *nbody, WorkerPool *workers) {
+    const size_t split = nbody->body_count / ((size_t) workers->thread_count * NBODY_TASKS_PER_THREAD);
+
+    nbody->task_count = 0;
+    nbody->top_count = 0;
+    if (!planNode(nbody, 0, 1, 0, (Uint32) nbody->body_count, (Uint32) SDL_max(split, NBODY_LEAF_SIZE))) {
+        return false;
+    }
+
+    RunParallel(workers, nbody->task_count, buildTask, nbody);
+
+    // the top nodes once everything below them is done, children were created after their parents
+    for (size_t k = nbody->top_count; k-- > 0;) sumNode(nbody, &nbody->nodes[nbody->top[k]]);
+    return true;
+}
+
+// --- forces
+
+static inline void pull(const float dx, const float dy, const float mass, float *ax, float *ay) {
+    const float d_sq = dx * dx + dy * dy + NBODY_SOFTENING * NBODY_SOFTENING;
+    const float scale = mass / (d_sq * sqrtf(d_sq));
+    *ax += scale * dx;
+    *ay += scale * dy;
+}
+
+static void forceTask(void *ctx, const size_t begin, const size_t end) {
+    const ForceTask *task = ctx;
+    NBody *nbody = task->nbody;
+    const float theta_sq = nbody->theta * nbody->theta;
+
+    for (size_t k = begin; k < end; ++k) {
+        const Uint32 i = nbody->order[k];
+        nbody->ax[i] = 0;
+        nbody->ay[i] = 0;
+        if (IsBallIdle(task->balls, i)) continue;
+
+        const float px = nbody->x[k];
+        const float py = nbody->y[k];
+        float ax = 0, ay = 0;
+
+        Uint32 stack[NBODY_TREE_DEPTH];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top) {
+            const NBodyNode *node = &nbody->nodes[stack[--top]];
+            const float dx = node->x - px;
+            const float dy = node->y - py;
+
+            // far enough and not around the ball itself: the whole cell at once
+            const bool inside = px >= node->cell_x && px < node->cell_x + node->size &&
+                                py >= node->cell_y && py < node->cell_y + node->size;
+            if (!inside && node->size * node->size < theta_sq * (dx * dx + dy * dy)) {
+                pull(dx, dy, node->mass, &ax, &ay);
+            } else if (node->leaf) {
+                for (Uint32 j = node->first; j < node->first + node->count; ++j) {
+                    if (j != k) pull(nbody->x[j] - px, nbody->y[j] - py, nbody->mass[j], &ax, &ay);
+                }
+            } else {
+                for (Uint32 c = 0; c < node->count && top < NBODY_TREE_DEPTH; ++c) stack[top++] = node->first + c;
+            }
+        }
+
+        nbody->ax[i] = ax * NBODY_G;
+        nbody->ay[i] = ay * NBODY_G;
+    }
+}
+
+bool ComputeNBodyForces(NBody *nbody, WorkerPool *workers, const BallStore *balls) {
+    if (!reserveNBody(nbody, balls->capacity)) return false;
+
+    // every visible ball pulls, idle ones included
+    size_t n = 0;
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            nbody->order[n] = (Uint32) i;
+            min_x = fminf(min_x, balls->x[i]);
+            min_y = fminf(min_y, balls->y[i]);
+            max_x = fmaxf(max_x, balls->x[i]);
+            max_y = fmaxf(max_y, balls->y[i]);
+            n++;
+        }
+    }
+
+    nbody->body_count = n;
+    if (!n) return true;
+
+    // a square root cell, a little larger so the far edge still maps inside the grid
+    nbody->min_x = min_x;
+    nbody->min_y = min_y;
+    nbody->size = fmaxf(fmaxf(max_x - min_x, max_y - min_y) * 1.001f, 1.0f);
+
+    for (size_t k = 0; k < n; ++k) {
+        nbody->x[k] = balls->x[nbody->order[k]];
+        nbody->y[k] = balls->y[nbody->order[k]];
+    }
+    RunParallel(workers, n, codeTask, nbody);
+    sortBodies(nbody);
+
+    for (size_t k = 0; k < n; ++k) {
+        const Uint32 i = nbody->order[k];
+        nbody->x[k] = balls->x[i];
+        nbody->y[k] = balls->y[i];
+        nbody->mass[k] = 1.0f / balls->inv_mass[i];
+    }
+
+    if (!buildTree(nbody, workers)) return false;
+
+    ForceTask task = {.nbody = nbody, .balls = balls};
+    RunParallel(workers, n, forceTask, &task);
+    return true;
+}
+
+void ApplyNBodyForces(const NBody *nbody, BallStore *balls, const float dt) {
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            balls->vx[i] += nbody->ax[i] * dt;
+            balls->vy[i] += nbody->ay[i] * dt;
+        }
+    }
+}
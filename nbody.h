@@ -0,0 +1,83 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include "ball.h"
+#include "workers.h"
+
+#define NBODY_G 6.0e4f // px^3/s^2 per unit of mass: 100 default balls pull at about standard gravity from 100 px
+#define NBODY_SOFTENING ((float) BALL_RADIUS) // px, keeps the pull between touching balls finite
+#define NBODY_THETA 0.5f // default opening angle, see NBody
+#define NBODY_MIN_THETA 0.1f
+#define NBODY_MAX_THETA 1.5f
+#define NBODY_THETA_ENV "SIM_NBODY_THETA" // overrides the default opening angle when set
+#define NBODY_LEAF_SIZE 8 // bodies per leaf
+#define NBODY_TREE_DEPTH 64 // traversal stack, a 4-ary tree 16 levels deep needs 3 * 17 + 1 at most
+#define NBODY_TASKS_PER_THREAD 8 // subtrees the tree build is split into per thread
+
+// one square cell of the quadtree. the children of an inner node are stored next to each other,
+// the bodies of a leaf too
+typedef struct {
+    float x; // centre of mass
+    float y;
+    float mass;
+    float size; // side of the cell
+    float cell_x; // top left corner of the cell
+    float cell_y;
+    Uint32 first; // first child or, for a leaf, first body
+    Uint32 count; // children (2 to 4) or bodies
+    bool leaf;
+} NBodyNode;
+
+// a subtree left for a worker: node `slot` over bodies [begin, end), its descendants from `area` on
+typedef struct {
+    Uint32 slot;
+    Uint32 area;
+    Uint32 begin;
+    Uint32 end;
+} NBodyTask;
+
+// mutual gravity between all visible balls with a Barnes-Hut quadtree, rebuilt every step.
+// bodies are sorted by the Morton code of their position so each cell is a contiguous run of them;
+// a cell seen from a ball at distance d under an angle size / d below theta pulls like a single body
+// at its centre of mass, so a ball visits O(log n) cells instead of n balls. smaller is closer to exact, down
+// to NBODY_MIN_THETA, larger is faster and rougher.
+// a node over m bodies never needs more than 2m - 1 slots for itself and everything below it, so each
+// subtree's slots are known up front and the workers build them without sharing anything
+typedef struct {
+    float theta;
+    size_t capacity; // bodies, the same as the ball capacity
+    size_t body_count;
+    Uint32 *codes;
+    Uint32 *order; // ball index of each sorted body
+    Uint32 *sort_codes; // radix sort scratch
+    Uint32 *sort_order;
+    float *x; // sorted body positions and masses
+    float *y;
+    float *mass;
+    NBodyNode *nodes; // 2 * capacity slots, sparse
+    NBodyTask *tasks;
+    size_t task_count;
+    size_t task_capacity;
+    Uint32 *top; // nodes built before the workers, in creation order
+    size_t top_count;
+    size_t top_capacity;
+    float min_x; // root cell
+    float min_y;
+    float size;
+    float *ax; // px/s^2 on each ball from the last ComputeNBodyForces, by ball index
+    float *ay;
+} NBody;
+
+// NBODY_THETA_ENV overrides theta when set, theta <= 0 picks NBODY_THETA
+void InitNBody(NBody *nbody, float theta);
+
+void FreeNBody(NBody *nbody);
+
+// builds the tree over every visible ball and evaluates the pull on each active one, both in parallel.
+// idle balls pull but aren't pulled. false if memory runs out, the accelerations are stale then
+bool ComputeNBodyForces(NBody *nbody, WorkerPool *workers, const BallStore *balls);
+
+// kicks every visible, non-idle ball by the last computed accelerations over dt seconds
+void ApplyNBodyForces(const NBody *nbody, BallStore *balls, float dt);
+
+#endif
@@ -0,0 +1,483 @@
+#include "obstacles.h"
+#include <math.h>
+
+
+void FreeObstacles(Obstacles *obstacles) {
+    SDL_free(obstacles->ax);
+    SDL_free(obstacles->ay);
+    SDL_free(obstacles->bx);
+    SDL_free(obstacles->by);
+    SDL_free(obstacles->radius);
+    SDL_free(obstacles->nodes);
+    *obstacles = (Obstacles) {0};
+}
+
+static bool reserveObstacles(Obstacles *obstacles, const size_t capacity) {
+    if (capacity <= obstacles->capacity) return true;
+
+#define GROW(field)                                                                      \
+    do {                                                                                 \
+        void *grown = SDL_realloc(obstacles->field, capacity * sizeof(*obstacles->field)); \
+        if (!grown) return false;                                                        \
+        obstacles->field = grown;                                                        \
+    } while (0)
+
+    GROW(ax);
+    GROW(ay);
+    GROW(bx);
+    GROW(by);
+    GROW(radius);
+#undef GROW
+
+    obstacles->capacity = capacity;
+    return true;
+}
+
+static bool addPrimitive(Obstacles *obstacles, const float ax, const float ay, const float bx, const float by,
+                         const float r) {
+    if (obstacles->count == obstacles->capacity &&
+        !reserveObstacles(obstacles, obstacles->capacity ? obstacles->capacity * 2 : 64)) {
+        return false;
+    }
+
+    const size_t k = obstacles->count++;
+    obstacles->ax[k] = ax;
+    obstacles->ay[k] = ay;
+    obstacles->bx[k] = bx;
+    obstacles->by[k] = by;
+    obstacles->radius[k] = r;
+    return true;
+}
+
+bool AddObstacleSegment(Obstacles *obstacles, const float x1, const float y1, const float x2, const float y2) {
+    return addPrimitive(obstacles, x1, y1, x2, y2, 0);
+}
+
+bool AddObstacleCircle(Obstacles *obstacles, const float x, const float y, const float r) {
+    return addPrimitive(obstacles, x, y, x, y, r);
+}
+
+bool AddObstaclePolygon(Obstacles *obstacles, const SDL_FPoint *points, const size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        const SDL_FPoint a = points[k];
+        const SDL_FPoint b = points[(k + 1) % count];
+        if (!addPrimitive(obstacles, a.x, a.y, b.x, b.y, 0)) return false;
+    }
+    return true;
+}
+
+// --- tree
+
+static void growBounds(ObstacleNode *node, const Obstacles *obstacles, const size_t k) {
+    const float r = obstacles->radius[k];
+    node->min_x = fminf(node->min_x, fminf(obstacles->ax[k], obstacles->bx[k]) - r);
+    node->min_y = fminf(node->min_y, fminf(obstacles->ay[k], obstacles->by[k]) - r);
+    node->max_x = fmaxf(node->max_x, fmaxf(obstacles->ax[k], obstacles->bx[k]) + r);
+    node->max_y = fmaxf(node->max_y, fmaxf(obstacles->ay[k], obstacles->by[k]) + r);
+}
+
+// partial sort of order[start, end) by key so that order[mid] is in its sorted place, smaller keys before it.
+// three-way partitions, so runs of equal keys (a row of pegs, a straight wall) don't make it quadratic
+static void selectMedian(Uint32 *order, const float *key, size_t start, size_t end, const size_t mid) {
+    while (end - start > 1) {
+        const float pivot = key[order[(start + end) / 2]];
+        size_t lt = start;
+        size_t gt = end;
+
+        // [start, lt) < pivot, [lt, k) == pivot, [gt, end) > pivot
+        for (size_t k = start; k < gt;) {
+            const Uint32 swap = order[k];
+            if (key[swap] < pivot) {
+                order[k++] = order[lt];
+                order[lt++] = swap;
+            } else if (key[swap] > pivot) {
+                order[k] = order[--gt];
+                order[gt] = swap;
+            } else {
+                k++;
+            }
+        }
+
+        if (mid < lt) {
+            end = lt;
+        } else if (mid >= gt) {
+            start = gt;
+        } else {
+            return;
+        }
+    }
+}
+
+// median split along the longer side of the centroids' bounds, node `n` covers order[start, end)
+static void buildNode(Obstacles *obstacles, Uint32 *order, const float *cx, const float *cy, const Uint32 n,
+                      const size_t start, const size_t end) {
+    ObstacleNode *node = &obstacles->nodes[n];
+    *node = (ObstacleNode) {.min_x = INFINITY, .min_y = INFINITY, .max_x = -INFINITY, .max_y = -INFINITY};
+
+    float min_cx = INFINITY, min_cy = INFINITY, max_cx = -INFINITY, max_cy = -INFINITY;
+    for (size_t k = start; k < end; ++k) {
+        growBounds(node, obstacles, order[k]);
+        min_cx = fminf(min_cx, cx[order[k]]);
+        max_cx = fmaxf(max_cx, cx[order[k]]);
+        min_cy = fminf(min_cy, cy[order[k]]);
+        max_cy = fmaxf(max_cy, cy[order[k]]);
+    }
+
+    if (end - start <= OBSTACLE_LEAF_SIZE) {
+        node->first = start;
+        node->count = end - start;
+        return;
+    }
+
+    const size_t mid = (start + end) / 2;
+    selectMedian(order, max_cx - min_cx >= max_cy - min_cy ? cx : cy, start, end, mid);
+
+    const Uint32 left = obstacles->node_count;
+    obstacles->node_count += 2;
+    node->first = left;
+
+    buildNode(obstacles, order, cx, cy, left, start, mid);
+    buildNode(obstacles, order, cx, cy, left + 1, mid, end);
+}
+
+// puts the primitives into tree order, so every leaf is one contiguous run
+static bool permuteStream(float **stream, const Uint32 *order, const size_t count) {
+    float *sorted = SDL_malloc(count * sizeof(float));
+    if (!sorted) return false;
+
+    for (size_t k = 0; k < count; ++k) sorted[k] = (*stream)[order[k]];
+    SDL_free(*stream);
+    *stream = sorted;
+    return true;
+}
+
+bool BuildObstacleTree(Obstacles *obstacles) {
+    const size_t count = obstacles->count;
+    SDL_free(obstacles->nodes);
+    obstacles->nodes = NULL;
+    obstacles->node_count = 0;
+    if (!count) return true;
+
+    // a binary tree with leaves of at least one primitive has fewer than 2 * count nodes
+    obstacles->nodes = SDL_malloc(2 * count * sizeof(ObstacleNode));
+    Uint32 *order = SDL_malloc(count * sizeof(Uint32));
+    float *centroids = SDL_malloc(2 * count * sizeof(float));
+    if (!obstacles->nodes || !order || !centroids) {
+        SDL_free(order);
+        SDL_free(centroids);
+        SDL_free(obstacles->nodes);
+        obstacles->nodes = NULL;
+        return false;
+    }
+
+    float *cx = centroids;
+    float *cy = centroids + count;
+    for (size_t k = 0; k < count; ++k) {
+        order[k] = k;
+        cx[k] = (obstacles->ax[k] + obstacles->bx[k]) * 0.5f;
+        cy[k] = (obstacles->ay[k] + obstacles->by[k]) * 0.5f;
+    }
+
+    obstacles->node_count = 1;
+    buildNode(obstacles, order, cx, cy, 0, 0, count);
+
+    const bool sorted = permuteStream(&obstacles->ax, order, count) && permuteStream(&obstacles->ay, order, count) &&
+                        permuteStream(&obstacles->bx, order, count) && permuteStream(&obstacles->by, order, count) &&
+                        permuteStream(&obstacles->radius, order, count);
+    obstacles->capacity = count;
+
+    SDL_free(order);
+    SDL_free(centroids);
+    if (!sorted) {
+        // the streams may be half reordered, leaves would point at the wrong primitives
+        FreeObstacles(obstacles);
+        return false;
+    }
+    return true;
+}
+
+// --- loading
+
+static bool parseNumbers(char **saveptr, float *values, const size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        const char *token = SDL_strtokr(NULL, " \t\r", saveptr);
+        if (!token) return false;
+
+        char *end;
+        values[k] = (float) SDL_strtod(token, &end);
+        if (end == token || *end) return false;
+    }
+    return true;
+}
+
+static bool parsePolygon(Obstacles *obstacles, char **saveptr) {
+    SDL_FPoint *points = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    bool ok = true;
+
+    for (;;) {
+        float xy[2];
+        const char *token = SDL_strtokr(NULL, " \t\r", saveptr);
+        if (!token) break;
+
+        char *end;
+        xy[0] = (float) SDL_strtod(token, &end);
+        if (end == token || *end || !parseNumbers(saveptr, xy + 1, 1)) {
+            ok = false;
+            break;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            SDL_FPoint *grown = SDL_realloc(points, capacity * sizeof(SDL_FPoint));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            points = grown;
+        }
+        points[count++] = (SDL_FPoint) {.x = xy[0], .y = xy[1]};
+    }
+
+    ok = ok && count >= 3 && AddObstaclePolygon(obstacles, points, count);
+    SDL_free(points);
+    return ok;
+}
+
+bool LoadObstacles(Obstacles *obstacles, const char *path) {
+    char *text = SDL_LoadFile(path, NULL);
+    if (!text) return false;
+
+    bool ok = true;
+    int line_number = 0;
+    char *next = text;
+
+    // split by hand, strtok would run blank lines together and the numbers in the messages would drift
+    while (next && ok) {
+        char *line = next;
+        next = SDL_strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_number++;
+
+        char *saveptr;
+        const char *keyword = SDL_strtokr(line, " \t\r", &saveptr);
+        if (!keyword || keyword[0] == '#') continue;
+
+        float v[4];
+        if (!SDL_strcmp(keyword, "segment")) {
+            ok = parseNumbers(&saveptr, v, 4) && AddObstacleSegment(obstacles, v[0], v[1], v[2], v[3]);
+        } else if (!SDL_strcmp(keyword, "circle")) {
+            ok = parseNumbers(&saveptr, v, 3) && v[2] > 0 && AddObstacleCircle(obstacles, v[0], v[1], v[2]);
+        } else if (!SDL_strcmp(keyword, "polygon")) {
+            ok = parsePolygon(obstacles, &saveptr);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) SDL_Log("%s:%d: can't read obstacle\n", path, line_number);
+    }
+
+    SDL_free(text);
+    return ok && BuildObstacleTree(obstacles);
+}
+
+// --- queries
+
+// closest point of primitive k to (x, y)
+static void closestPoint(const Obstacles *obstacles, const size_t k, const float x, const float y, float *px,
+                         float *py) {
+    const float dx = obstacles->bx[k] - obstacles->ax[k];
+    const float dy = obstacles->by[k] - obstacles->ay[k];
+    const float len_sq = dx * dx + dy * dy;
+
+    float u = len_sq > 0 ? ((x - obstacles->ax[k]) * dx + (y - obstacles->ay[k]) * dy) / len_sq : 0;
+    u = fminf(fmaxf(u, 0), 1.0f);
+    *px = obstacles->ax[k] + dx * u;
+    *py = obstacles->ay[k] + dy * u;
+}
+
+// pushes ball i out of primitive k and reflects the part of its velocity going into it, false if they don't touch
+static bool collidePrimitive(const Obstacles *obstacles, BallStore *balls, const size_t i, const size_t k) {
+    float px, py;
+    closestPoint(obstacles, k, balls->x[i], balls->y[i], &px, &py);
+
+    const float dx = balls->x[i] - px;
+    const float dy = balls->y[i] - py;
+    const float reach = balls->radius[i] + obstacles->radius[k];
+    const float distance_sq = dx * dx + dy * dy;
+    if (distance_sq >= reach * reach) return false;
+
+    // a centre right on a line goes out the side the segment's normal points to
+    const float distance = sqrtf(distance_sq);
+    float nx = 0, ny = -1.0f;
+    if (distance > 0) {
+        nx = dx / distance;
+        ny = dy / distance;
+    } else if (obstacles->ax[k] != obstacles->bx[k] || obstacles->ay[k] != obstacles->by[k]) {
+        const float sx = obstacles->bx[k] - obstacles->ax[k];
+        const float sy = obstacles->by[k] - obstacles->ay[k];
+        const float len = sqrtf(sx * sx + sy * sy);
+        nx = sy / len;
+        ny = -sx / len;
+    }
+
+    balls->x[i] += (reach - distance) * nx;
+    balls->y[i] += (reach - distance) * ny;
+
+    const float approach = balls->vx[i] * nx + balls->vy[i] * ny;
+    if (approach >= 0) return true;
+
+    const Uint8 m = balls->material[i];
+    const float bounce = balls->materials.restitution[m];
+    balls->vx[i] -= (1 + bounce) * approach * nx;
+    balls->vy[i] -= (1 + bounce) * approach * ny;
+
+    // barely bouncing: it's sliding along the obstacle, slowed like on the floor
+    if (-approach * bounce < BALL_REST_VELOCITY) {
+        const float along = balls->vx[i] * -ny + balls->vy[i] * nx;
+        balls->vx[i] -= (1.0f - balls->materials.friction[m]) * along * -ny;
+        balls->vy[i] -= (1.0f - balls->materials.friction[m]) * along * nx;
+    }
+    return true;
+}
+
+static bool nodeOverlaps(const ObstacleNode *node, const float min_x, const float min_y, const float max_x,
+                         const float max_y) {
+    return node->min_x <= max_x && node->max_x >= min_x && node->min_y <= max_y && node->max_y >= min_y;
+}
+
+// one pass over the primitives near ball i, returns whether it touched any
+static bool collideBall(const Obstacles *obstacles, BallStore *balls, const size_t i) {
+    Uint32 stack[OBSTACLE_TREE_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    bool touched = false;
+
+    const float r = balls->radius[i];
+    while (top) {
+        const ObstacleNode *node = &obstacles->nodes[stack[--top]];
+        if (!nodeOverlaps(node, balls->x[i] - r, balls->y[i] - r, balls->x[i] + r, balls->y[i] + r)) continue;
+
+        if (node->count) {
+            for (Uint32 k = node->first; k < node->first + node->count; ++k) {
+                touched |= collidePrimitive(obstacles, balls, i, k);
+            }
+        } else if (top + 2 <= OBSTACLE_TREE_DEPTH) {
+            stack[top++] = node->first + 1;
+            stack[top++] = node->first;
+        }
+    }
+
+    return touched;
+}
+
+void CollideBallObstacles(const Obstacles *obstacles, BallStore *balls, const size_t i) {
+    if (!obstacles->node_count) return;
+
+    // pushing out of one primitive can push into the next, a ball wedged between some takes a few passes
+    for (int n = 0; n < OBSTACLE_ITERATIONS && collideBall(obstacles, balls, i); ++n) {}
+}
+
+void CollideObstacles(const Obstacles *obstacles, BallStore *balls) {
+    if (!obstacles->node_count) return;
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            CollideBallObstacles(obstacles, balls, w * BALL_MASK_BITS + BALL_MASK_CTZ(bits));
+        }
+    }
+}
+
+// time until the point (x, y) moving at (vx, vy) comes within `reach` of (px, py), while closing in
+static bool sweepPoint(const float px, const float py, const float x, const float y, const float vx, const float vy,
+                       const float reach, float *time, float *nx, float *ny) {
+    const float dx = x - px;
+    const float dy = y - py;
+    const float qa = vx * vx + vy * vy;
+    const float qb = dx * vx + dy * vy;
+    const float qc = dx * dx + dy * dy - reach * reach;
+    if (qc <= 0 || qb >= 0 || qa == 0) return false;
+
+    const float disc = qb * qb - qa * qc;
+    if (disc < 0) return false;
+
+    const float t = qc / (-qb + sqrtf(disc));
+    if (t >= *time) return false;
+
+    *time = t;
+    *nx = (dx + vx * t) / reach;
+    *ny = (dy + vy * t) / reach;
+    return true;
+}
+
+// a rounded segment is two flat sides and two round ends
+static bool sweepPrimitive(const Obstacles *obstacles, const size_t k, const float x, const float y, const float vx,
+                           const float vy, const float r, float *time, float *nx, float *ny) {
+    const float ax = obstacles->ax[k];
+    const float ay = obstacles->ay[k];
+    const float dx = obstacles->bx[k] - ax;
+    const float dy = obstacles->by[k] - ay;
+    const float len_sq = dx * dx + dy * dy;
+    const float reach = r + obstacles->radius[k];
+    bool hit = false;
+
+    if (len_sq > 0) {
+        const float len = sqrtf(len_sq);
+        float sx = -dy / len;
+        float sy = dx / len;
+        float side = (x - ax) * sx + (y - ay) * sy;
+        if (side < 0) {
+            sx = -sx;
+            sy = -sy;
+            side = -side;
+        }
+
+        const float closing = vx * sx + vy * sy;
+        if (side >= reach && closing < 0) {
+            const float t = (reach - side) / closing;
+            const float u = ((x + vx * t - ax) * dx + (y + vy * t - ay) * dy) / len_sq;
+            if (t < *time && u >= 0 && u <= 1.0f) {
+                *time = t;
+                *nx = sx;
+                *ny = sy;
+                hit = true;
+            }
+        }
+
+        hit |= sweepPoint(obstacles->bx[k], obstacles->by[k], x, y, vx, vy, reach, time, nx, ny);
+    }
+
+    hit |= sweepPoint(ax, ay, x, y, vx, vy, reach, time, nx, ny);
+    return hit;
+}
+
+bool SweepObstacles(const Obstacles *obstacles, const float x, const float y, const float vx, const float vy,
+                    const float r, float *time, float *nx, float *ny) {
+    if (!obstacles->node_count) return false;
+
+    Uint32 stack[OBSTACLE_TREE_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    bool hit = false;
+
+    while (top) {
+        const ObstacleNode *node = &obstacles->nodes[stack[--top]];
+
+        // the box around what's left of the path shrinks with every hit
+        const float x1 = x + vx * *time;
+        const float y1 = y + vy * *time;
+        if (!nodeOverlaps(node, fminf(x, x1) - r, fminf(y, y1) - r, fmaxf(x, x1) + r, fmaxf(y, y1) + r)) continue;
+
+        if (node->count) {
+            for (Uint32 k = node->first; k < node->first + node->count; ++k) {
+                hit |= sweepPrimitive(obstacles, k, x, y, vx, vy, r, time, nx, ny);
+            }
+        } else if (top + 2 <= OBSTACLE_TREE_DEPTH) {
+            stack[top++] = node->first + 1;
+            stack[top++] = node->first;
+        }
+    }
+
+    return hit;
+}
@@ -0,0 +1,69 @@
+#ifndef OBSTACLES_H
+#define OBSTACLES_H
+
+#include "ball.h"
+
+#define OBSTACLE_LEAF_SIZE 4 // primitives per BVH leaf
+#define OBSTACLE_ITERATIONS 4 // passes per ball and substep while it's still touching something
+#define OBSTACLE_TREE_DEPTH 64 // traversal stack, far more than a median split tree ever needs
+#define OBSTACLE_LEVEL_ENV "SIM_LEVEL" // level file loaded at startup when set
+
+// every obstacle is made of rounded segments: a line segment is one with radius 0, a circle one whose
+// ends coincide, and a polygon is the loop of its edges. a ball touches a primitive when its centre is
+// within its own radius plus the primitive's of the segment
+typedef struct {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+    Uint32 first; // leaf: first primitive, inner node: left child, the right one follows it
+    Uint32 count; // primitives in a leaf, 0 for an inner node
+} ObstacleNode;
+
+// static level geometry in a bounding-volume hierarchy built once after loading:
+// a ball query visits O(log n) nodes instead of every primitive.
+// the primitive streams are reordered by BuildObstacleTree so each leaf's primitives are contiguous
+typedef struct {
+    size_t count;
+    size_t capacity;
+    float *ax;
+    float *ay;
+    float *bx;
+    float *by;
+    float *radius;
+    ObstacleNode *nodes;
+    size_t node_count;
+} Obstacles;
+
+void FreeObstacles(Obstacles *obstacles);
+
+bool AddObstacleSegment(Obstacles *obstacles, float x1, float y1, float x2, float y2);
+
+bool AddObstacleCircle(Obstacles *obstacles, float x, float y, float r);
+
+// closed polygon through count points
+bool AddObstaclePolygon(Obstacles *obstacles, const SDL_FPoint *points, size_t count);
+
+// has to run once after the last Add, queries see nothing before that
+bool BuildObstacleTree(Obstacles *obstacles);
+
+// reads a level file, one obstacle per line:
+//   segment x1 y1 x2 y2
+//   circle x y r
+//   polygon x1 y1 x2 y2 x3 y3 ...
+// blank lines and lines starting with # are skipped. builds the tree, false on a read or parse error
+bool LoadObstacles(Obstacles *obstacles, const char *path);
+
+// pushes ball i out of the obstacles it overlaps and bounces it off them
+void CollideBallObstacles(const Obstacles *obstacles, BallStore *balls, size_t i);
+
+// CollideBallObstacles for every active ball
+void CollideObstacles(const Obstacles *obstacles, BallStore *balls);
+
+// earliest time within *time a ball of radius r at (x, y) moving at (vx, vy) touches an obstacle.
+// on a hit, *time and the contact normal (pointing towards the ball) are updated and true is returned.
+// obstacles the ball already overlaps are left to CollideObstacles
+bool SweepObstacles(const Obstacles *obstacles, float x, float y, float vx, float vy, float r, float *time,
+                    float *nx, float *ny);
+
+#endif
@@ -0,0 +1,131 @@
+#include "quantize.h"
+#include <math.h>
+
+
+bool ReserveQuantizedBalls(QuantizedBalls *quantized, const size_t capacity) {
+    if (capacity <= quantized->capacity) return true;
+
+#define GROW(field)                                                                      \
+    do {                                                                                 \
+        void *grown = SDL_SIMDRealloc(quantized->field, capacity * sizeof(*quantized->field)); \
+        if (!grown) return false;                                                        \
+        quantized->field = grown;                                                        \
+    } while (0)
+
+    GROW(cell);
+    GROW(qx);
+    GROW(qy);
+    GROW(vx);
+    GROW(vy);
+#undef GROW
+
+    Uint64 *packed = SDL_realloc(quantized->packed, capacity / BALL_MASK_BITS * sizeof(Uint64));
+    if (!packed) return false;
+    quantized->packed = packed;
+
+    // zeroed slots decode to a ball at rest in the corner, so the kernels can run over them harmlessly
+    const size_t old = quantized->capacity;
+    const size_t added = capacity - old;
+    SDL_memset(quantized->cell + old, 0, added * sizeof(Uint16));
+    SDL_memset(quantized->qx + old, 0, added * sizeof(Uint16));
+    SDL_memset(quantized->qy + old, 0, added * sizeof(Uint16));
+    SDL_memset(quantized->vx + old, 0, added * sizeof(Uint16));
+    SDL_memset(quantized->vy + old, 0, added * sizeof(Uint16));
+    SDL_memset(quantized->packed + old / BALL_MASK_BITS, 0, added / BALL_MASK_BITS * sizeof(Uint64));
+
+    quantized->capacity = capacity;
+    return true;
+}
+
+void FreeQuantizedBalls(QuantizedBalls *quantized) {
+    SDL_SIMDFree(quantized->cell);
+    SDL_SIMDFree(quantized->qx);
+    SDL_SIMDFree(quantized->qy);
+    SDL_SIMDFree(quantized->vx);
+    SDL_SIMDFree(quantized->vy);
+    SDL_free(quantized->packed);
+    *quantized = (QuantizedBalls) {0};
+}
+
+// the bits of a float. through a union rather than SDL_memcpy, which is a call into the library and keeps
+// the loops converting whole streams from vectorizing
+typedef union {
+    float value;
+    Uint32 bits;
+} FloatBits;
+
+// round to nearest, flush anything below the smallest normal half to zero, clamp instead of overflowing
+Uint16 FloatToHalf(const float value) {
+    const Uint32 bits = ((FloatBits) {.value = value}).bits;
+
+    const Uint32 sign = (bits >> 16) & 0x8000;
+    const Uint32 magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude < 0x38800000) return (Uint16) sign;
+    if (magnitude > 0x477FEFFF) return (Uint16) (sign | 0x7BFF);
+    return (Uint16) (sign | ((magnitude - 0x38000000 + 0x1000) >> 13));
+}
+
+// subnormal halves read as zero, FloatToHalf never writes them anyway
+float HalfToFloat(const Uint16 half) {
+    const Uint32 magnitude = half & 0x7FFF;
+    const Uint32 bits = ((Uint32) (half & 0x8000) << 16) | (magnitude >= 0x400 ? (magnitude << 13) + 0x38000000 : 0);
+
+    return ((FloatBits) {.bits = bits}).value;
+}
+
+static void packBall(QuantizedBalls *quantized, const BallStore *balls, const size_t i) {
+    const Sint32 x = (Sint32) lrintf(balls->x[i] * QUANT_SCALE);
+    const Sint32 y = (Sint32) lrintf(balls->y[i] * QUANT_SCALE);
+
+    quantized->cell[i] = (Uint16) ((x >> 16) | ((y >> 16) << 8));
+    quantized->qx[i] = (Uint16) x;
+    quantized->qy[i] = (Uint16) y;
+    quantized->vx[i] = FloatToHalf(balls->vx[i]);
+    quantized->vy[i] = FloatToHalf(balls->vy[i]);
+}
+
+void PackNewBalls(QuantizedBalls *quantized, BallStore *balls) {
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        // a recycled slot is still visible, but holds a different ball than the one packed
+        quantized->packed[w] &= balls->visible[w] & ~balls->recycled[w];
+        balls->recycled[w] = 0;
+
+        for (Uint64 bits = balls->visible[w] & ~quantized->packed[w]; bits; bits &= bits - 1) {
+            packBall(quantized, balls, w * BALL_MASK_BITS + BALL_MASK_CTZ(bits));
+        }
+        quantized->packed[w] = balls->visible[w];
+    }
+}
+
+static float unpackX(const QuantizedBalls *quantized, const size_t i) {
+    return (float) (((Uint32) (quantized->cell[i] & 0xFF) << 16) | quantized->qx[i]) / QUANT_SCALE;
+}
+
+static float unpackY(const QuantizedBalls *quantized, const size_t i) {
+    return (float) (((Uint32) (quantized->cell[i] >> 8) << 16) | quantized->qy[i]) / QUANT_SCALE;
+}
+
+void QuantizedPositions(const QuantizedBalls *quantized, const size_t first, const float dt, float *restrict x,
+                        float *restrict y) {
+    // every slot of the word, free or not, so the loop has no branches to keep it from vectorizing
+    for (size_t k = 0; k < BALL_MASK_BITS; ++k) {
+        x[k] = unpackX(quantized, first + k) + HalfToFloat(quantized->vx[first + k]) * dt;
+        y[k] = unpackY(quantized, first + k) + HalfToFloat(quantized->vy[first + k]) * dt;
+    }
+}
+
+void UnpackBalls(const QuantizedBalls *quantized, BallStore *balls) {
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & quantized->packed[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+
+            balls->x[i] = unpackX(quantized, i);
+            balls->y[i] = unpackY(quantized, i);
+            balls->vx[i] = HalfToFloat(quantized->vx[i]);
+            balls->vy[i] = HalfToFloat(quantized->vy[i]);
+            balls->prev_x[i] = balls->x[i];
+            balls->prev_y[i] = balls->y[i];
+        }
+    }
+}
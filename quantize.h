@@ -0,0 +1,44 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "ball.h"
+
+#define QUANT_CELL_SIZE 32 // px, positions are stored as a cell plus a 16-bit offset inside it
+#define QUANT_SCALE (65536.0f / QUANT_CELL_SIZE) // offset steps per px
+
+// compact ball state for very large populations: 10 bytes per ball instead of the 24 the float
+// streams (x, y, vx, vy and the interpolation copies) move per step. a position is
+// (cell column, cell row) * QUANT_CELL_SIZE + (qx, qy) / QUANT_SCALE, which is the same as a 24-bit
+// fixed-point coordinate, and velocities are IEEE half floats without subnormals.
+// the kernels unpack into float registers and pack the result straight back, radius and material are
+// read from the BallStore as they are never written by a step
+typedef struct {
+    size_t capacity;
+    Uint16 *cell; // (row << 8) | column
+    Uint16 *qx;
+    Uint16 *qy;
+    Uint16 *vx;
+    Uint16 *vy;
+    Uint64 *packed; // balls whose state lives here, the float streams are stale for them
+} QuantizedBalls;
+
+bool ReserveQuantizedBalls(QuantizedBalls *quantized, size_t capacity);
+
+void FreeQuantizedBalls(QuantizedBalls *quantized);
+
+// packs every visible ball that isn't packed yet (new or recycled ones, or all after a switch) and forgets
+// released ones
+void PackNewBalls(QuantizedBalls *quantized, BallStore *balls);
+
+// writes the packed state back into the float streams, prev_x/prev_y included, for leaving quantized storage
+void UnpackBalls(const QuantizedBalls *quantized, BallStore *balls);
+
+// the packed positions in px of the BALL_MASK_BITS slots from `first` (a multiple of BALL_MASK_BITS) on, each
+// moved along its velocity for dt seconds, into x and y. for readers like the renderer that need no float copy
+void QuantizedPositions(const QuantizedBalls *quantized, size_t first, float dt, float *restrict x, float *restrict y);
+
+Uint16 FloatToHalf(float value);
+
+float HalfToFloat(Uint16 half);
+
+#endif
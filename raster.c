@@ -0,0 +1,105 @@
+#include "raster.h"
+#include "simd.h"
+#include <math.h>
+
+// each level works out RASTER_LANES rows at once: the square root gives the half width up to rounding, one
+// step either way makes it exact. squares stay below 2^24, so the float arithmetic on them is exact too
+#if SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX512
+#include <immintrin.h>
+#define RASTER_LANES 16
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX2
+#include <immintrin.h>
+#define RASTER_LANES 8
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_SSE2
+#include <emmintrin.h>
+#define RASTER_LANES 4
+#else
+#define RASTER_LANES 1
+#endif
+
+
+#if RASTER_LANES == 16
+
+static inline void spanLanes(const int r, const int first, int *half_width) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 dy = _mm512_cvtepi32_ps(_mm512_add_epi32(
+            _mm512_set1_epi32(first),
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+    ));
+    const __m512 t = _mm512_max_ps(_mm512_sub_ps(_mm512_set1_ps((float) (r * r)), _mm512_mul_ps(dy, dy)),
+                                   _mm512_setzero_ps());
+
+    __m512 s = _mm512_cvtepi32_ps(_mm512_cvttps_epi32(_mm512_sqrt_ps(t)));
+    s = _mm512_mask_sub_ps(s, _mm512_cmp_ps_mask(_mm512_mul_ps(s, s), t, _CMP_GE_OQ), s, one);
+    const __m512 next = _mm512_add_ps(s, one);
+    s = _mm512_mask_add_ps(s, _mm512_cmp_ps_mask(_mm512_mul_ps(next, next), t, _CMP_LT_OQ), s, one);
+    _mm512_storeu_si512(half_width, _mm512_cvtps_epi32(s));
+}
+
+#elif RASTER_LANES == 8
+
+static inline void spanLanes(const int r, const int first, int *half_width) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 dy = _mm256_cvtepi32_ps(_mm256_add_epi32(
+            _mm256_set1_epi32(first),
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+    ));
+    const __m256 t = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps((float) (r * r)), _mm256_mul_ps(dy, dy)),
+                                   _mm256_setzero_ps());
+
+    __m256 s = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_sqrt_ps(t)));
+    s = _mm256_sub_ps(s, _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(s, s), t, _CMP_GE_OQ), one));
+    const __m256 next = _mm256_add_ps(s, one);
+    s = _mm256_add_ps(s, _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(next, next), t, _CMP_LT_OQ), one));
+    _mm256_storeu_si256((__m256i *) half_width, _mm256_cvtps_epi32(s));
+}
+
+#elif RASTER_LANES == 4
+
+static inline void spanLanes(const int r, const int first, int *half_width) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 dy = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(first), _mm_setr_epi32(0, 1, 2, 3)));
+    const __m128 t = _mm_max_ps(_mm_sub_ps(_mm_set1_ps((float) (r * r)), _mm_mul_ps(dy, dy)), _mm_setzero_ps());
+
+    __m128 s = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_sqrt_ps(t)));
+    s = _mm_sub_ps(s, _mm_and_ps(_mm_cmpge_ps(_mm_mul_ps(s, s), t), one));
+    const __m128 next = _mm_add_ps(s, one);
+    s = _mm_add_ps(s, _mm_and_ps(_mm_cmplt_ps(_mm_mul_ps(next, next), t), one));
+    _mm_storeu_si128((__m128i *) half_width, _mm_cvtps_epi32(s));
+}
+
+#else
+
+// scalar fallback, one row per call
+static inline void spanLanes(const int r, const int first, int *half_width) {
+    const float t = fmaxf((float) (r * r) - (float) first * (float) first, 0.0f);
+
+    float s = (float) (int) sqrtf(t);
+    if (s * s >= t) s -= 1.0f;
+    if ((s + 1.0f) * (s + 1.0f) < t) s += 1.0f;
+    *half_width = (int) s;
+}
+
+#endif
+
+void SIMD_KERNEL(CircleSpans)(const int r, const int first, const int count, int *half_width) {
+    int k = 0;
+    for (; k + RASTER_LANES <= count; k += RASTER_LANES) spanLanes(r, first + k, half_width + k);
+
+    // the last rows through a full group, of which only they are kept
+    if (k < count) {
+        int rest[RASTER_LANES];
+        spanLanes(r, first + k, rest);
+        for (int l = 0; k + l < count; ++l) half_width[k + l] = rest[l];
+    }
+}
+
+#if SIMD_DISPATCH && SIMD_BUILD_LEVEL == SIMD_LEVEL_SCALAR
+
+SIMD_DECLARE_KERNEL(void, CircleSpans, (int r, int first, int count, int *half_width));
+
+void CircleSpans(const int r, const int first, const int count, int *half_width) {
+    SIMD_SELECT(CircleSpans)(r, first, count, half_width);
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#define RASTER_ROWS 64 // rows FillCircle works out and draws at once
+
+// for the rows dy = first .. first + count - 1 of a disc of radius r, the half width h of the span of pixels
+// x - h .. x + h with dx * dx + dy * dy < r * r, -1 for a row without any. exact for r below 2048
+void CircleSpans(int r, int first, int count, int *half_width);
+
+#endif
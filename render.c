@@ -1,4 +1,5 @@
 #include <math.h>
+#include "raster.h"
 #include "render.h"
 #include "utils.h"
 #include "window.h"
@@ -15,38 +16,170 @@ void SetRenderColor(SDL_Renderer *renderer, const Uint32 color) {
 }
 
 void FillCircle(SDL_Renderer *renderer, const SDL_Point p, const int r) {
-    const int r_sq = r * r;
-    int dst_sq;
-
-    for (int x = p.x - r; x <= p.x + r; ++x) {
-        for (int y = p.y - r; y <= p.y + r; ++y) {
-            dst_sq = (x - p.x) * (x - p.x) + (y - p.y) * (y - p.y);
-            if (dst_sq < r_sq) {
-                SDL_RenderDrawPoint(renderer, x, y);
+    // the pixels closer than r to the centre, as one span per row and one draw call per RASTER_ROWS rows
+    int half_width[RASTER_ROWS];
+    SDL_Rect spans[RASTER_ROWS];
+
+    for (int first = -r; first <= r; first += RASTER_ROWS) {
+        const int rows = SDL_min(RASTER_ROWS, r - first + 1);
+        CircleSpans(r, first, rows, half_width);
+
+        int count = 0;
+        for (int k = 0; k < rows; ++k) {
+            if (half_width[k] < 0) continue;
+            spans[count++] = (SDL_Rect) {
+                    .x = p.x - half_width[k],
+                    .y = p.y + first + k,
+                    .w = 2 * half_width[k] + 1,
+                    .h = 1
+            };
+        }
+        if (count) SDL_RenderFillRects(renderer, spans, count);
+    }
+}
+
+// a box as two triangles, a capsule as the box around its middle and a disc at each end
+static void renderShape(SDL_Renderer *renderer, const BallStore *balls, const size_t i, const float x, const float y,
+                        const Uint32 color) {
+    const float ux = cosf(balls->angle[i]);
+    const float uy = sinf(balls->angle[i]);
+    const float hl = balls->half_length[i];
+    const float hw = balls->half_width[i];
+    const SDL_Color tint = {color >> 24, (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF};
+
+    SDL_Vertex corners[4];
+    for (int k = 0; k < 4; ++k) {
+        const float along = k == 1 || k == 2 ? hl : -hl;
+        const float across = k >= 2 ? hw : -hw;
+        corners[k] = (SDL_Vertex) {
+                .position = {x + ux * along - uy * across, y + uy * along + ux * across},
+                .color = tint
+        };
+    }
+
+    const int triangles[6] = {0, 1, 2, 0, 2, 3};
+    SDL_RenderGeometry(renderer, NULL, corners, 4, triangles, 6);
+
+    if (balls->shape[i] == BALL_SHAPE_CAPSULE) {
+        SetRenderColor(renderer, color);
+        FillCircle(renderer, (SDL_Point) {.x = (int) (x - ux * hl), .y = (int) (y - uy * hl)}, (int) hw);
+        FillCircle(renderer, (SDL_Point) {.x = (int) (x + ux * hl), .y = (int) (y + uy * hl)}, (int) hw);
+    }
+}
+
+static void renderBall(SDL_Renderer *renderer, const BallStore *balls, const size_t i, const float x, const float y) {
+    Uint32 color = 0xFFFFFFFF;
+    const Uint32 lifetime = GetBallLifetime(balls, i);
+    if (lifetime != BALL_IDLE_LIFETIME_MS) {
+        const float fade = 1.0f - normalizeScalar(BALL_IDLE_LIFETIME_MS - lifetime, BALL_IDLE_LIFETIME_MS);
+        color = (0xFF << 24) | (0xFF << 16) | (0xFF << 8) | (Uint8) (fade * 255);
+    }
+
+    if (balls->shape[i] != BALL_SHAPE_CIRCLE) {
+        renderShape(renderer, balls, i, x, y, color);
+        return;
+    }
+
+    SetRenderColor(renderer, color);
+    FillCircle(
+            renderer,
+            (SDL_Point) {.x = (int) x, .y = (int) y},
+            (int) balls->radius[i]
+    );
+}
+
+void RenderBalls(SDL_Renderer *renderer, const BallStore *balls, const float alpha) {
+    // idle balls are still drawn while they fade out, so walk the visible mask rather than the active list
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+
+            // somewhere between the last two physics steps
+            renderBall(renderer, balls, i, balls->prev_x[i] + (balls->x[i] - balls->prev_x[i]) * alpha,
+                       balls->prev_y[i] + (balls->y[i] - balls->prev_y[i]) * alpha);
+        }
+    }
+}
+
+void RenderQuantizedBalls(SDL_Renderer *renderer, const QuantizedBalls *quantized, const BallStore *balls,
+                          const float alpha) {
+    float x[BALL_MASK_BITS];
+    float y[BALL_MASK_BITS];
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        if (!balls->visible[w]) continue;
+
+        // balls shot or recycled since the last step are only packed by the next one, they are still in the floats
+        Uint64 packed = 0;
+        if (w < quantized->capacity / BALL_MASK_BITS) {
+            packed = quantized->packed[w] & ~balls->recycled[w];
+            QuantizedPositions(quantized, w * BALL_MASK_BITS, (alpha - 1.0f) * STEP_TIME_S, x, y);
+        }
+
+        for (Uint64 bits = balls->visible[w]; bits; bits &= bits - 1) {
+            const size_t k = BALL_MASK_CTZ(bits);
+            const size_t i = w * BALL_MASK_BITS + k;
+
+            if ((packed >> k) & 1) {
+                renderBall(renderer, balls, i, x[k], y[k]);
+            } else {
+                renderBall(renderer, balls, i, balls->x[i], balls->y[i]);
             }
         }
     }
 }
 
-void RenderBalls(SDL_Renderer *renderer, Ball (*balls)[MAX_BALLS]) {
-    for (size_t i = 0; i < MAX_BALLS; ++i) {
-        Ball *ball = &(*balls)[i];
-        if (!ball->visible) continue;
+void RenderConstraints(SDL_Renderer *renderer, const Constraints *constraints, const BallStore *balls,
+                       const float alpha) {
+    for (size_t k = 0; k < constraints->count; ++k) {
+        const Uint32 a = constraints->list[k].a;
+        const Uint32 b = constraints->list[k].b;
+        SDL_RenderDrawLineF(renderer,
+                            balls->prev_x[a] + (balls->x[a] - balls->prev_x[a]) * alpha,
+                            balls->prev_y[a] + (balls->y[a] - balls->prev_y[a]) * alpha,
+                            balls->prev_x[b] + (balls->x[b] - balls->prev_x[b]) * alpha,
+                            balls->prev_y[b] + (balls->y[b] - balls->prev_y[b]) * alpha);
+    }
+}
+
+void RenderObstacles(SDL_Renderer *renderer, const Obstacles *obstacles) {
+    for (size_t k = 0; k < obstacles->count; ++k) {
+        const float r = obstacles->radius[k];
+        SDL_RenderDrawLineF(renderer, obstacles->ax[k], obstacles->ay[k], obstacles->bx[k], obstacles->by[k]);
 
-        Uint32 color = 0xFFFFFFFF;
-        if (ball->remaining_lifetime != BALL_IDLE_LIFETIME_MS) {
-            const float alpha = 1.0f - normalizeScalar(BALL_IDLE_LIFETIME_MS - ball->remaining_lifetime,
-                                                       BALL_IDLE_LIFETIME_MS);
-            color = (0xFF << 24) | (0xFF << 16) | (0xFF << 8) | (Uint8) (alpha * 255);
+        if (r > 0) {
+            FillCircle(renderer, (SDL_Point) {.x = (int) obstacles->ax[k], .y = (int) obstacles->ay[k]}, (int) r);
+            FillCircle(renderer, (SDL_Point) {.x = (int) obstacles->bx[k], .y = (int) obstacles->by[k]}, (int) r);
         }
+    }
+}
 
-        SetRenderColor(renderer, color);
-        FillCircle(
-                renderer,
-                (SDL_Point) {.x = (int) ball->pos.x, .y = (int) ball->pos.y},
-                BALL_RADIUS
-        );
+SDL_Texture *CreateTerrainTexture(SDL_Renderer *renderer, const Terrain *terrain, const Uint32 color) {
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC,
+                                             terrain->width, terrain->height);
+    Uint32 *pixels = SDL_malloc((size_t) terrain->width * (size_t) terrain->height * sizeof(Uint32));
+    if (!texture || !pixels) {
+        if (texture) SDL_DestroyTexture(texture);
+        SDL_free(pixels);
+        return NULL;
     }
+
+    for (size_t k = 0; k < (size_t) terrain->width * (size_t) terrain->height; ++k) {
+        pixels[k] = terrain->distance[k] < 0 ? color : 0;
+    }
+
+    SDL_UpdateTexture(texture, NULL, pixels, terrain->width * (int) sizeof(Uint32));
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    SDL_free(pixels);
+    return texture;
+}
+
+void RenderTerrain(SDL_Renderer *renderer, SDL_Texture *texture, const Terrain *terrain) {
+    const SDL_FRect area = {
+            .w = (float) terrain->width * terrain->cell_size,
+            .h = (float) terrain->height * terrain->cell_size
+    };
+    SDL_RenderCopyF(renderer, texture, NULL, &area);
 }
 
 void DrawDottedCircleLine(SDL_Renderer *renderer, int x1, int y1, int x2, int y2, const int step, const int r) {
@@ -3,10 +3,29 @@
 
 #include <SDL.h>
 #include "ball.h"
+#include "constraints.h"
+#include "obstacles.h"
+#include "quantize.h"
+#include "terrain.h"
 
 #define DRAW_TRAJECTORY_PREVIEW true
 
-void RenderBalls(SDL_Renderer *renderer, Ball (*balls)[MAX_BALLS]);
+// alpha in [0, 1] blends each ball from its position before the last physics step to its current one
+void RenderBalls(SDL_Renderer *renderer, const BallStore *balls, float alpha);
+
+// RenderBalls for quantized storage, read straight from the packed state. there is no copy from before the last
+// step, each ball is drawn back along its velocity by the part of the step alpha hasn't covered
+void RenderQuantizedBalls(SDL_Renderer *renderer, const QuantizedBalls *quantized, const BallStore *balls, float alpha);
+
+// a line between the two balls of each link, interpolated like RenderBalls
+void RenderConstraints(SDL_Renderer *renderer, const Constraints *constraints, const BallStore *balls, float alpha);
+
+void RenderObstacles(SDL_Renderer *renderer, const Obstacles *obstacles);
+
+// the terrain doesn't change, so it's drawn once into a texture with one pixel per field sample, NULL on failure
+SDL_Texture *CreateTerrainTexture(SDL_Renderer *renderer, const Terrain *terrain, Uint32 color);
+
+void RenderTerrain(SDL_Renderer *renderer, SDL_Texture *texture, const Terrain *terrain);
 
 void RenderBallShooter(SDL_Renderer *renderer, const SDL_Point *m_pos, const SDL_Point *anchor_point);
 
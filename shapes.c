@@ -0,0 +1,443 @@
+#include "shapes.h"
+#include "window.h"
+#include "world.h"
+#include <math.h>
+
+
+// --- response
+
+// pushes a and b apart by depth along n (unit, from a to b) and, if they close in at p, bounces them there:
+// the halved impulse of HandleCollision, with each ball's lever arm to p turning part of it into spin
+static inline float respond(BallStore *balls, const size_t a, const size_t b, const float nx, const float ny,
+                            const float depth, const float px, const float py) {
+    const float wa = balls->inv_mass[a];
+    const float wb = balls->inv_mass[b];
+    const float ia = balls->inv_inertia[a];
+    const float ib = balls->inv_inertia[b];
+
+    const float rax = px - balls->x[a];
+    const float ray = py - balls->y[a];
+    const float rbx = px - balls->x[b];
+    const float rby = py - balls->y[b];
+    const float arm_a = rax * ny - ray * nx;
+    const float arm_b = rbx * ny - rby * nx;
+
+    // velocity of each body at p: v + spin x r
+    const float dvx = (balls->vx[b] - balls->spin[b] * rby) - (balls->vx[a] - balls->spin[a] * ray);
+    const float dvy = (balls->vy[b] + balls->spin[b] * rbx) - (balls->vy[a] + balls->spin[a] * rax);
+    const float approach = dvx * nx + dvy * ny;
+
+    if (approach < 0) {
+        const float impulse = -(1 + PairRestitution(balls, a, b)) * approach /
+                              (wa + wb + ia * arm_a * arm_a + ib * arm_b * arm_b) / 2.0f;
+
+        balls->vx[a] -= impulse * nx * wa;
+        balls->vy[a] -= impulse * ny * wa;
+        balls->spin[a] -= impulse * arm_a * ia;
+        balls->vx[b] += impulse * nx * wb;
+        balls->vy[b] += impulse * ny * wb;
+        balls->spin[b] += impulse * arm_b * ib;
+    }
+
+    // the overlap is split by mass only, rotating it away would need another pass
+    const float share_a = wa / (wa + wb);
+    const float share_b = wb / (wa + wb);
+    balls->x[a] -= depth * share_a * nx;
+    balls->y[a] -= depth * share_a * ny;
+    balls->x[b] += depth * share_b * nx;
+    balls->y[b] += depth * share_b * ny;
+
+    return depth;
+}
+
+// --- geometry
+
+// t in [-1, 1] of the point c + t * h on a segment closest to p
+static inline float closestOnSegment(const float cx, const float cy, const float hx, const float hy,
+                                     const float px, const float py) {
+    const float length_sq = hx * hx + hy * hy;
+    if (length_sq <= 0) return 0;
+    return SDL_clamp(((px - cx) * hx + (py - cy) * hy) / length_sq, -1.0f, 1.0f);
+}
+
+// the point of a box (centre c, axis u, half extents hl and hw) furthest along d. corners about as far
+// as each other share it: a box lying flat on something touches it in the middle of its edge
+static inline void boxSupport(const float cx, const float cy, const float ux, const float uy, const float hl,
+                              const float hw, const float dx, const float dy, float *px, float *py) {
+    const float along = ux * dx + uy * dy;
+    const float across = ux * dy - uy * dx;
+    const float su = fabsf(along) * hl * 2.0f < SHAPE_PARALLEL_EPSILON ? 0 : copysignf(1.0f, along);
+    const float sv = fabsf(across) * hw * 2.0f < SHAPE_PARALLEL_EPSILON ? 0 : copysignf(1.0f, across);
+
+    *px = cx + ux * hl * su - uy * hw * sv;
+    *py = cy + uy * hl * su + ux * hw * sv;
+}
+
+// closest points of segments p1-q1 and p2-q2 (Ericson, Real-Time Collision Detection 5.1.9), neither degenerate
+static inline void closestSegments(const float p1x, const float p1y, const float q1x, const float q1y,
+                                   const float p2x, const float p2y, const float q2x, const float q2y,
+                                   float *c1x, float *c1y, float *c2x, float *c2y) {
+    const float d1x = q1x - p1x, d1y = q1y - p1y;
+    const float d2x = q2x - p2x, d2y = q2y - p2y;
+    const float rx = p1x - p2x, ry = p1y - p2y;
+    const float a = d1x * d1x + d1y * d1y;
+    const float e = d2x * d2x + d2y * d2y;
+    const float f = d2x * rx + d2y * ry;
+    const float c = d1x * rx + d1y * ry;
+    const float b = d1x * d2x + d1y * d2y;
+    const float denominator = a * e - b * b;
+
+    float s = denominator > 0 ? SDL_clamp((b * f - c * e) / denominator, 0.0f, 1.0f) : 0;
+    float t = (b * s + f) / e;
+    if (t < 0) {
+        t = 0;
+        s = SDL_clamp(-c / a, 0.0f, 1.0f);
+    } else if (t > 1) {
+        t = 1;
+        s = SDL_clamp((b - c) / a, 0.0f, 1.0f);
+    }
+
+    *c1x = p1x + d1x * s;
+    *c1y = p1y + d1y * s;
+    *c2x = p2x + d2x * t;
+    *c2y = p2y + d2y * t;
+}
+
+// whether segment p-q crosses the box [-hl, hl] x [-hw, hw] (Liang-Barsky clipping)
+static inline bool segmentHitsBox(const float px, const float py, const float qx, const float qy, const float hl,
+                                  const float hw) {
+    const float dx = qx - px;
+    const float dy = qy - py;
+    const float edge_p[4] = {-dx, dx, -dy, dy};
+    const float edge_q[4] = {px + hl, hl - px, py + hw, hw - py};
+    float t0 = 0, t1 = 1;
+
+    for (int k = 0; k < 4; ++k) {
+        if (edge_p[k] == 0) {
+            if (edge_q[k] < 0) return false;
+            continue;
+        }
+        const float t = edge_q[k] / edge_p[k];
+        if (edge_p[k] < 0) t0 = fmaxf(t0, t);
+        else t1 = fminf(t1, t);
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+// --- kernels, a is the lower shape
+
+// two round shapes whose closest points are c1 (on a's core) and c2 (on b's), with roundings r1 and r2
+static inline float roundContact(BallStore *balls, const size_t a, const size_t b, const float c1x,
+                                 const float c1y, const float c2x, const float c2y, const float r1, const float r2,
+                                 const float fallback_x, const float fallback_y) {
+    const float dx = c2x - c1x;
+    const float dy = c2y - c1y;
+    const float distance = sqrtf(dx * dx + dy * dy);
+    const float reach = r1 + r2;
+    if (distance >= reach) return 0;
+
+    const float nx = distance > 0 ? dx / distance : fallback_x;
+    const float ny = distance > 0 ? dy / distance : fallback_y;
+    const float depth = reach - distance;
+    return respond(balls, a, b, nx, ny, depth, c1x + nx * (r1 - depth * 0.5f), c1y + ny * (r1 - depth * 0.5f));
+}
+
+static inline float circleCapsule(BallStore *balls, const size_t a, const size_t b) {
+    const float ux = cosf(balls->angle[b]);
+    const float uy = sinf(balls->angle[b]);
+    const float hx = ux * balls->half_length[b];
+    const float hy = uy * balls->half_length[b];
+    const float t = closestOnSegment(balls->x[b], balls->y[b], hx, hy, balls->x[a], balls->y[a]);
+
+    return roundContact(balls, a, b, balls->x[a], balls->y[a], balls->x[b] + hx * t, balls->y[b] + hy * t,
+                        balls->radius[a], balls->half_width[b], -uy, ux);
+}
+
+static inline float capsuleCapsule(BallStore *balls, const size_t a, const size_t b) {
+    const float hax = cosf(balls->angle[a]) * balls->half_length[a];
+    const float hay = sinf(balls->angle[a]) * balls->half_length[a];
+    const float hbx = cosf(balls->angle[b]) * balls->half_length[b];
+    const float hby = sinf(balls->angle[b]) * balls->half_length[b];
+
+    float c1x, c1y, c2x, c2y;
+    closestSegments(balls->x[a] - hax, balls->y[a] - hay, balls->x[a] + hax, balls->y[a] + hay,
+                    balls->x[b] - hbx, balls->y[b] - hby, balls->x[b] + hbx, balls->y[b] + hby,
+                    &c1x, &c1y, &c2x, &c2y);
+
+    return roundContact(balls, a, b, c1x, c1y, c2x, c2y, balls->half_width[a], balls->half_width[b],
+                        -hay / balls->half_length[a], hax / balls->half_length[a]);
+}
+
+// in the box's frame: the closest point of the box to the circle, or the nearest face if the centre is inside.
+// a centre right on a face or corner counts as inside, it has no direction to the closest point
+static inline float circleBox(BallStore *balls, const size_t a, const size_t b) {
+    const float c = cosf(balls->angle[b]);
+    const float s = sinf(balls->angle[b]);
+    const float hl = balls->half_length[b];
+    const float hw = balls->half_width[b];
+    const float r = balls->radius[a];
+    const float dx = balls->x[a] - balls->x[b];
+    const float dy = balls->y[a] - balls->y[b];
+    const float lx = dx * c + dy * s;
+    const float ly = dy * c - dx * s;
+
+    float qx = SDL_clamp(lx, -hl, hl);
+    float qy = SDL_clamp(ly, -hw, hw);
+    const float distance = sqrtf((qx - lx) * (qx - lx) + (qy - ly) * (qy - ly));
+    if (distance >= r) return 0;
+
+    float nx, ny, depth;
+    if (distance <= 0) {
+        const float out_x = hl - fabsf(lx);
+        const float out_y = hw - fabsf(ly);
+        if (out_x < out_y) {
+            nx = -copysignf(1.0f, lx);
+            ny = 0;
+            qx = -nx * hl;
+            qy = ly;
+            depth = r + out_x;
+        } else {
+            nx = 0;
+            ny = -copysignf(1.0f, ly);
+            qx = lx;
+            qy = -ny * hw;
+            depth = r + out_y;
+        }
+    } else {
+        nx = (qx - lx) / distance;
+        ny = (qy - ly) / distance;
+        depth = r - distance;
+    }
+
+    return respond(balls, a, b, nx * c - ny * s, nx * s + ny * c, depth,
+                   balls->x[b] + qx * c - qy * s, balls->y[b] + qx * s + qy * c);
+}
+
+// in the box's frame. apart, the closest points are a segment end and the box or a corner and the segment;
+// crossing, the separating axis (box faces or the segment's normal) with the least overlap pushes them apart
+static inline float capsuleBox(BallStore *balls, const size_t a, const size_t b) {
+    const float c = cosf(balls->angle[b]);
+    const float s = sinf(balls->angle[b]);
+    const float hl = balls->half_length[b];
+    const float hw = balls->half_width[b];
+    const float r = balls->half_width[a];
+    const float dx = balls->x[a] - balls->x[b];
+    const float dy = balls->y[a] - balls->y[b];
+    const float lx = dx * c + dy * s;
+    const float ly = dy * c - dx * s;
+    const float turn = balls->angle[a] - balls->angle[b];
+    const float ux = cosf(turn);
+    const float uy = sinf(turn);
+    const float hx = ux * balls->half_length[a];
+    const float hy = uy * balls->half_length[a];
+
+    float nx, ny, px, py, depth;
+    if (segmentHitsBox(lx - hx, ly - hy, lx + hx, ly + hy, hl, hw)) {
+        const float axes[3][2] = {{1.0f, 0}, {0, 1.0f}, {-uy, ux}};
+        float least = INFINITY;
+        nx = 1.0f;
+        ny = 0;
+
+        for (int k = 0; k < 3; ++k) {
+            const float ax = axes[k][0], ay = axes[k][1];
+            const float centre = lx * ax + ly * ay;
+            const float overlap = hl * fabsf(ax) + hw * fabsf(ay) + fabsf(hx * ax + hy * ay) + r - fabsf(centre);
+            if (overlap < least) {
+                least = overlap;
+                nx = centre < 0 ? ax : -ax;
+                ny = centre < 0 ? ay : -ay;
+            }
+        }
+
+        // the segment end deepest into the box, or the middle if it lies along the face
+        const float along = hx * nx + hy * ny;
+        const float end = fabsf(along) * 2.0f < SHAPE_PARALLEL_EPSILON ? 0 : copysignf(1.0f, along);
+        depth = least;
+        px = lx + hx * end + nx * (r - depth * 0.5f);
+        py = ly + hy * end + ny * (r - depth * 0.5f);
+    } else {
+        float best = INFINITY, sx = 0, sy = 0, qx = 0, qy = 0;
+
+        for (int k = 0; k < 2; ++k) {
+            const float ex = k ? lx + hx : lx - hx;
+            const float ey = k ? ly + hy : ly - hy;
+            const float cx = SDL_clamp(ex, -hl, hl);
+            const float cy = SDL_clamp(ey, -hw, hw);
+            const float distance_sq = (cx - ex) * (cx - ex) + (cy - ey) * (cy - ey);
+            if (distance_sq < best) {
+                best = distance_sq;
+                sx = ex, sy = ey, qx = cx, qy = cy;
+            }
+        }
+        for (int k = 0; k < 4; ++k) {
+            const float vx = k & 1 ? hl : -hl;
+            const float vy = k & 2 ? hw : -hw;
+            const float t = closestOnSegment(lx, ly, hx, hy, vx, vy);
+            const float cx = lx + hx * t;
+            const float cy = ly + hy * t;
+            const float distance_sq = (vx - cx) * (vx - cx) + (vy - cy) * (vy - cy);
+            if (distance_sq < best) {
+                best = distance_sq;
+                sx = cx, sy = cy, qx = vx, qy = vy;
+            }
+        }
+
+        const float distance = sqrtf(best);
+        if (distance >= r || distance <= 0) return 0;
+
+        nx = (qx - sx) / distance;
+        ny = (qy - sy) / distance;
+        depth = r - distance;
+        px = qx;
+        py = qy;
+    }
+
+    return respond(balls, a, b, nx * c - ny * s, nx * s + ny * c, depth,
+                   balls->x[b] + px * c - py * s, balls->y[b] + px * s + py * c);
+}
+
+// separating axes are the four face normals. the contact point is the incident box's support point
+// into the other one, the reference box being the one whose face gave the axis
+static inline float boxBox(BallStore *balls, const size_t a, const size_t b) {
+    const float uax = cosf(balls->angle[a]), uay = sinf(balls->angle[a]);
+    const float ubx = cosf(balls->angle[b]), uby = sinf(balls->angle[b]);
+    const float hla = balls->half_length[a], hwa = balls->half_width[a];
+    const float hlb = balls->half_length[b], hwb = balls->half_width[b];
+    const float dx = balls->x[b] - balls->x[a];
+    const float dy = balls->y[b] - balls->y[a];
+    const float axes[4][2] = {{uax, uay}, {-uay, uax}, {ubx, uby}, {-uby, ubx}};
+
+    float least = INFINITY, nx = 1.0f, ny = 0;
+    int reference = 0;
+    for (int k = 0; k < 4; ++k) {
+        const float ax = axes[k][0], ay = axes[k][1];
+        const float extent_a = hla * fabsf(uax * ax + uay * ay) + hwa * fabsf(uax * ay - uay * ax);
+        const float extent_b = hlb * fabsf(ubx * ax + uby * ay) + hwb * fabsf(ubx * ay - uby * ax);
+        const float centre = dx * ax + dy * ay;
+        const float overlap = extent_a + extent_b - fabsf(centre);
+        if (overlap <= 0) return 0;
+
+        // a's faces win ties, so a box resting on another doesn't flip between them
+        if (overlap < least - 1e-3f) {
+            least = overlap;
+            nx = centre < 0 ? -ax : ax;
+            ny = centre < 0 ? -ay : ay;
+            reference = k < 2 ? 0 : 1;
+        }
+    }
+
+    float px, py;
+    if (reference == 0) {
+        boxSupport(balls->x[b], balls->y[b], ubx, uby, hlb, hwb, -nx, -ny, &px, &py);
+        px += nx * least * 0.5f;
+        py += ny * least * 0.5f;
+    } else {
+        boxSupport(balls->x[a], balls->y[a], uax, uay, hla, hwa, nx, ny, &px, &py);
+        px -= nx * least * 0.5f;
+        py -= ny * least * 0.5f;
+    }
+
+    return respond(balls, a, b, nx, ny, least, px, py);
+}
+
+void ResolveShapeContacts(BallStore *balls, const ContactKind kind, const BallPair *contacts, const size_t count,
+                          float *depth) {
+    // one loop per kind, so the kernel is picked once per bucket rather than per pair
+    switch (kind) {
+        case CONTACT_CIRCLE_CIRCLE:
+            for (size_t k = 0; k < count; ++k) depth[k] = HandleCollision(balls, contacts[k].a, contacts[k].b);
+            break;
+        case CONTACT_CIRCLE_CAPSULE:
+            for (size_t k = 0; k < count; ++k) depth[k] = circleCapsule(balls, contacts[k].a, contacts[k].b);
+            break;
+        case CONTACT_CIRCLE_BOX:
+            for (size_t k = 0; k < count; ++k) depth[k] = circleBox(balls, contacts[k].a, contacts[k].b);
+            break;
+        case CONTACT_CAPSULE_CAPSULE:
+            for (size_t k = 0; k < count; ++k) depth[k] = capsuleCapsule(balls, contacts[k].a, contacts[k].b);
+            break;
+        case CONTACT_CAPSULE_BOX:
+            for (size_t k = 0; k < count; ++k) depth[k] = capsuleBox(balls, contacts[k].a, contacts[k].b);
+            break;
+        case CONTACT_BOX_BOX:
+        default:
+            for (size_t k = 0; k < count; ++k) depth[k] = boxBox(balls, contacts[k].a, contacts[k].b);
+            break;
+    }
+}
+
+// --- integration
+
+// a bounce off a wall that doesn't move, at p with n pointing into the wall, then out of it by depth.
+// the tangential speed at p loses what the material's floor friction takes off a rolling ball
+static void bounceOffWall(BallStore *balls, const size_t i, const float nx, const float ny, const float depth,
+                          const float px, const float py) {
+    const float w = balls->inv_mass[i];
+    const float inertia = balls->inv_inertia[i];
+    const Uint8 m = balls->material[i];
+    const float rx = px - balls->x[i];
+    const float ry = py - balls->y[i];
+    const float arm_n = rx * ny - ry * nx;
+    const float arm_t = rx * nx + ry * ny; // r x t, with t = (-ny, nx)
+
+    const float vx = balls->vx[i] - balls->spin[i] * ry;
+    const float vy = balls->vy[i] + balls->spin[i] * rx;
+    const float into = vx * nx + vy * ny;
+    const float slide = vy * nx - vx * ny;
+
+    if (into > 0) {
+        const float impulse = (1 + balls->materials.restitution[m]) * into / (w + inertia * arm_n * arm_n);
+        balls->vx[i] -= impulse * nx * w;
+        balls->vy[i] -= impulse * ny * w;
+        balls->spin[i] -= impulse * arm_n * inertia;
+    }
+
+    const float grip = (1.0f - balls->materials.friction[m]) * slide / (w + inertia * arm_t * arm_t);
+    balls->vx[i] += grip * ny * w;
+    balls->vy[i] -= grip * nx * w;
+    balls->spin[i] -= grip * arm_t * inertia;
+
+    balls->x[i] -= nx * depth;
+    balls->y[i] -= ny * depth;
+}
+
+void IntegrateShapes(BallStore *balls, const float gravity, const bool walls, const float dt) {
+    static const float wall_normals[4][2] = {{-1.0f, 0}, {1.0f, 0}, {0, -1.0f}, {0, 1.0f}};
+    const float wall_offsets[4] = {0, (float) WIN_WIDTH, 0, (float) WIN_HEIGHT}; // n . p of a point on each
+
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w] & balls->shaped[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+
+            balls->vy[i] += gravity * dt;
+            balls->x[i] += balls->vx[i] * dt;
+            balls->y[i] += balls->vy[i] * dt;
+            balls->angle[i] = remainderf(balls->angle[i] + balls->spin[i] * dt, 2.0f * (float) M_PI);
+            if (!walls) continue;
+
+            // the point of the shape furthest into each wall: a corner (or an edge's middle) of a box,
+            // the rounding around a capsule's end
+            for (int k = 0; k < 4; ++k) {
+                const float nx = wall_normals[k][0];
+                const float ny = wall_normals[k][1];
+                const float ux = cosf(balls->angle[i]);
+                const float uy = sinf(balls->angle[i]);
+                const float hl = balls->half_length[i];
+                const float hw = balls->half_width[i];
+
+                float px, py;
+                if (balls->shape[i] == BALL_SHAPE_BOX) {
+                    boxSupport(balls->x[i], balls->y[i], ux, uy, hl, hw, nx, ny, &px, &py);
+                } else {
+                    boxSupport(balls->x[i], balls->y[i], ux, uy, hl, 0, nx, ny, &px, &py);
+                    px += nx * hw;
+                    py += ny * hw;
+                }
+
+                const float depth = px * nx + py * ny - wall_offsets[k];
+                if (depth > 0) bounceOffWall(balls, i, nx, ny, depth, px, py);
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include "ball.h"
+#include "sweep.h"
+
+#define SHAPE_PARALLEL_EPSILON 0.5f // px, support points this close in depth share the contact
+
+// the shapes of a contact's two balls, lower shape first: one narrowphase kernel each
+typedef enum {
+    CONTACT_CIRCLE_CIRCLE,
+    CONTACT_CIRCLE_CAPSULE,
+    CONTACT_CIRCLE_BOX,
+    CONTACT_CAPSULE_CAPSULE,
+    CONTACT_CAPSULE_BOX,
+    CONTACT_BOX_BOX,
+    CONTACT_KIND_COUNT
+} ContactKind;
+
+// lo <= hi, rows of the upper triangle of the shape-by-shape table one after the other
+#define CONTACT_KIND(lo, hi) ((ContactKind) ((lo) * (2 * BALL_SHAPE_COUNT - 1 - (lo)) / 2 + (hi)))
+
+// resolves count contacts that are all of one kind, with a's shape <= b's. the circle-circle kernel is
+// HandleCollision, the others find the contact normal and point of their shapes and apply the same
+// halved impulse at that point, so the balls get spun as well as pushed. depth as HandleCollision
+void ResolveShapeContacts(BallStore *balls, ContactKind kind, const BallPair *contacts, size_t count, float *depth);
+
+// what IntegrateBalls does for circles, for every awake ball in balls->shaped: gravity, motion, rotation and,
+// with walls, a bounce off the window edges at the shape's corners instead of its bounding circle
+void IntegrateShapes(BallStore *balls, float gravity, bool walls, float dt);
+
+#endif
@@ -0,0 +1,36 @@
+#include "simd.h"
+
+static const char *const simd_level_names[SIMD_LEVEL_COUNT] = {"scalar", "sse2", "avx2", "avx512"};
+
+static SimdLevel simd_level = SIMD_SCALAR;
+
+
+SimdLevel SelectSimdLevel(void) {
+#if SIMD_DISPATCH
+    // the best the CPU (and the OS, for the wider registers) supports
+    SimdLevel level = SIMD_AVX512;
+    if (level == SIMD_AVX512 && !SDL_HasAVX512F()) level = SIMD_AVX2;
+    if (level == SIMD_AVX2 && !SDL_HasAVX2()) level = SIMD_SSE2;
+    if (level == SIMD_SSE2 && !SDL_HasSSE2()) level = SIMD_SCALAR;
+
+    // the override only ever goes down, a level the CPU lacks would crash
+    const char *env = SDL_getenv(SIMD_LEVEL_ENV);
+    for (int l = 0; env && l < (int) level; ++l) {
+        if (!SDL_strcasecmp(env, simd_level_names[l])) level = l;
+    }
+#else
+    // only one build of the kernels, the compiler flags picked it
+    const SimdLevel level = SIMD_BUILD_LEVEL;
+#endif
+
+    simd_level = level;
+    return level;
+}
+
+SimdLevel GetSimdLevel(void) {
+    return simd_level;
+}
+
+const char *SimdLevelName(const SimdLevel level) {
+    return level < SIMD_LEVEL_COUNT ? simd_level_names[level] : "unknown";
+}
@@ -0,0 +1,74 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <SDL.h>
+
+// numbered for the preprocessor, SIMD_BUILD_LEVEL is one of these
+#define SIMD_LEVEL_SCALAR 0
+#define SIMD_LEVEL_SSE2 1
+#define SIMD_LEVEL_AVX2 2
+#define SIMD_LEVEL_AVX512 3
+
+#define SIMD_LEVEL_ENV "SIM_SIMD" // scalar, sse2, avx2 or avx512: the fastest level the kernels may use
+
+typedef enum {
+    SIMD_SCALAR = SIMD_LEVEL_SCALAR,
+    SIMD_SSE2 = SIMD_LEVEL_SSE2,
+    SIMD_AVX2 = SIMD_LEVEL_AVX2,
+    SIMD_AVX512 = SIMD_LEVEL_AVX512,
+    SIMD_LEVEL_COUNT
+} SimdLevel;
+
+// the kernel sources (integrate.c, narrowphase.c, raster.c) are built once per level with SIMD_DISPATCH on and
+// SIMD_BUILD_LEVEL set, and SIMD_KERNEL gives each build's functions the name of its level. the scalar build
+// also holds the public functions, which hand over to the build of the level SelectSimdLevel picked.
+// without SIMD_DISPATCH a kernel source is built once, for whatever the compiler flags allow
+#ifndef SIMD_DISPATCH
+#define SIMD_DISPATCH 0
+#endif
+
+#ifndef SIMD_BUILD_LEVEL
+#if defined(__AVX512F__)
+#define SIMD_BUILD_LEVEL SIMD_LEVEL_AVX512
+#elif defined(__AVX2__)
+#define SIMD_BUILD_LEVEL SIMD_LEVEL_AVX2
+#elif defined(__SSE2__)
+#define SIMD_BUILD_LEVEL SIMD_LEVEL_SSE2
+#else
+#define SIMD_BUILD_LEVEL SIMD_LEVEL_SCALAR
+#endif
+#endif
+
+#if !SIMD_DISPATCH
+#define SIMD_KERNEL(name) name
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX512
+#define SIMD_KERNEL(name) name##Avx512
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_AVX2
+#define SIMD_KERNEL(name) name##Avx2
+#elif SIMD_BUILD_LEVEL == SIMD_LEVEL_SSE2
+#define SIMD_KERNEL(name) name##Sse2
+#else
+#define SIMD_KERNEL(name) name##Scalar
+#endif
+
+// every level's build of a kernel, for the public function in the scalar build
+#define SIMD_DECLARE_KERNEL(type, name, params) \
+    type name##Scalar params;                   \
+    type name##Sse2 params;                     \
+    type name##Avx2 params;                     \
+    type name##Avx512 params
+
+// the build of a kernel for the level in use
+#define SIMD_SELECT(name) \
+    ((const __typeof__(&name##Scalar)[SIMD_LEVEL_COUNT]) {name##Scalar, name##Sse2, name##Avx2, name##Avx512} \
+        [GetSimdLevel()])
+
+// the fastest level both this CPU and the build have, no faster than SIMD_LEVEL_ENV asks for.
+// InitWorld calls it, the kernels run scalar until then
+SimdLevel SelectSimdLevel(void);
+
+SimdLevel GetSimdLevel(void);
+
+const char *SimdLevelName(SimdLevel level);
+
+#endif
@@ -0,0 +1,188 @@
+#include "sleep.h"
+#include "world.h"
+#include <math.h>
+
+#define NO_BALL ((Uint32) -1)
+
+
+void FreeSleepIslands(SleepIslands *islands) {
+    SDL_free(islands->parent);
+    SDL_free(islands->island_still);
+    SDL_free(islands->island_head);
+    *islands = (SleepIslands) {0};
+}
+
+static bool reserveIslands(SleepIslands *islands, const size_t capacity) {
+    if (capacity <= islands->capacity) return true;
+
+    Uint32 *parent = SDL_realloc(islands->parent, capacity * sizeof(Uint32));
+    if (!parent) return false;
+    islands->parent = parent;
+
+    float *island_still = SDL_realloc(islands->island_still, capacity * sizeof(float));
+    if (!island_still) return false;
+    islands->island_still = island_still;
+
+    Uint32 *island_head = SDL_realloc(islands->island_head, capacity * sizeof(Uint32));
+    if (!island_head) return false;
+    islands->island_head = island_head;
+
+    islands->capacity = capacity;
+    return true;
+}
+
+void WakeIsland(BallStore *balls, const size_t i) {
+    size_t j = i;
+
+    do {
+        const size_t next = balls->island_next[j];
+
+        balls->idle[j / BALL_MASK_BITS] &= ~((Uint64) 1 << (j % BALL_MASK_BITS));
+        ResetBallLifetime(balls, j);
+        balls->still_time[j] = 0;
+        balls->island_next[j] = j;
+        balls->island_prev[j] = j;
+
+        j = next;
+    } while (j != i);
+}
+
+void SettleSleepingContacts(World *world) {
+    BallStore *balls = &world->balls;
+    Broadphase *broadphase = &world->broadphase;
+    size_t kept = 0;
+
+    for (size_t k = 0; k < broadphase->pair_count; ++k) {
+        const BallPair pair = broadphase->pairs[k];
+
+        // sleepers are always b, and may have been woken by an earlier pair
+        if (!IsBallIdle(balls, pair.b)) {
+            broadphase->pairs[kept++] = pair;
+            continue;
+        }
+
+        const float dx = balls->x[pair.b] - balls->x[pair.a];
+        const float dy = balls->y[pair.b] - balls->y[pair.a];
+        const float distance_sq = dx * dx + dy * dy;
+        const float reach = balls->radius[pair.a] + balls->radius[pair.b];
+        if (distance_sq >= reach * reach || distance_sq == 0) continue;
+
+        const float approach = (balls->vx[pair.a] * dx + balls->vy[pair.a] * dy) / sqrtf(distance_sq);
+        if (approach > BALL_WAKE_VELOCITY) {
+            WakeIsland(balls, pair.b);
+            broadphase->pairs[kept++] = pair;
+        } else {
+            HandleStaticCollision(balls, pair.a, pair.b);
+        }
+    }
+
+    broadphase->pair_count = kept;
+}
+
+static Uint32 findRoot(Uint32 *parent, Uint32 i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]]; // path halving
+        i = parent[i];
+    }
+    return i;
+}
+
+void UpdateIslands(World *world) {
+    BallStore *balls = &world->balls;
+    SleepIslands *islands = &world->islands;
+    const size_t words = balls->capacity / BALL_MASK_BITS;
+
+    if (!reserveIslands(islands, balls->capacity)) return;
+
+    // every ball that is still awake after integration starts as its own island
+    for (size_t w = 0; w < words; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const float speed_sq = balls->vx[i] * balls->vx[i] + balls->vy[i] * balls->vy[i];
+
+            balls->still_time[i] = speed_sq < BALL_SLEEP_VELOCITY * BALL_SLEEP_VELOCITY
+                                   ? balls->still_time[i] + STEP_TIME_S : 0;
+            islands->parent[i] = i;
+            islands->island_still[i] = balls->still_time[i];
+            islands->island_head[i] = NO_BALL;
+        }
+    }
+
+    // join the balls that touch, with a little slack so resting stacks stay connected
+    const BallPair *pairs = world->broadphase.pairs;
+    for (size_t k = 0; k < world->broadphase.pair_count; ++k) {
+        const Uint32 a = pairs[k].a;
+        const Uint32 b = pairs[k].b;
+        if (IsBallIdle(balls, a) || IsBallIdle(balls, b) || !IsBallVisible(balls, a) || !IsBallVisible(balls, b)) {
+            continue;
+        }
+
+        const float dx = balls->x[b] - balls->x[a];
+        const float dy = balls->y[b] - balls->y[a];
+        const float reach = balls->radius[a] + balls->radius[b] + 1.0f;
+        if (dx * dx + dy * dy >= reach * reach) continue;
+
+        const Uint32 root_a = findRoot(islands->parent, a);
+        const Uint32 root_b = findRoot(islands->parent, b);
+        if (root_a == root_b) continue;
+
+        islands->parent[root_b] = root_a;
+        islands->island_still[root_a] = SDL_min(islands->island_still[root_a], islands->island_still[root_b]);
+    }
+
+    // linked balls sleep and wake together, touching or not
+    const Constraints *constraints = &world->constraints;
+    for (size_t k = 0; k < constraints->count; ++k) {
+        const Uint32 a = constraints->list[k].a;
+        const Uint32 b = constraints->list[k].b;
+        if (IsBallIdle(balls, a) || IsBallIdle(balls, b)) continue;
+
+        const Uint32 root_a = findRoot(islands->parent, a);
+        const Uint32 root_b = findRoot(islands->parent, b);
+        if (root_a == root_b) continue;
+
+        islands->parent[root_b] = root_a;
+        islands->island_still[root_a] = SDL_min(islands->island_still[root_a], islands->island_still[root_b]);
+    }
+
+    const float sleep_time = BALL_SLEEP_TIME_MS / 1000.0f;
+    bool slept = false;
+
+    for (size_t w = 0; w < words; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            const Uint32 root = findRoot(islands->parent, i);
+            if (islands->island_still[root] < sleep_time) continue;
+
+            // link it into its island's circular list
+            const Uint32 head = islands->island_head[root];
+            if (head == NO_BALL) {
+                islands->island_head[root] = i;
+            } else {
+                balls->island_next[i] = balls->island_next[head];
+                balls->island_prev[i] = head;
+                balls->island_prev[balls->island_next[head]] = i;
+                balls->island_next[head] = i;
+            }
+
+            balls->vx[i] = 0;
+            balls->vy[i] = 0;
+            balls->spin[i] = 0;
+            slept = true;
+        }
+    }
+
+    // flag them only now, the loop above walks the awake mask
+    if (!slept) return;
+
+    for (size_t w = 0; w < words; ++w) {
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            if (islands->island_still[findRoot(islands->parent, i)] >= sleep_time) {
+                balls->idle[w] |= (Uint64) 1 << (i % BALL_MASK_BITS);
+            }
+        }
+    }
+
+    world->broadphase.sleepers_dirty = true;
+}
@@ -0,0 +1,27 @@
+#ifndef SLEEP_H
+#define SLEEP_H
+
+#include "ball.h"
+
+// scratch space for finding islands (groups of touching active balls) with union-find
+typedef struct {
+    size_t capacity;
+    Uint32 *parent;
+    float *island_still; // shortest still_time in the island, valid for roots
+    Uint32 *island_head; // first ball put to sleep in the island, valid for roots
+} SleepIslands;
+
+void FreeSleepIslands(SleepIslands *islands);
+
+// wakes the sleeping island ball i belongs to
+void WakeIsland(BallStore *balls, size_t i);
+
+// goes over the active/sleeping pairs of the broadphase: a ball running into a sleeping one fast enough
+// wakes its island and the pair stays for the solver, anything slower bounces off the sleeper as a static
+// collider and is taken out of the list
+void SettleSleepingContacts(World *world);
+
+// puts every island whose balls have all been slow for BALL_SLEEP_TIME_MS to sleep
+void UpdateIslands(World *world);
+
+#endif
@@ -0,0 +1,265 @@
+#include "solver.h"
+#include "narrowphase.h"
+#include <math.h>
+
+typedef struct {
+    BallStore *balls;
+    ContactKind kind;
+    const BallPair *contacts;
+    float *depth;
+} BatchTask;
+
+
+void InitContactSolver(ContactSolver *solver, int max_substeps, int max_iterations) {
+    *solver = (ContactSolver) {0};
+
+    const char *env = SDL_getenv(SOLVER_SUBSTEPS_ENV);
+    if (env) max_substeps = SDL_atoi(env);
+    env = SDL_getenv(SOLVER_ITERATIONS_ENV);
+    if (env) max_iterations = SDL_atoi(env);
+    env = SDL_getenv(SOLVER_DETERMINISTIC_ENV);
+    solver->deterministic = env ? SDL_atoi(env) != 0 : SOLVER_DETERMINISTIC;
+
+    solver->max_substeps = max_substeps > 0 ? max_substeps : SOLVER_SUBSTEPS;
+    solver->max_iterations = max_iterations > 0 ? max_iterations : SOLVER_ITERATIONS;
+    solver->substeps = 1;
+}
+
+void FreeContactSolver(ContactSolver *solver) {
+    SDL_free(solver->ball_colors);
+    SDL_free(solver->contacts);
+    SDL_free(solver->contact_color);
+    SDL_free(solver->batched);
+    SDL_free(solver->depth);
+    *solver = (ContactSolver) {0};
+}
+
+static bool reserveSolver(ContactSolver *solver, const size_t balls, const size_t contacts) {
+    if (balls > solver->ball_capacity) {
+        Uint64 *ball_colors = SDL_realloc(solver->ball_colors, balls * sizeof(Uint64));
+        if (!ball_colors) return false;
+        SDL_memset(ball_colors + solver->ball_capacity, 0, (balls - solver->ball_capacity) * sizeof(Uint64));
+        solver->ball_colors = ball_colors;
+        solver->ball_capacity = balls;
+    }
+
+    if (contacts > solver->contact_capacity) {
+        BallPair *list = SDL_realloc(solver->contacts, contacts * sizeof(BallPair));
+        if (!list) return false;
+        solver->contacts = list;
+
+        Uint8 *contact_color = SDL_realloc(solver->contact_color, contacts * sizeof(Uint8));
+        if (!contact_color) return false;
+        solver->contact_color = contact_color;
+
+        BallPair *batched = SDL_realloc(solver->batched, contacts * sizeof(BallPair));
+        if (!batched) return false;
+        solver->batched = batched;
+
+        float *depth = SDL_realloc(solver->depth, contacts * sizeof(float));
+        if (!depth) return false;
+        solver->depth = depth;
+
+        solver->contact_capacity = contacts;
+    }
+
+    return true;
+}
+
+// the pair with the lower shape first, as the kernels take them
+static inline BallPair orderContact(const BallStore *balls, const BallPair pair) {
+    if (balls->shape[pair.a] <= balls->shape[pair.b]) return pair;
+    return (BallPair) {.a = pair.b, .b = pair.a};
+}
+
+static inline ContactKind contactKind(const BallStore *balls, const BallPair ordered) {
+    return CONTACT_KIND(balls->shape[ordered.a], balls->shape[ordered.b]);
+}
+
+// a coloured batch shares no balls, so circle pairs can go through the vectorised kernel
+static void resolveBatch(BallStore *balls, const ContactKind kind, const BallPair *contacts, const size_t count,
+                         float *depth) {
+    if (kind == CONTACT_CIRCLE_CIRCLE) ResolveCircleBatch(balls, contacts, count, depth);
+    else ResolveShapeContacts(balls, kind, contacts, count, depth);
+}
+
+static void resolveBatchSlice(void *ctx, const size_t begin, const size_t end) {
+    const BatchTask *task = ctx;
+    resolveBatch(task->balls, task->kind, task->contacts + begin, end - begin, task->depth + begin);
+}
+
+// greedy colouring in pair order, then a counting sort of the contacts by colour into solver->batched
+static void buildBatches(ContactSolver *solver, const BallPair *contacts, const size_t count) {
+    Uint32 *start = solver->batch_start;
+    SDL_memset(start, 0, sizeof(solver->batch_start));
+
+    for (size_t k = 0; k < count; ++k) {
+        const BallPair pair = contacts[k];
+        const Uint64 taken = solver->ball_colors[pair.a] | solver->ball_colors[pair.b];
+
+        int color = SOLVER_MAX_COLORS;
+        if (taken != ~(Uint64) 0) {
+            color = (int) BALL_MASK_CTZ(~taken);
+            solver->ball_colors[pair.a] |= (Uint64) 1 << color;
+            solver->ball_colors[pair.b] |= (Uint64) 1 << color;
+        }
+
+        solver->contact_color[k] = color;
+        start[color + 1]++;
+    }
+
+    for (int c = 0; c <= SOLVER_MAX_COLORS; ++c) start[c + 1] += start[c];
+
+    solver->batch_count = 0;
+    for (int c = 0; c <= SOLVER_MAX_COLORS; ++c) {
+        if (start[c + 1] > start[c]) solver->batch_count = c + 1;
+    }
+
+    // stable scatter keeps the pair order inside a batch, and clears the colours for the next step
+    Uint32 cursor[SOLVER_MAX_COLORS + 1];
+    SDL_memcpy(cursor, start, sizeof(cursor));
+    for (size_t k = 0; k < count; ++k) {
+        const BallPair pair = contacts[k];
+        solver->batched[cursor[solver->contact_color[k]]++] = pair;
+        solver->ball_colors[pair.a] = 0;
+        solver->ball_colors[pair.b] = 0;
+    }
+}
+
+int ChooseSubsteps(ContactSolver *solver, const float step_time) {
+    // enough substeps that touching balls close in by at most SOLVER_SUBSTEP_TRAVEL per substep,
+    // and that the worst overlap of the last step would have been split into fixable pieces
+    const float by_travel = ceilf(solver->max_approach * step_time / SOLVER_SUBSTEP_TRAVEL);
+    const float by_penetration = ceilf(solver->max_penetration / SOLVER_SUBSTEP_PENETRATION);
+    const float wanted = fmaxf(fmaxf(by_travel, by_penetration), 1.0f);
+
+    solver->substeps = wanted < (float) solver->max_substeps ? (int) wanted : solver->max_substeps;
+    solver->max_penetration = 0;
+    solver->max_approach = 0;
+    return solver->substeps;
+}
+
+// one pass over the count contacts of one kind from first on, leaves each contact's overlap in depth
+// (in contacts order)
+static void resolvePass(ContactSolver *solver, WorkerPool *workers, BallStore *balls, const ContactKind kind,
+                        const size_t first, const size_t count) {
+    BallPair *contacts = solver->contacts + first;
+    float *depth = solver->depth + first;
+
+    if (!solver->deterministic && (workers->thread_count <= 1 || count < SOLVER_MIN_PARALLEL_BATCH)) {
+        ResolveShapeContacts(balls, kind, contacts, count, depth);
+        return;
+    }
+
+    buildBatches(solver, contacts, count);
+
+    // one batch per phase, the last (overflow) batch may share balls so it stays on this thread
+    for (int c = 0; c < solver->batch_count; ++c) {
+        const size_t begin = solver->batch_start[c];
+        const size_t size = solver->batch_start[c + 1] - begin;
+
+        if (c == SOLVER_MAX_COLORS) {
+            ResolveShapeContacts(balls, kind, solver->batched + begin, size, depth + begin);
+        } else if (size < SOLVER_MIN_PARALLEL_BATCH || workers->thread_count <= 1) {
+            resolveBatch(balls, kind, solver->batched + begin, size, depth + begin);
+        } else {
+            BatchTask task = {
+                    .balls = balls,
+                    .kind = kind,
+                    .contacts = solver->batched + begin,
+                    .depth = depth + begin
+            };
+            RunParallel(workers, size, resolveBatchSlice, &task);
+        }
+    }
+
+    // depth follows batch order now, so the batched order becomes the contact order
+    SDL_memcpy(contacts, solver->batched, count * sizeof(BallPair));
+}
+
+void ResolveContacts(ContactSolver *solver, WorkerPool *workers, BallStore *balls, const Obstacles *obstacles,
+                     const Terrain *terrain, const BallPair *pairs, const size_t count) {
+    solver->iterations = 0;
+    if (!count) return;
+
+    if (!reserveSolver(solver, balls->capacity, count)) {
+        // out of memory: a single plain pass is still better than nothing
+        for (size_t k = 0; k < count; ++k) {
+            const BallPair pair = orderContact(balls, pairs[k]);
+            float depth;
+            ResolveShapeContacts(balls, contactKind(balls, pair), &pair, 1, &depth);
+        }
+        solver->iterations = 1;
+        return;
+    }
+
+    // only pairs whose bounding circles touch right now take part, found several at a time into batched
+    size_t contact_count = FindContacts(balls, pairs, count, solver->batched, &solver->max_approach);
+
+    // their kind goes in contact_color for the sort
+    Uint32 *kind_start = solver->kind_start;
+    SDL_memset(kind_start, 0, sizeof(solver->kind_start));
+    for (size_t k = 0; k < contact_count; ++k) {
+        const BallPair pair = orderContact(balls, solver->batched[k]);
+        const ContactKind kind = contactKind(balls, pair);
+        solver->contact_color[k] = kind;
+        solver->contacts[k] = pair;
+        kind_start[kind + 1]++;
+    }
+
+    for (int kind = 0; kind < CONTACT_KIND_COUNT; ++kind) kind_start[kind + 1] += kind_start[kind];
+
+    // stable counting sort into one bucket per kind, unless they're all circles
+    if (kind_start[CONTACT_CIRCLE_CIRCLE + 1] != contact_count) {
+        Uint32 cursor[CONTACT_KIND_COUNT];
+        SDL_memcpy(cursor, kind_start, sizeof(cursor));
+        for (size_t k = 0; k < contact_count; ++k) {
+            solver->batched[cursor[solver->contact_color[k]]++] = solver->contacts[k];
+        }
+
+        BallPair *contacts = solver->contacts;
+        solver->contacts = solver->batched;
+        solver->batched = contacts;
+    }
+
+    while (contact_count && solver->iterations < solver->max_iterations) {
+        for (int kind = 0; kind < CONTACT_KIND_COUNT; ++kind) {
+            const size_t size = kind_start[kind + 1] - kind_start[kind];
+            if (size) resolvePass(solver, workers, balls, kind, kind_start[kind], size);
+        }
+
+        // level geometry doesn't give way: balls pushed into it go straight back out before the next pass,
+        // so a pile leans on the obstacle instead of squeezing its bottom row through
+        if (obstacles->node_count) {
+            for (size_t k = 0; k < contact_count; ++k) {
+                CollideBallObstacles(obstacles, balls, solver->contacts[k].a);
+                CollideBallObstacles(obstacles, balls, solver->contacts[k].b);
+            }
+        }
+        if (terrain->distance) {
+            for (size_t k = 0; k < contact_count; ++k) {
+                CollideBallTerrain(terrain, balls, solver->contacts[k].a);
+                CollideBallTerrain(terrain, balls, solver->contacts[k].b);
+            }
+        }
+
+        // a contact that had to be pushed apart noticeably may have pushed into its neighbours,
+        // it goes round again. contacts that were (nearly) fine drop out, so sparse areas finish early
+        // the buckets shrink in place
+        size_t kept = 0;
+        size_t begin = 0;
+        for (int kind = 0; kind < CONTACT_KIND_COUNT; ++kind) {
+            const size_t end = kind_start[kind + 1];
+            for (size_t k = begin; k < end; ++k) {
+                const float depth = solver->depth[k];
+                if (!solver->iterations) solver->max_penetration = fmaxf(solver->max_penetration, depth);
+                if (depth > SOLVER_PENETRATION_SLOP) solver->contacts[kept++] = solver->contacts[k];
+            }
+            kind_start[kind + 1] = kept;
+            begin = end;
+        }
+
+        contact_count = kept;
+        solver->iterations++;
+    }
+}
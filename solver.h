@@ -0,0 +1,73 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "ball.h"
+#include "obstacles.h"
+#include "shapes.h"
+#include "terrain.h"
+#include "sweep.h"
+#include "workers.h"
+
+#ifndef SOLVER_DETERMINISTIC
+#define SOLVER_DETERMINISTIC 0 // the DETERMINISTIC build option turns this on
+#endif
+
+#define SOLVER_MAX_COLORS 64 // contacts that don't fit in these go into one last batch run on a single thread
+#define SOLVER_MIN_PARALLEL_BATCH 256 // smaller batches aren't worth waking the workers for
+#define SOLVER_SUBSTEPS 4 // default upper bound on substeps per step
+#define SOLVER_ITERATIONS 8 // default upper bound on passes over the contacts per substep
+#define SOLVER_SUBSTEPS_ENV "SIM_SUBSTEPS" // overrides the substep bound when set
+#define SOLVER_ITERATIONS_ENV "SIM_ITERATIONS" // overrides the iteration bound when set
+#define SOLVER_DETERMINISTIC_ENV "SIM_DETERMINISTIC" // 1 or 0 overrides the build's default
+#define SOLVER_PENETRATION_SLOP 0.5f // px, contacts pushed apart by less than this are done for the substep
+#define SOLVER_SUBSTEP_TRAVEL (BALL_RADIUS * 0.25f) // px of closing distance per substep between touching balls
+#define SOLVER_SUBSTEP_PENETRATION (BALL_RADIUS * 0.25f) // px of overlap per substep the solver is expected to fix
+
+// contacts are bucketed by the shapes of their balls (ContactKind) and each bucket is handed to its own
+// narrowphase kernel; a scene of circles only is one bucket. the candidate pairs are filtered down to contacts
+// by FindContacts, several pairs per instruction.
+// within a bucket, contacts are split into batches by greedy graph colouring: no ball appears twice in a batch,
+// so a batch can be resolved by all threads at once without locks, and circle batches several contacts per
+// instruction by ResolveCircleBatch.
+// batch c is contacts[batch_start[c]] .. contacts[batch_start[c + 1]]
+//
+// each substep makes up to max_iterations passes, but only contacts that still needed pushing apart in
+// one pass take part in the next, so a crowded pile gets all of them and a lone pair just one or two.
+// the number of substeps follows the deepest overlap and fastest closing speed seen in the last step.
+//
+// in deterministic mode contacts are always coloured, even on one thread: the batches come out the same
+// whatever the thread count, and since no ball is in a batch twice the order within one doesn't matter,
+// so the ball state after a step is bit-identical on 1 or 64 threads.
+typedef struct {
+    bool deterministic;
+    int max_substeps;
+    int max_iterations;
+    float max_penetration; // deepest overlap found this step, px
+    float max_approach; // fastest closing speed between touching balls this step, px/s
+    int substeps; // what the current step uses
+    int iterations; // passes made by the last ResolveContacts call
+    size_t ball_capacity;
+    Uint64 *ball_colors; // colours already taken by each ball's contacts
+    size_t contact_capacity;
+    BallPair *contacts;
+    Uint8 *contact_color;
+    BallPair *batched;
+    float *depth; // overlap each contact had in the last pass, in contacts order
+    Uint32 kind_start[CONTACT_KIND_COUNT + 1]; // contacts are sorted by kind, each kind's batches run on their own
+    Uint32 batch_start[SOLVER_MAX_COLORS + 2];
+    int batch_count;
+} ContactSolver;
+
+// max_substeps or max_iterations <= 0 fall back to SOLVER_SUBSTEPS and SOLVER_ITERATIONS
+void InitContactSolver(ContactSolver *solver, int max_substeps, int max_iterations);
+
+void FreeContactSolver(ContactSolver *solver);
+
+// picks this step's substep count from what the last step ran into and starts measuring again
+int ChooseSubsteps(ContactSolver *solver, float step_time);
+
+// resolves the candidate pairs over one substep, in parallel batches when the pool has more than one thread
+void ResolveContacts(ContactSolver *solver, WorkerPool *workers, BallStore *balls, const Obstacles *obstacles,
+                     const Terrain *terrain, const BallPair *pairs, size_t count);
+
+#endif
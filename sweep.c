@@ -0,0 +1,235 @@
+#include "sweep.h"
+
+#define PAIR_EMPTY (~(Uint64) 0)
+
+
+static Uint64 pairKey(const Uint32 a, const Uint32 b) {
+    return a < b ? ((Uint64) a << 32) | b : ((Uint64) b << 32) | a;
+}
+
+static size_t pairHash(const Uint64 key, const size_t table_size) {
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (table_size - 1);
+}
+
+static size_t findPair(const PairSet *set, const Uint64 key) {
+    if (!set->table_size) return -1;
+
+    for (size_t i = pairHash(key, set->table_size); set->keys[i] != PAIR_EMPTY; i = (i + 1) & (set->table_size - 1)) {
+        if (set->keys[i] == key) return i;
+    }
+    return -1;
+}
+
+static bool growTable(PairSet *set) {
+    const size_t table_size = set->table_size ? set->table_size * 2 : 64;
+    Uint64 *keys = SDL_malloc(table_size * sizeof(Uint64));
+    Uint32 *slots = SDL_malloc(table_size * sizeof(Uint32));
+    if (!keys || !slots) {
+        SDL_free(keys);
+        SDL_free(slots);
+        return false;
+    }
+
+    for (size_t i = 0; i < table_size; ++i) keys[i] = PAIR_EMPTY;
+
+    // re-insert from the dense array, the table order does not matter
+    for (size_t slot = 0; slot < set->count; ++slot) {
+        const Uint64 key = pairKey(set->pairs[slot].a, set->pairs[slot].b);
+        size_t i = pairHash(key, table_size);
+        while (keys[i] != PAIR_EMPTY) i = (i + 1) & (table_size - 1);
+        keys[i] = key;
+        slots[i] = slot;
+    }
+
+    SDL_free(set->keys);
+    SDL_free(set->slots);
+    set->keys = keys;
+    set->slots = slots;
+    set->table_size = table_size;
+    return true;
+}
+
+bool AddPair(PairSet *set, const Uint32 a, const Uint32 b) {
+    const Uint64 key = pairKey(a, b);
+    if (findPair(set, key) != (size_t) -1) return true;
+
+    // keep the table at most half full
+    if ((set->count + 1) * 2 > set->table_size && !growTable(set)) return false;
+
+    if (set->count == set->capacity) {
+        const size_t capacity = set->capacity ? set->capacity * 2 : 32;
+        BallPair *pairs = SDL_realloc(set->pairs, capacity * sizeof(BallPair));
+        if (!pairs) return false;
+        set->pairs = pairs;
+        set->capacity = capacity;
+    }
+
+    size_t i = pairHash(key, set->table_size);
+    while (set->keys[i] != PAIR_EMPTY) i = (i + 1) & (set->table_size - 1);
+
+    set->keys[i] = key;
+    set->slots[i] = set->count;
+    set->pairs[set->count++] = (BallPair) {.a = key >> 32, .b = (Uint32) key};
+    return true;
+}
+
+void RemovePair(PairSet *set, const Uint32 a, const Uint32 b) {
+    size_t i = findPair(set, pairKey(a, b));
+    if (i == (size_t) -1) return;
+
+    // swap the last pair into the hole of the dense array
+    const Uint32 slot = set->slots[i];
+    if (slot != --set->count) {
+        set->pairs[slot] = set->pairs[set->count];
+        set->slots[findPair(set, pairKey(set->pairs[slot].a, set->pairs[slot].b))] = slot;
+    }
+
+    // backward-shift deletion, pulls later entries of the probe run into the hole
+    const size_t mask = set->table_size - 1;
+    for (size_t j = (i + 1) & mask; set->keys[j] != PAIR_EMPTY; j = (j + 1) & mask) {
+        const size_t home = pairHash(set->keys[j], set->table_size);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            set->keys[i] = set->keys[j];
+            set->slots[i] = set->slots[j];
+            i = j;
+        }
+    }
+    set->keys[i] = PAIR_EMPTY;
+}
+
+static void clearPairSet(PairSet *set) {
+    for (size_t i = 0; i < set->table_size; ++i) set->keys[i] = PAIR_EMPTY;
+    set->count = 0;
+}
+
+void FreePairSet(PairSet *set) {
+    SDL_free(set->pairs);
+    SDL_free(set->keys);
+    SDL_free(set->slots);
+    *set = (PairSet) {0};
+}
+
+void FreeSweepAndPrune(SweepAndPrune *sap) {
+    SDL_free(sap->endpoints);
+    SDL_free(sap->members);
+    SDL_free(sap->departed);
+    FreePairSet(&sap->overlaps);
+    *sap = (SweepAndPrune) {0};
+}
+
+static bool reserveSweep(SweepAndPrune *sap, const size_t capacity) {
+    const size_t words = BALL_MASK_WORDS(capacity);
+
+    if (words > sap->member_words) {
+        Uint64 *members = SDL_realloc(sap->members, words * sizeof(Uint64));
+        if (!members) return false;
+        SDL_memset(members + sap->member_words, 0, (words - sap->member_words) * sizeof(Uint64));
+        sap->members = members;
+
+        Uint64 *departed = SDL_realloc(sap->departed, words * sizeof(Uint64));
+        if (!departed) return false;
+        sap->departed = departed;
+        sap->member_words = words;
+    }
+
+    if (capacity * 2 > sap->capacity) {
+        SweepEndpoint *endpoints = SDL_realloc(sap->endpoints, capacity * 2 * sizeof(SweepEndpoint));
+        if (!endpoints) return false;
+        sap->endpoints = endpoints;
+        sap->capacity = capacity * 2;
+    }
+
+    return true;
+}
+
+static bool isDeparted(const Uint64 *departed, const Uint32 i) {
+    return (departed[i / BALL_MASK_BITS] >> (i % BALL_MASK_BITS)) & 1;
+}
+
+// drops the balls that are no longer active, their pairs and their endpoints
+static void removeDeparted(SweepAndPrune *sap, const Uint64 *departed) {
+    // backwards, so the pair swapped into a hole has already been looked at
+    for (size_t k = sap->overlaps.count; k-- > 0;) {
+        const BallPair pair = sap->overlaps.pairs[k];
+        if (isDeparted(departed, pair.a) || isDeparted(departed, pair.b)) {
+            RemovePair(&sap->overlaps, pair.a, pair.b);
+        }
+    }
+
+    size_t count = 0;
+    for (size_t k = 0; k < sap->count; ++k) {
+        if (!isDeparted(departed, sap->endpoints[k].id >> 1)) sap->endpoints[count++] = sap->endpoints[k];
+    }
+    sap->count = count;
+}
+
+void ResetSweepAndPrune(SweepAndPrune *sap) {
+    sap->count = 0;
+    SDL_memset(sap->members, 0, sap->member_words * sizeof(Uint64));
+    clearPairSet(&sap->overlaps);
+}
+
+bool UpdateSweepAndPrune(SweepAndPrune *sap, const BallStore *balls) {
+    const size_t words = BALL_MASK_WORDS(balls->capacity);
+    if (!reserveSweep(sap, balls->capacity)) return false;
+
+    // balls that went idle or disappeared since the last step
+    Uint64 *departed = sap->departed;
+    bool any_departed = false;
+    for (size_t w = 0; w < sap->member_words; ++w) {
+        const Uint64 active = w < words ? balls->visible[w] & ~balls->idle[w] : 0;
+        departed[w] = sap->members[w] & ~active;
+        sap->members[w] &= active;
+        any_departed |= departed[w] != 0;
+    }
+    if (any_departed) removeDeparted(sap, departed);
+
+    // move the remaining endpoints to this step's positions
+    for (size_t k = 0; k < sap->count; ++k) {
+        const Uint32 i = sap->endpoints[k].id >> 1;
+        const float r = balls->radius[i];
+        sap->endpoints[k].value = (sap->endpoints[k].id & 1) ? balls->x[i] + r : balls->x[i] - r;
+    }
+
+    // newcomers go to the back, the sort below moves them into place and finds their pairs
+    for (size_t w = 0; w < words; ++w) {
+        Uint64 arrived = balls->visible[w] & ~balls->idle[w] & ~sap->members[w];
+        sap->members[w] |= arrived;
+
+        while (arrived) {
+            const Uint32 i = w * BALL_MASK_BITS + BALL_MASK_CTZ(arrived);
+            arrived &= arrived - 1;
+
+            const float r = balls->radius[i];
+            sap->endpoints[sap->count++] = (SweepEndpoint) {.value = balls->x[i] - r, .id = i << 1};
+            sap->endpoints[sap->count++] = (SweepEndpoint) {.value = balls->x[i] + r, .id = (i << 1) | 1};
+        }
+    }
+
+    // insertion sort, nearly linear while balls barely move between steps
+    for (size_t k = 1; k < sap->count; ++k) {
+        const SweepEndpoint e = sap->endpoints[k];
+        size_t j = k;
+
+        while (j > 0 && sap->endpoints[j - 1].value > e.value) {
+            const SweepEndpoint other = sap->endpoints[j - 1];
+
+            if ((e.id ^ other.id) & 1) {
+                if (e.id & 1) {
+                    // a max passing a min to the left: the intervals no longer overlap
+                    RemovePair(&sap->overlaps, e.id >> 1, other.id >> 1);
+                } else if (!AddPair(&sap->overlaps, e.id >> 1, other.id >> 1)) {
+                    // a min passing a max to the left starts an overlap, start over next step if it can't be stored
+                    ResetSweepAndPrune(sap);
+                    return false;
+                }
+            }
+
+            sap->endpoints[j--] = other;
+        }
+
+        sap->endpoints[j] = e;
+    }
+
+    return true;
+}
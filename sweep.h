@@ -0,0 +1,53 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "ball.h"
+
+typedef struct {
+    Uint32 a;
+    Uint32 b;
+} BallPair;
+
+// set of ball pairs: dense array to walk, open-addressed index (linear probing) to find a pair's slot
+typedef struct {
+    size_t count;
+    size_t capacity;
+    BallPair *pairs;
+    size_t table_size;
+    Uint64 *keys;
+    Uint32 *slots;
+} PairSet;
+
+typedef struct {
+    float value;
+    Uint32 id; // ball index << 1, low bit set for the max endpoint
+} SweepEndpoint;
+
+// sweep-and-prune along x: endpoints stay sorted between steps and are repaired with an insertion sort,
+// every swap of a min and a max endpoint adds or removes a pair from the persistent overlap set
+typedef struct {
+    size_t count;
+    size_t capacity;
+    SweepEndpoint *endpoints;
+    size_t member_words;
+    Uint64 *members;
+    Uint64 *departed; // member_words of scratch, the members that left during an update
+    PairSet overlaps;
+} SweepAndPrune;
+
+void FreeSweepAndPrune(SweepAndPrune *sap);
+
+// brings the endpoint order and the overlap set up to date with the active balls,
+// returns false if it ran out of memory
+bool UpdateSweepAndPrune(SweepAndPrune *sap, const BallStore *balls);
+
+// forgets every endpoint and overlap, the next update starts over from the active balls
+void ResetSweepAndPrune(SweepAndPrune *sap);
+
+bool AddPair(PairSet *set, Uint32 a, Uint32 b);
+
+void RemovePair(PairSet *set, Uint32 a, Uint32 b);
+
+void FreePairSet(PairSet *set);
+
+#endif
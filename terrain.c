@@ -0,0 +1,316 @@
+#include "terrain.h"
+#include "window.h"
+#include <math.h>
+
+#define TERRAIN_FAR 1e20f // squared distance of a cell no seed has reached yet
+#define TERRAIN_MAX_SIDE 8192 // samples per row or column a field file may have
+
+
+void FreeTerrain(Terrain *terrain) {
+    SDL_free(terrain->distance);
+    *terrain = (Terrain) {0};
+}
+
+// --- building
+
+// exact squared distance transform of one line (Felzenszwalb & Huttenlocher): d[q] = min over p of
+// (q - p)^2 + f[p], from the lower envelope of the parabolas rooted at each p. v and z hold n + 1 entries
+static void transformLine(const float *f, float *d, const int n, int *v, float *z) {
+    int k = 0;
+    v[0] = 0;
+    z[0] = -TERRAIN_FAR;
+    z[1] = TERRAIN_FAR;
+
+    for (int q = 1; q < n; ++q) {
+        float s;
+        for (;;) {
+            const int p = v[k];
+            s = ((f[q] + (float) (q * q)) - (f[p] + (float) (p * p))) / (float) (2 * q - 2 * p);
+            if (s > z[k] || k == 0) break;
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = TERRAIN_FAR;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < (float) q) k++;
+        d[q] = (float) ((q - v[k]) * (q - v[k])) + f[v[k]];
+    }
+}
+
+// squared distance in cells from every cell to the nearest one where seed == want, columns then rows
+static void distanceField(const Uint8 *seed, const Uint8 want, const int width, const int height, float *field,
+                          float *line, float *out, int *v, float *z) {
+    for (int k = 0; k < width * height; ++k) field[k] = seed[k] == want ? 0 : TERRAIN_FAR;
+
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < height; ++y) line[y] = field[y * width + x];
+        transformLine(line, out, height, v, z);
+        for (int y = 0; y < height; ++y) field[y * width + x] = out[y];
+    }
+
+    for (int y = 0; y < height; ++y) {
+        SDL_memcpy(line, &field[y * width], width * sizeof(float));
+        transformLine(line, &field[y * width], width, v, z);
+    }
+}
+
+bool BuildTerrain(Terrain *terrain, const Uint8 *solid, const int width, const int height, const float cell_size) {
+    if (width < 2 || height < 2 || !(cell_size > 0)) return false;
+
+    // a frame of solid cells around the mask, so the grid's edges are walls
+    const int pw = width + 2;
+    const int ph = height + 2;
+    const int side = pw > ph ? pw : ph;
+    const size_t cells = (size_t) pw * (size_t) ph;
+
+    Uint8 *mask = SDL_malloc(cells);
+    float *to_solid = SDL_malloc(cells * sizeof(float));
+    float *to_free = SDL_malloc(cells * sizeof(float));
+    float *lines = SDL_malloc(3 * ((size_t) side + 1) * sizeof(float));
+    int *v = SDL_malloc(((size_t) side + 1) * sizeof(int));
+    float *distance = SDL_malloc((size_t) width * (size_t) height * sizeof(float));
+
+    const bool ok = mask && to_solid && to_free && lines && v && distance;
+    if (ok) {
+        for (int y = 0; y < ph; ++y) {
+            for (int x = 0; x < pw; ++x) {
+                const bool frame = x == 0 || y == 0 || x == pw - 1 || y == ph - 1;
+                mask[y * pw + x] = frame || solid[(y - 1) * width + (x - 1)] ? 1 : 0;
+            }
+        }
+
+        float *line = lines;
+        float *out = lines + side + 1;
+        float *z = lines + 2 * (side + 1);
+        distanceField(mask, 1, pw, ph, to_solid, line, out, v, z);
+        distanceField(mask, 0, pw, ph, to_free, line, out, v, z);
+
+        // the surface runs halfway between a solid cell and a free one
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const size_t k = (size_t) (y + 1) * pw + (size_t) (x + 1);
+                distance[y * width + x] = mask[k] ? -(sqrtf(to_free[k]) - 0.5f) * cell_size
+                                                  : (sqrtf(to_solid[k]) - 0.5f) * cell_size;
+            }
+        }
+
+        FreeTerrain(terrain);
+        *terrain = (Terrain) {.width = width, .height = height, .cell_size = cell_size, .distance = distance};
+    } else {
+        SDL_free(distance);
+    }
+
+    SDL_free(mask);
+    SDL_free(to_solid);
+    SDL_free(to_free);
+    SDL_free(lines);
+    SDL_free(v);
+    return ok;
+}
+
+// --- loading
+
+// the image stretched over the window, one cell every TERRAIN_CELL_SIZE px
+static bool loadImage(Terrain *terrain, const char *path) {
+    SDL_Surface *loaded = SDL_LoadBMP(path);
+    if (!loaded) return false;
+    SDL_Surface *image = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if (!image) return false;
+
+    const int width = (int) ceilf((float) WIN_WIDTH / TERRAIN_CELL_SIZE);
+    const int height = (int) ceilf((float) WIN_HEIGHT / TERRAIN_CELL_SIZE);
+    Uint8 *solid = SDL_malloc((size_t) width * (size_t) height);
+    bool ok = solid && SDL_LockSurface(image) == 0;
+
+    if (ok) {
+        for (int y = 0; y < height; ++y) {
+            const int py = (int) (((float) y + 0.5f) * (float) image->h / (float) height);
+            const Uint32 *row = (const Uint32 *) ((const Uint8 *) image->pixels + py * image->pitch);
+
+            for (int x = 0; x < width; ++x) {
+                const int px = (int) (((float) x + 0.5f) * (float) image->w / (float) width);
+                Uint8 r, g, b, a;
+                SDL_GetRGBA(row[px], image->format, &r, &g, &b, &a);
+
+                const int luminance = (r * 77 + g * 150 + b * 29) >> 8;
+                solid[y * width + x] = a >= 128 && luminance < TERRAIN_SOLID_LEVEL;
+            }
+        }
+        SDL_UnlockSurface(image);
+
+        ok = BuildTerrain(terrain, solid, width, height, TERRAIN_CELL_SIZE);
+    }
+
+    SDL_free(solid);
+    SDL_FreeSurface(image);
+    return ok;
+}
+
+static Uint32 readU32(const Uint8 *bytes) {
+    Uint32 value;
+    SDL_memcpy(&value, bytes, sizeof(value));
+    return SDL_SwapLE32(value);
+}
+
+static float readFloat(const Uint8 *bytes) {
+    float value;
+    SDL_memcpy(&value, bytes, sizeof(value));
+    return SDL_SwapFloatLE(value);
+}
+
+// a field computed elsewhere, taken as it is
+static bool loadField(Terrain *terrain, const char *path) {
+    size_t size;
+    Uint8 *bytes = SDL_LoadFile(path, &size);
+    if (!bytes) return false;
+
+    const Uint32 width = size >= 12 ? readU32(bytes) : 0;
+    const Uint32 height = size >= 12 ? readU32(bytes + 4) : 0;
+    const float cell_size = size >= 12 ? readFloat(bytes + 8) : 0;
+
+    bool ok = width >= 2 && height >= 2 && width <= TERRAIN_MAX_SIDE && height <= TERRAIN_MAX_SIDE &&
+              cell_size > 0 && size == 12 + (size_t) width * height * sizeof(float);
+    float *distance = ok ? SDL_malloc((size_t) width * height * sizeof(float)) : NULL;
+    ok = ok && distance;
+
+    if (ok) {
+        for (size_t k = 0; k < (size_t) width * height; ++k) distance[k] = readFloat(bytes + 12 + k * sizeof(float));
+
+        FreeTerrain(terrain);
+        *terrain = (Terrain) {.width = (int) width, .height = (int) height, .cell_size = cell_size,
+                              .distance = distance};
+    } else {
+        SDL_Log("%s: not a terrain field\n", path);
+    }
+
+    SDL_free(bytes);
+    return ok;
+}
+
+bool LoadTerrain(Terrain *terrain, const char *path) {
+    const size_t length = SDL_strlen(path);
+    if (length >= 4 && !SDL_strcasecmp(path + length - 4, ".bmp")) return loadImage(terrain, path);
+    return loadField(terrain, path);
+}
+
+// --- queries
+
+float SampleTerrain(const Terrain *terrain, const float x, const float y, float *nx, float *ny) {
+    const int width = terrain->width;
+
+    // grid coordinates, clamped to the outermost samples
+    const float u = x / terrain->cell_size - 0.5f;
+    const float v = y / terrain->cell_size - 0.5f;
+    const float cu = fminf(fmaxf(u, 0), (float) (width - 1));
+    const float cv = fminf(fmaxf(v, 0), (float) (terrain->height - 1));
+    const int x0 = SDL_min((int) cu, width - 2);
+    const int y0 = SDL_min((int) cv, terrain->height - 2);
+    const float fu = cu - (float) x0;
+    const float fv = cv - (float) y0;
+
+    // bilinear in the cell, its slope gives the normal
+    const float *row = &terrain->distance[y0 * width + x0];
+    const float top = row[0] + (row[1] - row[0]) * fu;
+    const float bottom = row[width] + (row[width + 1] - row[width]) * fu;
+    float distance = top + (bottom - top) * fv;
+    float gx = (row[1] - row[0]) * (1.0f - fv) + (row[width + 1] - row[width]) * fv;
+    float gy = bottom - top;
+
+    // beyond the grid it's solid, deeper the further out
+    const float ox = (cu - u) * terrain->cell_size;
+    const float oy = (cv - v) * terrain->cell_size;
+    const float outside = sqrtf(ox * ox + oy * oy);
+    if (outside > 0) {
+        distance -= outside;
+        gx = ox;
+        gy = oy;
+    }
+
+    const float length = sqrtf(gx * gx + gy * gy);
+    *nx = length > 0 ? gx / length : 0;
+    *ny = length > 0 ? gy / length : -1.0f;
+    return distance;
+}
+
+bool CollideBallTerrain(const Terrain *terrain, BallStore *balls, const size_t i) {
+    float nx, ny;
+    const float depth = balls->radius[i] - SampleTerrain(terrain, balls->x[i], balls->y[i], &nx, &ny);
+    if (depth <= 0) return false;
+
+    balls->x[i] += depth * nx;
+    balls->y[i] += depth * ny;
+
+    const float approach = balls->vx[i] * nx + balls->vy[i] * ny;
+    if (approach >= 0) return false;
+
+    const Uint8 m = balls->material[i];
+    const float bounce = balls->materials.restitution[m];
+    balls->vx[i] -= (1 + bounce) * approach * nx;
+    balls->vy[i] -= (1 + bounce) * approach * ny;
+    if (-approach * bounce >= BALL_REST_VELOCITY) return false;
+
+    // barely bouncing: it rolls along the surface, slowed like on the floor, and stops on level enough ground
+    const float along = (balls->vx[i] * -ny + balls->vy[i] * nx) * (1.0f - balls->materials.friction[m]);
+    balls->vx[i] -= along * -ny;
+    balls->vy[i] -= along * nx;
+
+    if (ny > -TERRAIN_REST_SLOPE || fabsf(balls->vx[i] * -ny + balls->vy[i] * nx) >= BALL_IDLE_VELOCITY) return false;
+
+    balls->vx[i] = 0;
+    balls->vy[i] = 0;
+    return true;
+}
+
+size_t CollideTerrain(const Terrain *terrain, BallStore *balls) {
+    if (!terrain->distance) return 0;
+
+    size_t idle_count = 0;
+    for (size_t w = 0; w < balls->capacity / BALL_MASK_BITS; ++w) {
+        Uint64 went_idle = 0;
+
+        for (Uint64 bits = balls->visible[w] & ~balls->idle[w]; bits; bits &= bits - 1) {
+            const size_t i = w * BALL_MASK_BITS + BALL_MASK_CTZ(bits);
+            if (CollideBallTerrain(terrain, balls, i)) went_idle |= (Uint64) 1 << (i % BALL_MASK_BITS);
+        }
+
+        balls->idle[w] |= went_idle;
+        idle_count += BALL_MASK_POPCOUNT(went_idle);
+    }
+
+    return idle_count;
+}
+
+bool SweepTerrain(const Terrain *terrain, const float x, const float y, const float vx, const float vy, const float r,
+                  float *time, float *nx, float *ny) {
+    const float speed = sqrtf(vx * vx + vy * vy);
+    if (!terrain->distance || speed == 0) return false;
+
+    // the ball can't reach the surface before it has travelled the sampled distance, so that's the next step
+    float t = 0;
+    for (int n = 0; n < TERRAIN_MARCH_STEPS; ++n) {
+        float sx, sy;
+        float gap = SampleTerrain(terrain, x + vx * t, y + vy * t, &sx, &sy) - r;
+
+        if (gap <= TERRAIN_SKIN) {
+            if (vx * sx + vy * sy < 0) {
+                *time = t;
+                *nx = sx;
+                *ny = sy;
+                return true;
+            }
+            // touching but on its way out
+            gap = TERRAIN_SKIN;
+        }
+
+        t += gap / speed;
+        if (t >= *time) return false;
+    }
+
+    return false;
+}
@@ -0,0 +1,49 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "ball.h"
+
+#define TERRAIN_CELL_SIZE 2.0f // px between distance samples when converting an image
+#define TERRAIN_SOLID_LEVEL 128 // image pixels darker than this (and opaque) are terrain
+#define TERRAIN_SKIN 0.25f // px, a swept ball this close to the surface has hit it
+#define TERRAIN_MARCH_STEPS 16 // sphere-tracing steps per sweep, a path that needs more is left to CollideTerrain
+#define TERRAIN_REST_SLOPE 0.9f // a resting ball only goes idle on ground whose normal points at least this far up
+#define TERRAIN_FILE_ENV "SIM_TERRAIN" // terrain file loaded at startup when set
+
+// signed distance to the terrain surface sampled on a regular grid: positive in free space, negative inside.
+// a ball looks up the four samples around its centre and gets the distance and the surface normal from
+// them, the same cost whatever the terrain looks like. everything outside the grid counts as solid,
+// so the terrain takes the place of the window walls
+typedef struct {
+    int width;
+    int height;
+    float cell_size; // px, sample (x, y) sits at ((x + 0.5) * cell_size, (y + 0.5) * cell_size)
+    float *distance; // px, row-major, NULL when there is no terrain
+} Terrain;
+
+void FreeTerrain(Terrain *terrain);
+
+// computes the field from a row-major mask of width * height cells, non-zero ones are solid
+bool BuildTerrain(Terrain *terrain, const Uint8 *solid, int width, int height, float cell_size);
+
+// reads either a .bmp image, stretched over the window with dark pixels as terrain, or a precomputed field:
+//   Uint32 width, Uint32 height, float cell_size, then width * height float distances,
+// all little-endian. false on a read or format error
+bool LoadTerrain(Terrain *terrain, const char *path);
+
+// distance from (x, y) to the surface and the direction it grows in, the outward normal when inside
+float SampleTerrain(const Terrain *terrain, float x, float y, float *nx, float *ny);
+
+// pushes ball i out of the terrain and bounces it off, returns whether it came to rest on level enough ground
+bool CollideBallTerrain(const Terrain *terrain, BallStore *balls, size_t i);
+
+// CollideBallTerrain for every active ball, flags the ones that came to rest idle and returns how many did
+size_t CollideTerrain(const Terrain *terrain, BallStore *balls);
+
+// earliest time within *time a ball of radius r at (x, y) moving at (vx, vy) touches the terrain, found by
+// stepping along the path by the sampled distance. on a hit, *time and the surface normal are updated and
+// true is returned
+bool SweepTerrain(const Terrain *terrain, float x, float y, float vx, float vy, float r, float *time, float *nx,
+                  float *ny);
+
+#endif
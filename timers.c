@@ -0,0 +1,90 @@
+#include "timers.h"
+
+#define TIMER_POOL_INITIAL_CAPACITY 64
+
+
+void InitTimerWheel(TimerWheel *wheel) {
+    *wheel = (TimerWheel) {.free_head = TIMER_NONE, .fired = TIMER_NONE};
+    SDL_memset(wheel->head, 0xFF, sizeof(wheel->head));
+}
+
+void FreeTimerWheel(TimerWheel *wheel) {
+    SDL_free(wheel->timers);
+    InitTimerWheel(wheel);
+}
+
+static bool growPool(TimerWheel *wheel) {
+    const size_t capacity = wheel->capacity ? wheel->capacity * 2 : TIMER_POOL_INITIAL_CAPACITY;
+    if (capacity > TIMER_NONE) return false;
+
+    Timer *timers = SDL_realloc(wheel->timers, capacity * sizeof(Timer));
+    if (!timers) return false;
+    wheel->timers = timers;
+
+    // pushed in reverse so the lowest entry is handed out first
+    for (size_t t = capacity; t-- > wheel->capacity;) {
+        timers[t].next = wheel->free_head;
+        wheel->free_head = t;
+    }
+    wheel->capacity = capacity;
+    return true;
+}
+
+// onto the level of the highest bit group where due and now differ, in the slot due's group picks there
+static void place(TimerWheel *wheel, const Uint32 t) {
+    const Uint32 due = wheel->timers[t].due;
+    const Uint32 diff = due ^ wheel->now;
+    const int level = diff ? (31 - __builtin_clz(diff)) / TIMER_WHEEL_BITS : 0;
+    const Uint32 slot = (due >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+
+    wheel->timers[t].next = wheel->head[level][slot];
+    wheel->head[level][slot] = t;
+}
+
+bool ScheduleTimer(TimerWheel *wheel, Uint32 due, const Uint32 id, const Uint32 tag) {
+    if (wheel->free_head == TIMER_NONE && !growPool(wheel)) return false;
+
+    // the slot of now has gone off already
+    if ((Sint32) (due - wheel->now) <= 0) due = wheel->now + 1;
+
+    const Uint32 t = wheel->free_head;
+    wheel->free_head = wheel->timers[t].next;
+    wheel->timers[t] = (Timer) {.due = due, .id = id, .tag = tag};
+    place(wheel, t);
+    return true;
+}
+
+Uint32 AdvanceTimers(TimerWheel *wheel) {
+    // the last tick's timers go back to the pool
+    if (wheel->fired != TIMER_NONE) {
+        Uint32 last = wheel->fired;
+        while (wheel->timers[last].next != TIMER_NONE) last = wheel->timers[last].next;
+        wheel->timers[last].next = wheel->free_head;
+        wheel->free_head = wheel->fired;
+    }
+
+    const Uint32 now = ++wheel->now;
+
+    // every level whose slot now ends moves the next one down, top first so a timer can fall
+    // through several levels in one tick
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+        const int shift = level * TIMER_WHEEL_BITS;
+        if (now & ((1u << shift) - 1)) continue;
+
+        const Uint32 slot = (now >> shift) & (TIMER_WHEEL_SLOTS - 1);
+        Uint32 t = wheel->head[level][slot];
+        wheel->head[level][slot] = TIMER_NONE;
+
+        while (t != TIMER_NONE) {
+            const Uint32 next = wheel->timers[t].next;
+            place(wheel, t);
+            t = next;
+        }
+    }
+
+    // everything left in now's level 0 slot is due exactly now
+    const Uint32 slot = now & (TIMER_WHEEL_SLOTS - 1);
+    wheel->fired = wheel->head[0][slot];
+    wheel->head[0][slot] = TIMER_NONE;
+    return wheel->fired;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_BITS 6 // slots per level as a power of two
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 6 // 6 * TIMER_WHEEL_BITS covers every bit of a Uint32 tick
+#define TIMER_NONE ((Uint32) -1)
+
+// one scheduled event: what it is about (id, tag) is up to the caller, next links the slot's list
+typedef struct {
+    Uint32 due;
+    Uint32 id;
+    Uint32 tag;
+    Uint32 next;
+} Timer;
+
+// hierarchical timer wheel over Uint32 ticks that wrap around: a timer sits on the level of the highest
+// TIMER_WHEEL_BITS group in which its due tick differs from now, in the slot that group of due selects.
+// when now enters that slot the timer moves down a level, and it fires from level 0, so a tick costs
+// the timers firing plus the ones moving down
+typedef struct {
+    Uint32 now;
+    Timer *timers;
+    size_t capacity;
+    Uint32 free_head;
+    Uint32 head[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    Uint32 fired; // the list that went off at now, valid until the next AdvanceTimers
+} TimerWheel;
+
+void InitTimerWheel(TimerWheel *wheel);
+
+void FreeTimerWheel(TimerWheel *wheel);
+
+// due has to be less than 2^31 ticks ahead, a timer that is already due fires on the next tick.
+// false if the pool couldn't grow
+bool ScheduleTimer(TimerWheel *wheel, Uint32 due, Uint32 id, Uint32 tag);
+
+// moves on by one tick, returns the first timer that fired (TIMER_NONE if none did), the rest follow its next
+Uint32 AdvanceTimers(TimerWheel *wheel);
+
+#endif
@@ -0,0 +1,84 @@
+#include "workers.h"
+
+
+static size_t sliceStart(const WorkerPool *pool, const int index) {
+    return pool->count * index / pool->thread_count;
+}
+
+static int workerMain(void *data) {
+    Worker *worker = data;
+    WorkerPool *pool = worker->pool;
+
+    while (true) {
+        SDL_SemWait(worker->start);
+        if (pool->quit) break;
+
+        const size_t begin = sliceStart(pool, worker->index);
+        const size_t end = sliceStart(pool, worker->index + 1);
+        if (begin < end) pool->task(pool->ctx, begin, end);
+
+        SDL_SemPost(pool->done);
+    }
+
+    return 0;
+}
+
+bool InitWorkerPool(WorkerPool *pool, int thread_count) {
+    *pool = (WorkerPool) {0};
+
+    const char *env = SDL_getenv(WORKER_THREADS_ENV);
+    if (env) thread_count = SDL_atoi(env);
+    if (thread_count <= 0) thread_count = SDL_GetCPUCount();
+    if (thread_count > MAX_WORKER_THREADS) thread_count = MAX_WORKER_THREADS;
+
+    pool->thread_count = 1;
+    pool->done = SDL_CreateSemaphore(0);
+    if (!pool->done) return false;
+
+    for (int i = 1; i < thread_count; ++i) {
+        Worker *worker = &pool->workers[i];
+        *worker = (Worker) {.pool = pool, .index = i, .start = SDL_CreateSemaphore(0)};
+        if (!worker->start) break;
+
+        worker->thread = SDL_CreateThread(workerMain, "physics worker", worker);
+        if (!worker->thread) {
+            SDL_DestroySemaphore(worker->start);
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    // fewer threads than asked for is fine, the slices just get bigger
+    return true;
+}
+
+void FreeWorkerPool(WorkerPool *pool) {
+    pool->quit = true;
+
+    for (int i = 1; i < pool->thread_count; ++i) {
+        SDL_SemPost(pool->workers[i].start);
+        SDL_WaitThread(pool->workers[i].thread, NULL);
+        SDL_DestroySemaphore(pool->workers[i].start);
+    }
+
+    if (pool->done) SDL_DestroySemaphore(pool->done);
+    *pool = (WorkerPool) {0};
+}
+
+void RunParallel(WorkerPool *pool, const size_t count, const WorkerTask task, void *ctx) {
+    if (pool->thread_count <= 1 || count < (size_t) pool->thread_count) {
+        if (count) task(ctx, 0, count);
+        return;
+    }
+
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->count = count;
+
+    for (int i = 1; i < pool->thread_count; ++i) SDL_SemPost(pool->workers[i].start);
+
+    task(ctx, 0, sliceStart(pool, 1));
+
+    for (int i = 1; i < pool->thread_count; ++i) SDL_SemWait(pool->done);
+}
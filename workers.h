@@ -0,0 +1,41 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+#define MAX_WORKER_THREADS 64
+#define WORKER_THREADS_ENV "SIM_THREADS" // overrides the thread count, 1 runs everything on the calling thread
+
+// work on [begin, end) of a range split across the pool
+typedef void (*WorkerTask)(void *ctx, size_t begin, size_t end);
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct {
+    WorkerPool *pool;
+    int index;
+    SDL_Thread *thread;
+    SDL_sem *start;
+} Worker;
+
+// threads sleep on their own semaphore until RunParallel hands them a slice, the caller takes slice 0
+struct WorkerPool {
+    int thread_count; // including the calling thread
+    Worker workers[MAX_WORKER_THREADS];
+    SDL_sem *done;
+    WorkerTask task;
+    void *ctx;
+    size_t count;
+    bool quit;
+};
+
+// thread_count <= 0 picks one per CPU (or WORKER_THREADS_ENV if set)
+bool InitWorkerPool(WorkerPool *pool, int thread_count);
+
+void FreeWorkerPool(WorkerPool *pool);
+
+// splits [0, count) into one contiguous slice per thread and returns once every slice is done
+void RunParallel(WorkerPool *pool, size_t count, WorkerTask task, void *ctx);
+
+#endif
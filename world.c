@@ -0,0 +1,131 @@
+#include "world.h"
+#include "simd.h"
+
+
+bool InitWorld(World *world, const int thread_count) {
+    *world = (World) {0};
+    SelectSimdLevel();
+    InitContactSolver(&world->solver, SOLVER_SUBSTEPS, SOLVER_ITERATIONS);
+    InitNBody(&world->gravity, NBODY_THETA);
+    InitFluid(&world->sph);
+
+    if (!InitBallStore(&world->balls, BALL_POOL_INITIAL_CAPACITY, BALL_POOL_MAX_CAPACITY) ||
+        !InitBroadphase(&world->broadphase, BROADPHASE_GRID) ||
+        !InitWorkerPool(&world->workers, thread_count)) {
+        FreeWorld(world);
+        return false;
+    }
+
+    return true;
+}
+
+void FreeWorld(World *world) {
+    FreeQuantizedBalls(&world->quantized_balls);
+    FreeFluid(&world->sph);
+    FreeNBody(&world->gravity);
+    FreeConstraints(&world->constraints);
+    FreeTerrain(&world->terrain);
+    FreeObstacles(&world->obstacles);
+    FreeEventSimulation(&world->events);
+    FreeWorkerPool(&world->workers);
+    FreeSleepIslands(&world->islands);
+    FreeContactSolver(&world->solver);
+    FreeBroadphase(&world->broadphase);
+    FreeBallStore(&world->balls);
+}
+
+const char *SimulationEngineName(const SimulationEngine engine) {
+    switch (engine) {
+        case SIM_ENGINE_EVENTS:
+            return "event driven";
+        case SIM_ENGINE_STEPPED:
+        default:
+            return "fixed step";
+    }
+}
+
+bool SetSimulationEngine(World *world, const SimulationEngine engine) {
+    if (engine == world->engine) return true;
+    if (world->quantized) return false;
+
+    if (engine == SIM_ENGINE_EVENTS) {
+        if (world->obstacles.count || world->terrain.distance || world->constraints.count || world->nbody ||
+            world->fluid) {
+            return false;
+        }
+        if (!StartEventSimulation(&world->events, &world->balls)) return false;
+    } else {
+        // the event engine sets idle flags on its own, the sleeping grid has to catch up
+        world->broadphase.sleepers_dirty = true;
+    }
+
+    world->engine = engine;
+    return true;
+}
+
+bool SetQuantizedStorage(World *world, const bool quantized) {
+    if (quantized == world->quantized) return true;
+
+    if (quantized) {
+        if (world->engine != SIM_ENGINE_STEPPED || world->obstacles.count || world->terrain.distance ||
+            world->constraints.count || world->nbody || world->fluid) {
+            return false;
+        }
+        if (!ReserveQuantizedBalls(&world->quantized_balls, world->balls.capacity)) return false;
+
+        SDL_memset(world->quantized_balls.packed, 0, world->balls.capacity / BALL_MASK_BITS * sizeof(Uint64));
+        PackNewBalls(&world->quantized_balls, &world->balls);
+    } else {
+        UnpackBalls(&world->quantized_balls, &world->balls);
+        world->broadphase.sleepers_dirty = true;
+    }
+
+    world->quantized = quantized;
+    return true;
+}
+
+bool SetNBodyGravity(World *world, const bool nbody) {
+    if (nbody && (world->engine != SIM_ENGINE_STEPPED || world->quantized || world->fluid)) return false;
+
+    world->nbody = nbody;
+    return true;
+}
+
+bool SetFluidMode(World *world, const bool fluid) {
+    if (fluid == world->fluid) return true;
+    if (fluid && (world->engine != SIM_ENGINE_STEPPED || world->quantized || world->nbody ||
+                  world->constraints.count)) {
+        return false;
+    }
+
+    // the particles moved without the sleeping grid knowing
+    if (!fluid) world->broadphase.sleepers_dirty = true;
+
+    world->fluid = fluid;
+    return true;
+}
+
+bool SortWorldBalls(World *world) {
+    // the event engine and the quantized storage keep state per slot of their own
+    if (world->engine != SIM_ENGINE_STEPPED || world->quantized) return false;
+    if (!SortBallStore(&world->balls)) return false;
+
+    RemapConstraints(&world->constraints, &world->balls);
+    ResetSweepAndPrune(&world->broadphase.sap);
+    world->broadphase.sleepers_dirty = true;
+    return true;
+}
+
+void FastForwardWorld(World *world, const double seconds) {
+    BallStore *balls = &world->balls;
+
+    if (world->engine == SIM_ENGINE_EVENTS) {
+        AdvanceEventSimulation(&world->events, balls, seconds);
+    } else {
+        for (double t = 0; t < seconds; t += STEP_TIME_S) UpdateBalls(world);
+    }
+
+    // nothing to interpolate from after a jump
+    SDL_memcpy(balls->prev_x, balls->x, balls->capacity * sizeof(float));
+    SDL_memcpy(balls->prev_y, balls->y, balls->capacity * sizeof(float));
+}
@@ -1,6 +1,91 @@
 #ifndef WORLD_H
 #define WORLD_H
 
+#include "ball.h"
+#include "broadphase.h"
+#include "constraints.h"
+#include "events.h"
+#include "fluid.h"
+#include "nbody.h"
+#include "obstacles.h"
+#include "quantize.h"
+#include "sleep.h"
+#include "solver.h"
+#include "terrain.h"
+#include "window.h"
+#include "workers.h"
+
 #define FLOOR_FRICTION 0.95f
+#define WORLD_GRAVITY (SDL_STANDARD_GRAVITY * 60.0f) // px/s^2, same pull as the old one-step-per-60Hz-frame integration
+
+// where the centre of a ball of radius r may go, the window shrunk by that radius
+#define WORLD_MIN_X(r) (r)
+#define WORLD_MAX_X(r) ((float) WIN_WIDTH - (r))
+#define WORLD_MIN_Y(r) (r)
+#define WORLD_MAX_Y(r) ((float) WIN_HEIGHT - (r))
+
+#define PHYSICS_HZ 60 // fixed simulation rate, independent of TARGET_FPS
+#define STEP_TIME_S (1.0f / PHYSICS_HZ)
+#define STEP_TIME_MS (1000 / PHYSICS_HZ)
+#define MAX_STEPS_PER_FRAME 8 // catch-up limit, whatever is left of a longer frame is dropped
+#define FAST_FORWARD_S 60.0 // simulated seconds skipped by FastForwardWorld from the keyboard
+
+typedef enum {
+    SIM_ENGINE_STEPPED, // fixed steps: broadphase, solver, integration
+    SIM_ENGINE_EVENTS, // jumps from one predicted contact to the next, see events.h
+    SIM_ENGINE_COUNT
+} SimulationEngine;
+
+// everything one simulation step reads or writes
+struct World {
+    SimulationEngine engine;
+    BallStore balls;
+    Broadphase broadphase;
+    ContactSolver solver;
+    SleepIslands islands;
+    WorkerPool workers;
+    EventSimulation events;
+    Obstacles obstacles; // static level geometry, see LoadObstacles
+    Terrain terrain; // replaces the window walls when loaded, see LoadTerrain
+    Constraints constraints; // links between balls, see AddConstraint
+    bool nbody; // balls attract each other instead of falling, see SetNBodyGravity
+    NBody gravity;
+    bool fluid; // the balls are SPH particles, see SetFluidMode
+    Fluid sph;
+    bool quantized; // ballistic motion on QuantizedBalls only, see SetQuantizedStorage
+    QuantizedBalls quantized_balls;
+};
+
+// thread_count as for InitWorkerPool
+bool InitWorld(World *world, int thread_count);
+
+void FreeWorld(World *world);
+
+const char *SimulationEngineName(SimulationEngine engine);
+
+// switching to the event engine hands it the current ball state, false (staying put) if that fails.
+// the event engine only knows the window edges and uniform gravity, so it isn't available once obstacles or
+// terrain are loaded, balls are linked or in n-body or fluid mode
+bool SetSimulationEngine(World *world, SimulationEngine engine);
+
+// compact storage for very large populations: the state moves into QuantizedBalls and steps only
+// integrate it, there are no ball-to-ball or obstacle contacts. fixed-step engine under uniform gravity without
+// obstacles, terrain or links outside n-body and fluid mode only, false if that or memory fails
+bool SetQuantizedStorage(World *world, bool quantized);
+
+// n-body mode: the balls pull on each other, see NBody, and the uniform downward gravity is off.
+// fixed-step engine with float storage outside fluid mode only, false otherwise
+bool SetNBodyGravity(World *world, bool nbody);
+
+// fluid mode: every visible ball is a particle of one SPH fluid, see Fluid, in place of the ball contacts.
+// fixed-step engine with float storage under uniform gravity and without links only, false otherwise
+bool SetFluidMode(World *world, bool fluid);
+
+// SortBallStore, with everything that holds on to ball slots brought along. fixed-step engine with
+// float storage only, false otherwise or if nothing moved
+bool SortWorldBalls(World *world);
+
+// runs the simulation for `seconds` without rendering, in one jump on the event engine
+void FastForwardWorld(World *world, double seconds);
 
 #endif